@@ -0,0 +1,528 @@
+// Decoder for blocks and transactions from the queryd publisher.
+//
+// Messages are parsed with satoshi_load while the GIL is released.
+// Fields become Python objects only when they are first read. They
+// use the same keys and layout as bitcoin.parse_block() and
+// parse_transaction(), so subscribers see no difference apart from speed.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <memory>
+#include <bitcoin/bitcoin.hpp>
+
+constexpr Py_ssize_t header_size = 80;
+
+// Runs without the GIL so it must not touch Python objects.
+template <typename Message>
+bool load_message(const char* data, Py_ssize_t size, Message& result)
+{
+    const uint8_t* begin = reinterpret_cast<const uint8_t*>(data);
+    try
+    {
+        bc::satoshi_load(begin, begin + size, result);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return true;
+}
+
+PyObject* bytes(const uint8_t* data, size_t size)
+{
+    return PyString_FromStringAndSize(
+        reinterpret_cast<const char*>(data), size);
+}
+template <typename Container>
+PyObject* bytes(const Container& data)
+{
+    return bytes(data.data(), data.size());
+}
+
+// Script address helpers stay in deserialize.py so addresses match the
+// pure Python decoder exactly. They're only called for inputs and
+// outputs that are actually read.
+PyObject* deserialize_function(const char* name)
+{
+    static PyObject* module = nullptr;
+    if (!module)
+    {
+        module = PyImport_ImportModule("bcquery.deserialize");
+        if (!module)
+        {
+            PyErr_Clear();
+            module = PyImport_ImportModule("deserialize");
+        }
+        if (!module)
+            return nullptr;
+    }
+    return PyObject_GetAttrString(module, name);
+}
+
+PyObject* call_deserialize(const char* name, const bc::data_chunk& script)
+{
+    PyObject* function = deserialize_function(name);
+    if (!function)
+        return nullptr;
+    PyObject* result = PyObject_CallFunction(function, const_cast<char*>("s#"),
+        reinterpret_cast<const char*>(script.data()),
+        static_cast<Py_ssize_t>(script.size()));
+    Py_DECREF(function);
+    return result;
+}
+
+struct block_object
+{
+    PyObject_HEAD
+    std::shared_ptr<bc::block_type>* blk;
+    uint8_t header[header_size];
+    // Fields read so far.
+    PyObject* fields;
+};
+
+struct transaction_object
+{
+    PyObject_HEAD
+    // The block or lone transaction that tx points into.
+    std::shared_ptr<const void>* owner;
+    const bc::transaction_type* tx;
+    PyObject* fields;
+};
+
+PyTypeObject block_type = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    "bcquery._native.Block", sizeof(block_object)};
+PyTypeObject transaction_type = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    "bcquery._native.Transaction", sizeof(transaction_object)};
+
+const char* const block_keys[] = {
+    "version", "hashPrev", "hashMerkleRoot", "nTime", "nBits", "nNonce",
+    "__header__", "hash", "transactions", nullptr};
+const char* const transaction_keys[] = {
+    "version", "inputs", "outputs", "lockTime", "hash", nullptr};
+
+const char* const* keys_of(block_object*)
+{
+    return block_keys;
+}
+const char* const* keys_of(transaction_object*)
+{
+    return transaction_keys;
+}
+
+PyObject* new_transaction(std::shared_ptr<const void> owner,
+    const bc::transaction_type& tx)
+{
+    transaction_object* result =
+        PyObject_New(transaction_object, &transaction_type);
+    if (!result)
+        return nullptr;
+    result->fields = PyDict_New();
+    if (!result->fields)
+    {
+        result->owner = nullptr;
+        Py_DECREF(result);
+        return nullptr;
+    }
+    result->owner = new std::shared_ptr<const void>(owner);
+    result->tx = &tx;
+    return reinterpret_cast<PyObject*>(result);
+}
+
+PyObject* materialize_inputs(const bc::transaction_type& tx)
+{
+    PyObject* inputs = PyList_New(tx.inputs.size());
+    if (!inputs)
+        return nullptr;
+    for (size_t i = 0; i < tx.inputs.size(); ++i)
+    {
+        const bc::transaction_input_type& input = tx.inputs[i];
+        const bc::data_chunk script = bc::save_script(input.input_script);
+        PyObject* address = nullptr;
+        PyObject* signatures = nullptr;
+        if (script.empty())
+        {
+            Py_INCREF(Py_None);
+            address = Py_None;
+            signatures = PyList_New(0);
+        }
+        else
+        {
+            // Returns (pubkeys, signatures, address).
+            PyObject* found = call_deserialize(
+                "get_address_from_input_script", script);
+            if (found && PyTuple_Check(found) && PyTuple_Size(found) == 3)
+            {
+                address = PyTuple_GET_ITEM(found, 2);
+                signatures = PyTuple_GET_ITEM(found, 1);
+                Py_INCREF(address);
+                Py_INCREF(signatures);
+            }
+            else if (found)
+                PyErr_SetString(PyExc_TypeError,
+                    "Unexpected get_address_from_input_script result");
+            Py_XDECREF(found);
+        }
+        PyObject* entry = nullptr;
+        if (address && signatures)
+            entry = Py_BuildValue("{s:N,s:k,s:k,s:O,s:O}",
+                "prevout_hash", bytes(bc::encode_hex(
+                    input.previous_output.hash)),
+                "prevout_n", static_cast<unsigned long>(
+                    input.previous_output.index),
+                "sequence", static_cast<unsigned long>(input.sequence),
+                "address", address,
+                "signatures", signatures);
+        Py_XDECREF(address);
+        Py_XDECREF(signatures);
+        if (!entry)
+        {
+            Py_DECREF(inputs);
+            return nullptr;
+        }
+        PyList_SET_ITEM(inputs, i, entry);
+    }
+    return inputs;
+}
+
+PyObject* materialize_outputs(const bc::transaction_type& tx)
+{
+    PyObject* outputs = PyList_New(tx.outputs.size());
+    if (!outputs)
+        return nullptr;
+    for (size_t i = 0; i < tx.outputs.size(); ++i)
+    {
+        const bc::transaction_output_type& output = tx.outputs[i];
+        const bc::data_chunk script = bc::save_script(output.output_script);
+        PyObject* address = call_deserialize(
+            "get_address_from_output_script", script);
+        PyObject* entry = nullptr;
+        if (address)
+            entry = Py_BuildValue("{s:L,s:N,s:N,s:n}",
+                "value", static_cast<PY_LONG_LONG>(output.value),
+                "address", address,
+                "raw_output_script", bytes(bc::encode_hex(script)),
+                "index", static_cast<Py_ssize_t>(i));
+        if (!entry)
+        {
+            Py_DECREF(outputs);
+            return nullptr;
+        }
+        PyList_SET_ITEM(outputs, i, entry);
+    }
+    return outputs;
+}
+
+// New reference, or nullptr without an exception set for unknown keys.
+PyObject* materialize(block_object* self, const std::string& key)
+{
+    const bc::block_type& blk = **self->blk;
+    if (key == "version")
+        return PyInt_FromLong(static_cast<int32_t>(blk.version));
+    // Hashes inside the header stay in wire order, as in deserialize.py.
+    if (key == "hashPrev")
+        return bytes(self->header + 4, 32);
+    if (key == "hashMerkleRoot")
+        return bytes(self->header + 36, 32);
+    if (key == "nTime")
+        return PyLong_FromUnsignedLong(blk.timestamp);
+    if (key == "nBits")
+        return PyLong_FromUnsignedLong(blk.bits);
+    if (key == "nNonce")
+        return PyLong_FromUnsignedLong(blk.nonce);
+    if (key == "__header__")
+        return bytes(self->header, header_size);
+    if (key == "hash")
+        return bytes(bc::hash_block_header(blk));
+    if (key == "transactions")
+    {
+        PyObject* txs = PyList_New(blk.transactions.size());
+        if (!txs)
+            return nullptr;
+        for (size_t i = 0; i < blk.transactions.size(); ++i)
+        {
+            PyObject* tx = new_transaction(*self->blk, blk.transactions[i]);
+            if (!tx)
+            {
+                Py_DECREF(txs);
+                return nullptr;
+            }
+            PyList_SET_ITEM(txs, i, tx);
+        }
+        return txs;
+    }
+    return nullptr;
+}
+
+PyObject* materialize(transaction_object* self, const std::string& key)
+{
+    const bc::transaction_type& tx = *self->tx;
+    if (key == "version")
+        return PyInt_FromLong(static_cast<int32_t>(tx.version));
+    if (key == "inputs")
+        return materialize_inputs(tx);
+    if (key == "outputs")
+        return materialize_outputs(tx);
+    if (key == "lockTime")
+        return PyLong_FromUnsignedLong(tx.locktime);
+    if (key == "hash")
+        return bytes(bc::hash_transaction(tx));
+    return nullptr;
+}
+
+template <typename Object>
+PyObject* lookup(PyObject* object, PyObject* key)
+{
+    Object* self = reinterpret_cast<Object*>(object);
+    PyObject* value = PyDict_GetItem(self->fields, key);
+    if (value)
+    {
+        Py_INCREF(value);
+        return value;
+    }
+    if (!PyString_Check(key))
+    {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return nullptr;
+    }
+    value = materialize(self, PyString_AS_STRING(key));
+    if (!value)
+    {
+        if (!PyErr_Occurred())
+            PyErr_SetObject(PyExc_KeyError, key);
+        return nullptr;
+    }
+    if (PyDict_SetItem(self->fields, key, value) < 0)
+    {
+        Py_DECREF(value);
+        return nullptr;
+    }
+    return value;
+}
+
+template <typename Object>
+int contains(PyObject* object, PyObject* key)
+{
+    if (!PyString_Check(key))
+        return 0;
+    const std::string name = PyString_AS_STRING(key);
+    for (const char* const* entry = keys_of((Object*)nullptr);
+        *entry; ++entry)
+        if (name == *entry)
+            return 1;
+    return 0;
+}
+
+template <typename Object>
+Py_ssize_t length(PyObject*)
+{
+    Py_ssize_t count = 0;
+    for (const char* const* entry = keys_of((Object*)nullptr);
+        *entry; ++entry)
+        ++count;
+    return count;
+}
+
+template <typename Object>
+PyObject* keys(PyObject*, PyObject*)
+{
+    PyObject* result = PyList_New(0);
+    for (const char* const* entry = keys_of((Object*)nullptr);
+        result && *entry; ++entry)
+    {
+        PyObject* key = PyString_FromString(*entry);
+        if (!key || PyList_Append(result, key) < 0)
+            Py_CLEAR(result);
+        Py_XDECREF(key);
+    }
+    return result;
+}
+
+template <typename Object>
+PyObject* iterate(PyObject* object)
+{
+    PyObject* names = keys<Object>(object, nullptr);
+    if (!names)
+        return nullptr;
+    PyObject* result = PyObject_GetIter(names);
+    Py_DECREF(names);
+    return result;
+}
+
+template <typename Object>
+PyObject* get(PyObject* object, PyObject* args)
+{
+    PyObject* key;
+    PyObject* fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O", &key, &fallback))
+        return nullptr;
+    PyObject* value = lookup<Object>(object, key);
+    if (value || !PyErr_ExceptionMatches(PyExc_KeyError))
+        return value;
+    PyErr_Clear();
+    Py_INCREF(fallback);
+    return fallback;
+}
+
+// Reads every field into a plain dict.
+template <typename Object>
+PyObject* to_dict(PyObject* object, PyObject*)
+{
+    PyObject* result = PyDict_New();
+    for (const char* const* entry = keys_of((Object*)nullptr);
+        result && *entry; ++entry)
+    {
+        PyObject* key = PyString_FromString(*entry);
+        PyObject* value = key ? lookup<Object>(object, key) : nullptr;
+        if (!value || PyDict_SetItem(result, key, value) < 0)
+            Py_CLEAR(result);
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+    }
+    return result;
+}
+
+template <typename Object>
+PyObject* items(PyObject* object, PyObject*)
+{
+    PyObject* fields = to_dict<Object>(object, nullptr);
+    if (!fields)
+        return nullptr;
+    PyObject* result = PyDict_Items(fields);
+    Py_DECREF(fields);
+    return result;
+}
+
+void block_dealloc(PyObject* object)
+{
+    block_object* self = reinterpret_cast<block_object*>(object);
+    delete self->blk;
+    Py_XDECREF(self->fields);
+    PyObject_Del(object);
+}
+
+void transaction_dealloc(PyObject* object)
+{
+    transaction_object* self = reinterpret_cast<transaction_object*>(object);
+    delete self->owner;
+    Py_XDECREF(self->fields);
+    PyObject_Del(object);
+}
+
+template <typename Object>
+struct mapping_slots
+{
+    static PyMappingMethods mapping;
+    static PySequenceMethods sequence;
+    static PyMethodDef methods[];
+};
+template <typename Object>
+PyMappingMethods mapping_slots<Object>::mapping = {
+    length<Object>, lookup<Object>, nullptr};
+template <typename Object>
+PySequenceMethods mapping_slots<Object>::sequence = {
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    contains<Object>};
+template <typename Object>
+PyMethodDef mapping_slots<Object>::methods[] = {
+    {"keys", keys<Object>, METH_NOARGS, nullptr},
+    {"items", items<Object>, METH_NOARGS, nullptr},
+    {"get", get<Object>, METH_VARARGS, nullptr},
+    {"to_dict", to_dict<Object>, METH_NOARGS,
+        "Read every field into a plain dict."},
+    {nullptr}};
+
+template <typename Object>
+int ready_type(PyTypeObject& type, destructor dealloc, const char* doc)
+{
+    type.tp_dealloc = dealloc;
+    type.tp_flags = Py_TPFLAGS_DEFAULT;
+    type.tp_doc = doc;
+    type.tp_as_mapping = &mapping_slots<Object>::mapping;
+    type.tp_as_sequence = &mapping_slots<Object>::sequence;
+    type.tp_iter = iterate<Object>;
+    type.tp_methods = mapping_slots<Object>::methods;
+    return PyType_Ready(&type);
+}
+
+PyObject* decode_block(PyObject*, PyObject* args)
+{
+    const char* data;
+    Py_ssize_t size;
+    if (!PyArg_ParseTuple(args, "s#", &data, &size))
+        return nullptr;
+    if (size < header_size)
+    {
+        PyErr_SetString(PyExc_ValueError, "Block is too short");
+        return nullptr;
+    }
+    auto blk = std::make_shared<bc::block_type>();
+    bool decoded;
+    Py_BEGIN_ALLOW_THREADS
+    decoded = load_message(data, size, *blk);
+    Py_END_ALLOW_THREADS
+    if (!decoded)
+    {
+        PyErr_SetString(PyExc_ValueError, "Malformed block");
+        return nullptr;
+    }
+    block_object* result = PyObject_New(block_object, &block_type);
+    if (!result)
+        return nullptr;
+    result->blk = new std::shared_ptr<bc::block_type>(blk);
+    std::copy(data, data + header_size, result->header);
+    result->fields = PyDict_New();
+    if (!result->fields)
+    {
+        Py_DECREF(result);
+        return nullptr;
+    }
+    return reinterpret_cast<PyObject*>(result);
+}
+
+PyObject* decode_transaction(PyObject*, PyObject* args)
+{
+    const char* data;
+    Py_ssize_t size;
+    if (!PyArg_ParseTuple(args, "s#", &data, &size))
+        return nullptr;
+    auto tx = std::make_shared<bc::transaction_type>();
+    bool decoded;
+    Py_BEGIN_ALLOW_THREADS
+    decoded = load_message(data, size, *tx);
+    Py_END_ALLOW_THREADS
+    if (!decoded)
+    {
+        PyErr_SetString(PyExc_ValueError, "Malformed transaction");
+        return nullptr;
+    }
+    return new_transaction(tx, *tx);
+}
+
+PyMethodDef module_methods[] = {
+    {"decode_block", decode_block, METH_VARARGS,
+        "Decode a raw block into a lazily read Block mapping."},
+    {"decode_transaction", decode_transaction, METH_VARARGS,
+        "Decode a raw transaction into a lazily read Transaction mapping."},
+    {nullptr}};
+
+PyMODINIT_FUNC init_native()
+{
+    if (ready_type<block_object>(block_type, block_dealloc,
+            "Block decoded by decode_block().") < 0 ||
+        ready_type<transaction_object>(transaction_type, transaction_dealloc,
+            "Transaction decoded by decode_transaction().") < 0)
+        return;
+    PyObject* module = Py_InitModule3("_native", module_methods,
+        "Native decoder for published blocks and transactions.");
+    if (!module)
+        return;
+    Py_INCREF(&block_type);
+    PyModule_AddObject(module, "Block",
+        reinterpret_cast<PyObject*>(&block_type));
+    Py_INCREF(&transaction_type);
+    PyModule_AddObject(module, "Transaction",
+        reinterpret_cast<PyObject*>(&transaction_type));
+}
+
@@ -1,5 +1,6 @@
 import hashlib
 import serializer
+import transport as transport_module
 
 from interface import QueryService
 from interface.ttypes import *
@@ -8,6 +9,7 @@ from thrift import Thrift
 from thrift.transport import TSocket
 from thrift.transport import TTransport
 from thrift.protocol import TBinaryProtocol
+from thrift.protocol import TCompactProtocol
 
 class BlocksManager:
 
@@ -40,6 +42,10 @@ class BlocksManager:
     def last_depth(self):
         return self.client.last_depth()
 
+    # First block at or after timestamp (by running max timestamp).
+    def at_time(self, timestamp):
+        return self[self.client.depth_at_time(timestamp)]
+
     def __len__(self):
         return self.last_depth + 1
 
@@ -210,6 +216,10 @@ class Transaction:
             self.populate_outputs()
         return self.outputs_
 
+    @property
+    def merkle_proof(self):
+        return self.client.merkle_proof(self.hash)
+
     def set_depth_offset(self):
         assert self.hash is not None
         tx_index = self.client.transaction_index(self.hash)
@@ -344,13 +354,33 @@ class Output:
 
 class Service:
 
-    def __init__(self, server="localhost", port=9090):
+    # protocol and transport must match the server's service-protocol
+    # and service-transport settings. Pass unix_socket to connect to
+    # the server's unix-socket listener instead of server:port.
+    def __init__(self, server="localhost", port=9090,
+                 protocol="binary", transport="buffered", unix_socket=None):
         # Make socket
-        self.transport = TSocket.TSocket(server, port)
+        if unix_socket is not None:
+            self.transport = TSocket.TSocket(unix_socket=unix_socket)
+        else:
+            self.transport = TSocket.TSocket(server, port)
         # Buffering is critical. Raw sockets are very slow
-        self.transport = TTransport.TBufferedTransport(self.transport)
+        if transport == "buffered":
+            self.transport = TTransport.TBufferedTransport(self.transport)
+        elif transport == "framed":
+            self.transport = TTransport.TFramedTransport(self.transport)
+        elif transport == "compressed":
+            self.transport = \
+                transport_module.TCompressedTransport(self.transport)
+        else:
+            raise ValueError("Unknown transport: %s" % transport)
         # Wrap in a protocol
-        self.protocol = TBinaryProtocol.TBinaryProtocol(self.transport)
+        if protocol == "binary":
+            self.protocol = TBinaryProtocol.TBinaryProtocol(self.transport)
+        elif protocol == "compact":
+            self.protocol = TCompactProtocol.TCompactProtocol(self.transport)
+        else:
+            raise ValueError("Unknown protocol: %s" % protocol)
         # Create a client to use the protocol encoder
         self.client = QueryService.Client(self.protocol)
         # Connect!
@@ -2,9 +2,45 @@ import bitcoin
 import deserialize
 import threading
 import struct
+import zlib
 import zmq
 import Queue
 
+# The native decoder is optional, see "make python-native".
+try:
+    import _native
+except ImportError:
+    _native = None
+
+# Blocks and transactions from the native decoder are mappings with the
+# same keys as these dicts, filled in as they are read.
+def parse_block(data):
+    if _native is not None:
+        return _native.decode_block(data)
+    return bitcoin.parse_block(data)
+
+def parse_transaction(data):
+    if _native is not None:
+        return _native.decode_transaction(data)
+    return bitcoin.parse_transaction(data)
+
+CODEC_NONE = 0
+CODEC_ZLIB = 1
+
+# Frames from a socket with *-publish-compression = "zlib" are
+# [1 byte codec] [4 bytes raw size, big endian] [payload].
+def decompress_frame(data):
+    codec = ord(data[0])
+    raw_size = struct.unpack(">L", data[1:5])[0]
+    payload = data[5:]
+    if codec == CODEC_ZLIB:
+        payload = zlib.decompress(payload)
+    elif codec != CODEC_NONE:
+        raise ValueError("Unknown frame codec %d" % codec)
+    if len(payload) != raw_size:
+        raise ValueError("Frame size mismatch")
+    return payload
+
 class SubscribeContext(zmq.Context):
     pass
 
@@ -12,14 +48,29 @@ class BaseSubscribe(threading.Thread):
 
     daemon = True
 
-    def __init__(self, context, server, port):
+    # endpoint overrides server and port, e.g. "ipc:///tmp/queryd-tx".
+    # compressed must match the publisher's compression setting.
+    def __init__(self, context, server, port, endpoint=None,
+                 compressed=False):
         super(BaseSubscribe, self).__init__()
+        self.compressed = compressed
         self.subscriber = context.socket(zmq.SUB)
-        self.subscriber.connect("tcp://%s:%s" % (server, port))
+        if endpoint is None:
+            endpoint = "tcp://%s:%s" % (server, port)
+        self.subscriber.connect(endpoint)
         self.subscriber.setsockopt(zmq.SUBSCRIBE, "")
         self.queue = Queue.Queue()
         self.start()
 
+    # Message data without copying the frame where possible.
+    def receive_payload(self):
+        frame = self.subscriber.recv(copy=False)
+        if self.compressed:
+            return decompress_frame(frame.bytes)
+        if _native is not None:
+            return frame.buffer
+        return frame.bytes
+
     # Options for timeout are None, 0 or a positive number.
     def pop(self, timeout=0):
         block = True
@@ -32,25 +83,48 @@ class BaseSubscribe(threading.Thread):
 
 class BlockSubscribe(BaseSubscribe):
 
-    def __init__(self, context, server="localhost", port=5563):
-        super(BlockSubscribe, self).__init__(context, server, port)
+    def __init__(self, context, server="localhost", port=5563,
+                 endpoint=None, compressed=False):
+        super(BlockSubscribe, self).__init__(
+            context, server, port, endpoint, compressed)
 
     def run(self):
         while True:
             message = self.subscriber.recv()
             depth = struct.unpack("<L", message)[0]
-            message = self.subscriber.recv()
-            block = bitcoin.parse_block(message)
+            block = parse_block(self.receive_payload())
             self.queue.put((depth, block))
 
 class TransactionSubscribe(BaseSubscribe):
 
-    def __init__(self, context, server="localhost", port=5564):
-        super(TransactionSubscribe, self).__init__(context, server, port)
+    def __init__(self, context, server="localhost", port=5564,
+                 endpoint=None, compressed=False):
+        super(TransactionSubscribe, self).__init__(
+            context, server, port, endpoint, compressed)
 
     def run(self):
         while True:
-            message = self.subscriber.recv()
-            tx = bitcoin.parse_transaction(message)
+            tx = parse_transaction(self.receive_payload())
             self.queue.put(tx)
 
+# Pops (depth, header, tx_hashes) where header is laid out like
+# bitcoin.parse_block() without "transactions" and tx_hashes match
+# the "hash" of each transaction.
+class CompactBlockSubscribe(BaseSubscribe):
+
+    def __init__(self, context, server="localhost", port=5565,
+                 endpoint=None):
+        super(CompactBlockSubscribe, self).__init__(
+            context, server, port, endpoint)
+
+    def run(self):
+        while True:
+            message = self.subscriber.recv()
+            depth = struct.unpack("<L", message)[0]
+            vds = deserialize.BCDataStream()
+            vds.write(self.subscriber.recv())
+            header = deserialize.parse_BlockHeader(vds)
+            hashes = self.subscriber.recv()
+            tx_hashes = [hashes[i:i + 32] for i in xrange(0, len(hashes), 32)]
+            self.queue.put((depth, header, tx_hashes))
+
@@ -0,0 +1,65 @@
+import struct
+import zlib
+
+from cStringIO import StringIO
+from thrift.transport import TTransport
+
+CODEC_NONE = 0
+CODEC_ZLIB = 1
+
+class TCompressedTransport(TTransport.TTransportBase):
+    """Client side of queryd's compressed transport.
+
+    Frames are [4 byte size][1 byte codec][4 byte raw size][payload] and
+    are zlib compressed when the payload reaches the threshold.
+    """
+
+    def __init__(self, trans, threshold=4096):
+        self.trans = trans
+        self.threshold = threshold
+        self.rbuf = StringIO()
+        self.wbuf = StringIO()
+
+    def isOpen(self):
+        return self.trans.isOpen()
+
+    def open(self):
+        return self.trans.open()
+
+    def close(self):
+        return self.trans.close()
+
+    def read(self, sz):
+        ret = self.rbuf.read(sz)
+        if len(ret) != 0:
+            return ret
+        self.read_frame()
+        return self.rbuf.read(sz)
+
+    def read_frame(self):
+        header = self.trans.readAll(9)
+        size, codec, raw_size = struct.unpack("!IBI", header)
+        payload = self.trans.readAll(size - 5)
+        if codec == CODEC_ZLIB:
+            payload = zlib.decompress(payload)
+        elif codec != CODEC_NONE:
+            raise TTransport.TTransportException(
+                message="Unknown frame codec %s" % codec)
+        assert len(payload) == raw_size
+        self.rbuf = StringIO(payload)
+
+    def write(self, buf):
+        self.wbuf.write(buf)
+
+    def flush(self):
+        data = self.wbuf.getvalue()
+        self.wbuf = StringIO()
+        codec = CODEC_NONE
+        payload = data
+        if len(data) >= self.threshold:
+            compressed = zlib.compress(data, 1)
+            if len(compressed) < len(data):
+                codec, payload = CODEC_ZLIB, compressed
+        header = struct.pack("!IBI", len(payload) + 5, codec, len(data))
+        self.trans.write(header + payload)
+        self.trans.flush()
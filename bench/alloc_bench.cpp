@@ -0,0 +1,150 @@
+// Counts heap allocations along the fetch-to-response path.
+//
+//   make bench && ./alloc-bench
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <bitcoin/bitcoin.hpp>
+
+#include "request_arena.hpp"
+#include "sync_get_impl.hpp"
+#include "thriftify.hpp"
+
+using namespace bc;
+
+std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* pointer = std::malloc(size);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+template <typename Function>
+void report(const std::string& name, Function function)
+{
+    constexpr size_t iterations = 10000;
+    // Warms up anything kept across calls, like the request arena.
+    function();
+    const size_t before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        function();
+    const auto duration = std::chrono::steady_clock::now() - start;
+    const double per_call = double(allocations - before) / iterations;
+    const auto nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+    std::cout << std::left << std::setw(36) << name << std::right
+        << std::setw(10) << std::fixed << std::setprecision(1) << per_call
+        << " allocs" << std::setw(10) << nanoseconds.count() / iterations
+        << " ns" << std::endl;
+}
+
+data_chunk repeated(uint8_t value, size_t size)
+{
+    return data_chunk(size, value);
+}
+
+// A typical two in, two out pay to pubkey hash transaction.
+transaction_type make_transaction()
+{
+    data_chunk input_script{0x48};
+    extend_data(input_script, repeated(0x30, 0x48));
+    input_script.push_back(0x21);
+    extend_data(input_script, repeated(0x02, 0x21));
+    data_chunk output_script{0x76, 0xa9, 0x14};
+    extend_data(output_script, repeated(0xab, 0x14));
+    output_script.push_back(0x88);
+    output_script.push_back(0xac);
+    transaction_type tx;
+    tx.version = 1;
+    tx.locktime = 0;
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        hash_digest previous_hash;
+        previous_hash.fill(i + 1);
+        tx.inputs.push_back(transaction_input_type{
+            output_point{previous_hash, i},
+            parse_script(input_script), 0xffffffff});
+        tx.outputs.push_back(transaction_output_type{
+            50000 * (i + 1), parse_script(output_script)});
+    }
+    return tx;
+}
+
+history_t make_history(size_t rows)
+{
+    history_t history;
+    for (uint32_t i = 0; i < rows; ++i)
+    {
+        hash_digest hash;
+        hash.fill(i);
+        history.outpoints.push_back(output_point{hash, i});
+        history.inpoints.push_back(input_point{hash, i});
+    }
+    return history;
+}
+
+int main()
+{
+    const transaction_type tx = make_transaction();
+    const history_t history = make_history(100);
+    // Answers immediately, standing in for the blockchain's handler call.
+    typedef std::function<
+        void (const std::error_code&, const transaction_type&)> handler_type;
+    auto fetch_transaction =
+        [&tx](const hash_digest&, handler_type handle)
+        {
+            handle(std::error_code(), tx);
+        };
+    OutputPointList thrift_outpoints;
+    thriftify_outpoints(thrift_outpoints, history.outpoints);
+
+    report("sync_get_impl<transaction_type>", [&]
+        {
+            std::error_code ec;
+            sync_get_impl<transaction_type>(
+                fetch_transaction, null_hash, ec);
+        });
+    report("thriftify_transaction", [&]
+        {
+            Transaction response;
+            thriftify_transaction(response, tx);
+        });
+    report("transaction() end to end", [&]
+        {
+            std::error_code ec;
+            const transaction_type result =
+                sync_get_impl<transaction_type>(
+                    fetch_transaction, null_hash, ec);
+            Transaction response;
+            thriftify_transaction(response, result);
+        });
+    report("thriftify_history (100 rows)", [&]
+        {
+            History response;
+            thriftify_history(response, history);
+        });
+    report("proper_outpoints (100 rows)", [&]
+        {
+            proper_outpoints(thrift_outpoints);
+        });
+    report("proper_outpoints arena (100 rows)", [&]
+        {
+            request_arena& arena = begin_request_arena();
+            proper_outpoints(arena.outpoints, thrift_outpoints);
+        });
+    return 0;
+}
+
@@ -0,0 +1,83 @@
+// Compares hash_pairs with hashing one pair at a time through OpenSSL,
+// over the levels of a block sized merkle tree.
+//
+//   make bench && ./merkle-bench
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <openssl/sha.h>
+#include <bitcoin/bitcoin.hpp>
+
+#include "merkle_tree.hpp"
+
+using namespace bc;
+
+// The reference: reversed into a buffer, hashed twice, reversed back.
+void hash_pairs_openssl(const hash_digest* in, size_t pairs,
+    hash_digest* out)
+{
+    uint8_t buffer[2 * hash_digest_size];
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        std::reverse_copy(in[2 * i].begin(), in[2 * i].end(), buffer);
+        std::reverse_copy(in[2 * i + 1].begin(), in[2 * i + 1].end(),
+            buffer + hash_digest_size);
+        SHA256(buffer, sizeof(buffer), digest);
+        SHA256(digest, sizeof(digest), digest);
+        std::reverse_copy(digest, digest + hash_digest_size, out[i].begin());
+    }
+}
+
+template <typename Function>
+void report(const std::string& name, size_t pairs, Function function)
+{
+    constexpr size_t iterations = 1000;
+    function();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        function();
+    const auto duration = std::chrono::steady_clock::now() - start;
+    const auto nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+    std::cout << std::left << std::setw(24) << name << std::right
+        << std::setw(10) << std::fixed << std::setprecision(1)
+        << double(nanoseconds.count()) / iterations / pairs
+        << " ns per pair" << std::endl;
+}
+
+int main()
+{
+    // About the leaf level of a full block.
+    constexpr size_t pairs = 1024;
+    std::mt19937 random(1);
+    hash_list in(2 * pairs);
+    for (hash_digest& hash: in)
+        for (uint8_t& byte: hash)
+            byte = random();
+    hash_list expected(pairs), result(pairs);
+    hash_pairs_openssl(in.data(), pairs, expected.data());
+    // Every count up to a few lanes, so the leftover path is covered.
+    for (size_t count = 0; count <= 17; ++count)
+    {
+        hash_pairs(in.data(), count, result.data());
+        if (!std::equal(result.begin(), result.begin() + count,
+            expected.begin()))
+        {
+            std::cerr << "hash_pairs differs for " << count << " pairs"
+                << std::endl;
+            return 1;
+        }
+    }
+    report("OpenSSL, one pair", pairs, [&]
+        {
+            hash_pairs_openssl(in.data(), pairs, result.data());
+        });
+    report("hash_pairs", pairs, [&]
+        {
+            hash_pairs(in.data(), pairs, result.data());
+        });
+    return 0;
+}
@@ -0,0 +1,358 @@
+#include "query_client.hpp"
+
+#include <thrift/protocol/TProtocolException.h>
+#include <thrift/transport/TTransportException.h>
+
+#include "thrift_factories.hpp"
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+// Upper bound on items in one batched call.
+constexpr size_t max_batch_items = 1000;
+
+pipelined_connection::pipelined_connection(const std::string& host, int port,
+    boost::shared_ptr<TProtocolFactory> protocol_factory,
+    boost::shared_ptr<TTransportFactory> transport_factory)
+  : socket_(new TSocket(host, port)), outstanding_(0), broken_(false)
+{
+    transport_ = transport_factory->getTransport(socket_);
+    // One protocol per direction since the reader and writer run on
+    // different threads and protocols like compact keep field state.
+    client_.reset(new QueryServiceClient(
+        protocol_factory->getProtocol(transport_),
+        protocol_factory->getProtocol(transport_)));
+    transport_->open();
+    reader_ = std::thread(&pipelined_connection::read_replies, this);
+}
+
+pipelined_connection::~pipelined_connection()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        closing_ = true;
+    }
+    queue_ready_.notify_one();
+    // Wakes a reader blocked on a reply that will never come.
+    if (outstanding_ > 0)
+        socket_->close();
+    reader_.join();
+    socket_->close();
+}
+
+bool pipelined_connection::call(
+    send_type send, receive_type receive, complete_type complete)
+{
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    if (broken_)
+        return false;
+    try
+    {
+        send(*client_);
+    }
+    catch (const apache::thrift::TException&)
+    {
+        // A half written request leaves the stream unusable. Closing
+        // fails whatever is still waiting on the reader.
+        broken_ = true;
+        socket_->close();
+        return false;
+    }
+    ++outstanding_;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (!reader_done_)
+        {
+            pending_.push_back(pending_call{receive, complete});
+            queue_ready_.notify_one();
+            return true;
+        }
+    }
+    --outstanding_;
+    complete(std::make_exception_ptr(TTransportException(
+        TTransportException::NOT_OPEN, "Connection closed")));
+    return true;
+}
+
+void pipelined_connection::read_replies()
+{
+    while (true)
+    {
+        pending_call next;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_ready_.wait(lock,
+                [this] { return closing_ || !pending_.empty(); });
+            if (pending_.empty())
+            {
+                reader_done_ = true;
+                return;
+            }
+            next = std::move(pending_.front());
+            pending_.pop_front();
+        }
+        std::exception_ptr error;
+        bool stream_failed = false;
+        try
+        {
+            next.receive(*client_);
+        }
+        catch (const TTransportException&)
+        {
+            error = std::current_exception();
+            stream_failed = true;
+        }
+        catch (const TProtocolException&)
+        {
+            error = std::current_exception();
+            stream_failed = true;
+        }
+        catch (...)
+        {
+            // Server side errors like ErrorCode leave the stream in step.
+            error = std::current_exception();
+        }
+        --outstanding_;
+        next.complete(error);
+        if (stream_failed)
+        {
+            broken_ = true;
+            fail_pending(error);
+            return;
+        }
+    }
+}
+
+void pipelined_connection::fail_pending(std::exception_ptr error)
+{
+    std::deque<pending_call> failed;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        reader_done_ = true;
+        failed.swap(pending_);
+    }
+    for (pending_call& call: failed)
+    {
+        --outstanding_;
+        call.complete(error);
+    }
+}
+
+size_t pipelined_connection::outstanding() const
+{
+    return outstanding_;
+}
+bool pipelined_connection::broken() const
+{
+    return broken_;
+}
+
+query_client::query_client(const std::string& host, int port,
+    const std::string& protocol, const std::string& transport,
+    size_t pool_size, std::chrono::microseconds batch_window,
+    size_t compression_threshold, size_t compression_max_frame)
+  : host_(host), port_(port),
+    protocol_factory_(make_protocol_factory(protocol)),
+    transport_factory_(make_transport_factory(
+        transport, compression_threshold, compression_max_frame)),
+    closing_(false),
+    connections_(std::max<size_t>(pool_size, 1))
+{
+    if (!protocol_factory_)
+        throw std::invalid_argument("Unknown protocol: " + protocol);
+    if (!transport_factory_)
+        throw std::invalid_argument("Unknown transport: " + transport);
+    output_values_batcher_.reset(new call_batcher<OutputPoint, int64_t>(
+        [this](const OutputPointList& outpoints,
+            call_batcher<OutputPoint, int64_t>::handler_type handle)
+        {
+            call<OutputValues>(
+                [outpoints](QueryServiceClient& client)
+                {
+                    client.send_output_values(outpoints);
+                },
+                [](QueryServiceClient& client, OutputValues& values)
+                {
+                    client.recv_output_values(values);
+                },
+                handle);
+        }, batch_window, max_batch_items));
+    broadcast_batcher_.reset(new call_batcher<std::string, BroadcastResult>(
+        [this](const std::vector<std::string>& txs_data,
+            call_batcher<std::string, BroadcastResult>::handler_type handle)
+        {
+            call<BroadcastResultList>(
+                [txs_data](QueryServiceClient& client)
+                {
+                    client.send_broadcast_transactions(txs_data);
+                },
+                [](QueryServiceClient& client, BroadcastResultList& results)
+                {
+                    client.recv_broadcast_transactions(results);
+                },
+                handle);
+        }, batch_window, max_batch_items, false));
+}
+
+query_client::~query_client()
+{
+    // Pending batches go out while the pool still exists.
+    output_values_batcher_.reset();
+    broadcast_batcher_.reset();
+    // Failed calls retried from reader threads must not touch the pool.
+    closing_ = true;
+    connections_.clear();
+}
+
+query_client::connection_ptr query_client::pick()
+{
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    connection_ptr best;
+    for (connection_ptr& conn: connections_)
+    {
+        if (!conn || conn->broken())
+        {
+            try
+            {
+                conn = std::make_shared<pipelined_connection>(
+                    host_, port_, protocol_factory_, transport_factory_);
+            }
+            catch (const TTransportException&)
+            {
+                conn.reset();
+                continue;
+            }
+        }
+        if (!best || conn->outstanding() < best->outstanding())
+            best = conn;
+        // An idle connection can't be beaten.
+        if (best->outstanding() == 0)
+            break;
+    }
+    return best;
+}
+
+std::future<int32_t> query_client::last_depth()
+{
+    return call<int32_t>(
+        [](QueryServiceClient& client)
+        {
+            client.send_last_depth();
+        },
+        [](QueryServiceClient& client, int32_t& depth)
+        {
+            depth = client.recv_last_depth();
+        });
+}
+
+std::future<BlockHeader> query_client::block_header_by_depth(int32_t depth)
+{
+    return call<BlockHeader>(
+        [depth](QueryServiceClient& client)
+        {
+            client.send_block_header_by_depth(depth);
+        },
+        [](QueryServiceClient& client, BlockHeader& blk)
+        {
+            client.recv_block_header_by_depth(blk);
+        });
+}
+
+std::future<BlockHeader> query_client::block_header_by_hash(
+    const std::string& hash)
+{
+    return call<BlockHeader>(
+        [hash](QueryServiceClient& client)
+        {
+            client.send_block_header_by_hash(hash);
+        },
+        [](QueryServiceClient& client, BlockHeader& blk)
+        {
+            client.recv_block_header_by_hash(blk);
+        });
+}
+
+std::future<Transaction> query_client::transaction(const std::string& hash)
+{
+    return call<Transaction>(
+        [hash](QueryServiceClient& client)
+        {
+            client.send_transaction(hash);
+        },
+        [](QueryServiceClient& client, Transaction& tx)
+        {
+            client.recv_transaction(tx);
+        });
+}
+
+std::future<TransactionIndex> query_client::transaction_index(
+    const std::string& hash)
+{
+    return call<TransactionIndex>(
+        [hash](QueryServiceClient& client)
+        {
+            client.send_transaction_index(hash);
+        },
+        [](QueryServiceClient& client, TransactionIndex& tx_index)
+        {
+            client.recv_transaction_index(tx_index);
+        });
+}
+
+std::future<RawBlockList> query_client::blocks_raw(
+    int32_t start_depth, int32_t count)
+{
+    return call<RawBlockList>(
+        [start_depth, count](QueryServiceClient& client)
+        {
+            client.send_blocks_raw(start_depth, count);
+        },
+        [](QueryServiceClient& client, RawBlockList& blocks)
+        {
+            client.recv_blocks_raw(blocks);
+        });
+}
+
+std::future<History> query_client::history(const std::string& address)
+{
+    return call<History>(
+        [address](QueryServiceClient& client)
+        {
+            client.send_history(address);
+        },
+        [](QueryServiceClient& client, History& history)
+        {
+            client.recv_history(history);
+        });
+}
+
+std::future<OutputValues> query_client::output_values(
+    const OutputPointList& outpoints)
+{
+    auto promise = std::make_shared<std::promise<OutputValues>>();
+    output_values_batcher_->submit(outpoints,
+        [promise](std::exception_ptr error, OutputValues values)
+        {
+            if (error)
+                promise->set_exception(error);
+            else
+                promise->set_value(std::move(values));
+        });
+    return promise->get_future();
+}
+
+std::future<BroadcastResult> query_client::broadcast_transaction(
+    const std::string& tx_data)
+{
+    auto promise = std::make_shared<std::promise<BroadcastResult>>();
+    broadcast_batcher_->submit({tx_data},
+        [promise](std::exception_ptr error, BroadcastResultList results)
+        {
+            if (error)
+                promise->set_exception(error);
+            else
+                promise->set_value(results.front());
+        });
+    return promise->get_future();
+}
+
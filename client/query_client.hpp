@@ -0,0 +1,312 @@
+#ifndef QUERY_CLIENT_QUERY_CLIENT_HPP
+#define QUERY_CLIENT_QUERY_CLIENT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TSocket.h>
+#include <thrift/transport/TTransport.h>
+
+#include "thrift/QueryService.h"
+
+// A connection that pipelines requests. Calls are written as they come
+// and a reader thread takes the replies in the same order, so many
+// requests can be in flight at once. Relies on the server answering a
+// connection's requests in order, which every Thrift server does.
+class pipelined_connection
+{
+public:
+    typedef std::function<void (QueryServiceClient&)> send_type;
+    // Reads the reply, throwing whatever the generated recv_ method does.
+    typedef std::function<void (QueryServiceClient&)> receive_type;
+    // Runs exactly once per call, with an empty pointer on success.
+    typedef std::function<void (std::exception_ptr)> complete_type;
+
+    // Throws TTransportException when it can't connect.
+    pipelined_connection(const std::string& host, int port,
+        boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>
+            protocol_factory,
+        boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+            transport_factory);
+    // Calls still waiting for replies complete with an error.
+    ~pipelined_connection();
+
+    // Returns false without calling anything once the connection broke.
+    bool call(send_type send, receive_type receive, complete_type complete);
+
+    size_t outstanding() const;
+    bool broken() const;
+
+private:
+    struct pending_call
+    {
+        receive_type receive;
+        complete_type complete;
+    };
+
+    void read_replies();
+    void fail_pending(std::exception_ptr error);
+
+    boost::shared_ptr<apache::thrift::transport::TSocket> socket_;
+    boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
+    std::unique_ptr<QueryServiceClient> client_;
+    std::atomic<size_t> outstanding_;
+    std::atomic<bool> broken_;
+    // Held while writing a request and queueing its reply, so the queue
+    // is in wire order.
+    std::mutex write_mutex_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_ready_;
+    std::deque<pending_call> pending_;
+    bool closing_ = false, reader_done_ = false;
+    std::thread reader_;
+};
+
+// Gathers same-method calls made within window of each other into one
+// call over the concatenated items. Each caller gets its own slice of
+// the results. If the combined call fails, each caller's items are
+// retried alone so one bad item doesn't fail the others. Calls that
+// aren't safe to repeat pass retry_alone=false, and every caller then
+// gets the combined call's error.
+template <typename Item, typename Result>
+class call_batcher
+{
+public:
+    typedef std::vector<Item> item_list;
+    typedef std::vector<Result> result_list;
+    typedef std::function<void (std::exception_ptr, result_list)>
+        handler_type;
+    // Issues one call and completes with a result per item.
+    typedef std::function<void (const item_list&, handler_type)>
+        batch_call_type;
+
+    call_batcher(batch_call_type call, std::chrono::microseconds window,
+        size_t max_items, bool retry_alone=true)
+      : call_(call), window_(window), max_items_(max_items),
+        retry_alone_(retry_alone), flusher_(&call_batcher::run, this)
+    {
+    }
+    ~call_batcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        wakeup_.notify_one();
+        flusher_.join();
+    }
+
+    void submit(item_list items, handler_type handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (waiters_.empty())
+            batch_start_ = std::chrono::steady_clock::now();
+        waiters_.push_back(waiter{items_.size(), items.size(), handle});
+        items_.insert(items_.end(), std::make_move_iterator(items.begin()),
+            std::make_move_iterator(items.end()));
+        wakeup_.notify_one();
+    }
+
+private:
+    struct waiter
+    {
+        size_t offset, count;
+        handler_type handle;
+    };
+    typedef std::vector<waiter> waiter_list;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            wakeup_.wait(lock,
+                [this] { return stopped_ || !waiters_.empty(); });
+            if (waiters_.empty())
+                return;
+            // Wait out the window unless the batch fills up first.
+            wakeup_.wait_until(lock, batch_start_ + window_,
+                [this] { return stopped_ || items_.size() >= max_items_; });
+            item_list items;
+            items.swap(items_);
+            waiter_list waiters;
+            waiters.swap(waiters_);
+            lock.unlock();
+            flush(items, std::move(waiters));
+            lock.lock();
+        }
+    }
+
+    void flush(const item_list& items, waiter_list waiters)
+    {
+        auto shared_items = std::make_shared<item_list>(items);
+        auto shared_waiters = std::make_shared<waiter_list>(
+            std::move(waiters));
+        batch_call_type call = call_;
+        const bool retry = retry_alone_;
+        call_(items,
+            [call, retry, shared_items, shared_waiters](
+                std::exception_ptr error, result_list results)
+            {
+                for (const waiter& entry: *shared_waiters)
+                {
+                    auto first = shared_items->begin() + entry.offset;
+                    if (error && retry && shared_waiters->size() > 1)
+                        call(item_list(first, first + entry.count),
+                            entry.handle);
+                    else if (error)
+                        entry.handle(error, result_list());
+                    else if (entry.offset + entry.count > results.size())
+                        entry.handle(std::make_exception_ptr(
+                            std::runtime_error("Short batched reply")),
+                            result_list());
+                    else
+                        entry.handle(nullptr, result_list(
+                            results.begin() + entry.offset,
+                            results.begin() + entry.offset + entry.count));
+                }
+            });
+    }
+
+    const batch_call_type call_;
+    const std::chrono::microseconds window_;
+    const size_t max_items_;
+    const bool retry_alone_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    item_list items_;
+    waiter_list waiters_;
+    std::chrono::steady_clock::time_point batch_start_;
+    bool stopped_ = false;
+    // Last so everything it reads exists before it starts.
+    std::thread flusher_;
+};
+
+// Client for queryd and query-router over a pool of pipelined
+// connections. Handlers and futures complete on connection reader
+// threads, so handlers shouldn't block.
+class query_client
+{
+public:
+    template <typename Result>
+    using receive_type = std::function<void (QueryServiceClient&, Result&)>;
+    template <typename Result>
+    using handler_type = std::function<void (std::exception_ptr, Result)>;
+
+    query_client(const std::string& host, int port,
+        const std::string& protocol="binary",
+        const std::string& transport="buffered",
+        size_t pool_size=4,
+        std::chrono::microseconds batch_window=
+            std::chrono::microseconds(2000),
+        size_t compression_threshold=4096,
+        size_t compression_max_frame=64 * 1024 * 1024);
+    // Calls still in flight fail.
+    ~query_client();
+
+    // Runs any method on the least busy connection, e.g.
+    //   client.call<HashList>(
+    //       [=](QueryServiceClient& c) { c.send_..._by_depth(depth); },
+    //       [](QueryServiceClient& c, HashList& r) { c.recv_..._by_depth(r); },
+    //       handle);
+    template <typename Result>
+    void call(pipelined_connection::send_type send,
+        receive_type<Result> receive, handler_type<Result> handle);
+    template <typename Result>
+    std::future<Result> call(pipelined_connection::send_type send,
+        receive_type<Result> receive);
+
+    std::future<int32_t> last_depth();
+    std::future<BlockHeader> block_header_by_depth(int32_t depth);
+    std::future<BlockHeader> block_header_by_hash(const std::string& hash);
+    std::future<Transaction> transaction(const std::string& hash);
+    std::future<TransactionIndex> transaction_index(const std::string& hash);
+    std::future<History> history(const std::string& address);
+    // The server reads ahead per connection. Scans that wait for each
+    // call before the next stay on one idle connection and keep it.
+    std::future<RawBlockList> blocks_raw(int32_t start_depth, int32_t count);
+    // Batched with other output_values calls made within the window.
+    std::future<OutputValues> output_values(const OutputPointList& outpoints);
+    // Batched into broadcast_transactions calls. A failed batch isn't
+    // resent, since some of it may have been broadcast already.
+    std::future<BroadcastResult> broadcast_transaction(
+        const std::string& tx_data);
+
+private:
+    typedef std::shared_ptr<pipelined_connection> connection_ptr;
+
+    // Least outstanding requests, reconnecting broken or unopened slots.
+    connection_ptr pick();
+
+    const std::string host_;
+    const int port_;
+    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>
+        protocol_factory_;
+    boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+        transport_factory_;
+    std::atomic<bool> closing_;
+    std::mutex pool_mutex_;
+    std::vector<connection_ptr> connections_;
+    // Declared after the pool so they're gone before it is.
+    std::unique_ptr<call_batcher<OutputPoint, int64_t>> output_values_batcher_;
+    std::unique_ptr<call_batcher<std::string, BroadcastResult>>
+        broadcast_batcher_;
+};
+
+template <typename Result>
+void query_client::call(pipelined_connection::send_type send,
+    receive_type<Result> receive, handler_type<Result> handle)
+{
+    auto result = std::make_shared<Result>();
+    auto receive_result =
+        [receive, result](QueryServiceClient& client)
+        {
+            receive(client, *result);
+        };
+    auto complete =
+        [handle, result](std::exception_ptr error)
+        {
+            handle(error, error ? Result() : std::move(*result));
+        };
+    // A second attempt covers a pooled connection found broken on write.
+    for (size_t attempt = 0; attempt < 2 && !closing_; ++attempt)
+    {
+        connection_ptr conn = pick();
+        if (conn && conn->call(send, receive_result, complete))
+            return;
+    }
+    handle(std::make_exception_ptr(
+        apache::thrift::transport::TTransportException(
+            apache::thrift::transport::TTransportException::NOT_OPEN,
+            "No connection to " + host_)), Result());
+}
+
+template <typename Result>
+std::future<Result> query_client::call(pipelined_connection::send_type send,
+    receive_type<Result> receive)
+{
+    auto promise = std::make_shared<std::promise<Result>>();
+    call<Result>(send, receive,
+        [promise](std::exception_ptr error, Result result)
+        {
+            if (error)
+                promise->set_exception(error);
+            else
+                promise->set_value(std::move(result));
+        });
+    return promise->get_future();
+}
+
+#endif
+
@@ -0,0 +1,200 @@
+#include "subscriber.hpp"
+
+#include <zlib.h>
+
+constexpr uint8_t codec_none = 0;
+constexpr uint8_t codec_zlib = 1;
+constexpr size_t codec_header_size = 1 + 4;
+constexpr size_t header_size = 80;
+// Blocks are the largest messages published.
+constexpr uint32_t max_raw_size = 1000000;
+
+void subscribe_all(zmq::socket_t& socket, const std::string& endpoint)
+{
+    socket.connect(endpoint.c_str());
+    socket.setsockopt(ZMQ_SUBSCRIBE, "", 0);
+}
+
+bool wait_readable(zmq::socket_t& socket, std::chrono::milliseconds timeout)
+{
+    zmq::pollitem_t items[] = {
+        {static_cast<void*>(socket), 0, ZMQ_POLLIN, 0}};
+    zmq::poll(items, 1, timeout.count());
+    return items[0].revents & ZMQ_POLLIN;
+}
+
+bool has_more(zmq::socket_t& socket)
+{
+    int more = 0;
+    size_t more_size = sizeof(more);
+    socket.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+    return more;
+}
+
+// Drops the rest of a multipart message so the next receive starts clean.
+void skip_parts(zmq::socket_t& socket)
+{
+    while (has_more(socket))
+    {
+        zmq::message_t part;
+        socket.recv(&part);
+    }
+}
+
+template <typename Message>
+bool decode_message(const uint8_t* begin, size_t size, Message& result)
+{
+    try
+    {
+        bc::satoshi_load(begin, begin + size, result);
+    }
+    catch (const bc::end_of_stream&)
+    {
+        return false;
+    }
+    return true;
+}
+
+// Frames on compressed sockets are [1 byte codec] [4 bytes raw size]
+// [payload]. The raw message is left in buffer.
+bool decompress_frame(zmq::message_t& message, bc::data_chunk& buffer)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(message.data());
+    if (message.size() < codec_header_size)
+        return false;
+    const uint32_t raw_size =
+        (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4];
+    // The size comes off the wire, so it can't be trusted to allocate.
+    if (raw_size > max_raw_size)
+        return false;
+    const uint8_t* payload = data + codec_header_size;
+    const size_t payload_size = message.size() - codec_header_size;
+    buffer.resize(raw_size);
+    if (data[0] == codec_none)
+    {
+        if (payload_size != raw_size)
+            return false;
+        std::copy(payload, payload + payload_size, buffer.begin());
+        return true;
+    }
+    if (data[0] != codec_zlib)
+        return false;
+    uLongf dest_size = raw_size;
+    return uncompress(buffer.data(), &dest_size,
+        payload, payload_size) == Z_OK && dest_size == raw_size;
+}
+
+template <typename Message>
+bool decode_frame(zmq::message_t& message, bool compressed,
+    bc::data_chunk& buffer, Message& result)
+{
+    if (!compressed)
+        return decode_message(static_cast<const uint8_t*>(message.data()),
+            message.size(), result);
+    return decompress_frame(message, buffer) &&
+        decode_message(buffer.data(), buffer.size(), result);
+}
+
+uint32_t read_depth(zmq::message_t& message)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(message.data());
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        (uint32_t(data[3]) << 24);
+}
+
+block_subscriber::block_subscriber(zmq::context_t& context,
+    const std::string& endpoint, bool compressed)
+  : socket_(context, ZMQ_SUB), compressed_(compressed)
+{
+    subscribe_all(socket_, endpoint);
+}
+
+bool block_subscriber::receive(uint32_t& depth, bc::block_type& blk,
+    std::chrono::milliseconds timeout)
+{
+    if (!wait_readable(socket_, timeout))
+        return false;
+    // [4 byte little endian depth] [raw block]
+    zmq::message_t raw_depth;
+    socket_.recv(&raw_depth);
+    if (raw_depth.size() != 4 || !has_more(socket_))
+    {
+        skip_parts(socket_);
+        return false;
+    }
+    depth = read_depth(raw_depth);
+    zmq::message_t raw_block;
+    socket_.recv(&raw_block);
+    skip_parts(socket_);
+    return decode_frame(raw_block, compressed_, buffer_, blk);
+}
+
+transaction_subscriber::transaction_subscriber(zmq::context_t& context,
+    const std::string& endpoint, bool compressed)
+  : socket_(context, ZMQ_SUB), compressed_(compressed)
+{
+    subscribe_all(socket_, endpoint);
+}
+
+bool transaction_subscriber::receive(
+    bc::transaction_type& tx, std::chrono::milliseconds timeout)
+{
+    if (!wait_readable(socket_, timeout))
+        return false;
+    zmq::message_t raw_tx;
+    socket_.recv(&raw_tx);
+    skip_parts(socket_);
+    return decode_frame(raw_tx, compressed_, buffer_, tx);
+}
+
+compact_block_subscriber::compact_block_subscriber(
+    zmq::context_t& context, const std::string& endpoint)
+  : socket_(context, ZMQ_SUB)
+{
+    subscribe_all(socket_, endpoint);
+}
+
+bool compact_block_subscriber::receive(uint32_t& depth,
+    bc::block_type& blk, std::vector<bc::hash_digest>& tx_hashes,
+    std::chrono::milliseconds timeout)
+{
+    if (!wait_readable(socket_, timeout))
+        return false;
+    // [4 byte little endian depth] [80 byte header] [32 byte tx hashes]
+    zmq::message_t raw_depth, raw_header, raw_hashes;
+    socket_.recv(&raw_depth);
+    if (raw_depth.size() != 4 || !has_more(socket_))
+    {
+        skip_parts(socket_);
+        return false;
+    }
+    socket_.recv(&raw_header);
+    if (raw_header.size() != header_size || !has_more(socket_))
+    {
+        skip_parts(socket_);
+        return false;
+    }
+    socket_.recv(&raw_hashes);
+    skip_parts(socket_);
+    if (raw_hashes.size() % bc::hash_digest_size != 0)
+        return false;
+    depth = read_depth(raw_depth);
+    const uint8_t* header = static_cast<const uint8_t*>(raw_header.data());
+    auto deserial = bc::make_deserializer(header, header + header_size);
+    blk.version = deserial.read_4_bytes();
+    blk.previous_block_hash = deserial.read_hash();
+    blk.merkle = deserial.read_hash();
+    blk.timestamp = deserial.read_4_bytes();
+    blk.bits = deserial.read_4_bytes();
+    blk.nonce = deserial.read_4_bytes();
+    blk.transactions.clear();
+    const uint8_t* hashes = static_cast<const uint8_t*>(raw_hashes.data());
+    tx_hashes.resize(raw_hashes.size() / bc::hash_digest_size);
+    for (bc::hash_digest& tx_hash: tx_hashes)
+    {
+        std::copy(hashes, hashes + bc::hash_digest_size, tx_hash.begin());
+        hashes += bc::hash_digest_size;
+    }
+    return true;
+}
+
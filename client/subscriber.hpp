@@ -0,0 +1,64 @@
+#ifndef QUERY_CLIENT_SUBSCRIBER_HPP
+#define QUERY_CLIENT_SUBSCRIBER_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+#include <bitcoin/bitcoin.hpp>
+
+// Reads blocks published by queryd on block-publish-endpoint. Blocks
+// are decoded straight out of the received message unless compressed,
+// which must match the publisher's block-publish-compression.
+class block_subscriber
+{
+public:
+    block_subscriber(zmq::context_t& context, const std::string& endpoint,
+        bool compressed=false);
+
+    // Waits up to timeout for the next block. Returns false on timeout
+    // or when the message is malformed.
+    bool receive(uint32_t& depth, bc::block_type& blk,
+        std::chrono::milliseconds timeout);
+
+private:
+    zmq::socket_t socket_;
+    const bool compressed_;
+    bc::data_chunk buffer_;
+};
+
+// Reads transactions published by queryd on tx-publish-endpoint.
+class transaction_subscriber
+{
+public:
+    transaction_subscriber(zmq::context_t& context,
+        const std::string& endpoint, bool compressed=false);
+
+    // Same as block_subscriber::receive().
+    bool receive(bc::transaction_type& tx, std::chrono::milliseconds timeout);
+
+private:
+    zmq::socket_t socket_;
+    const bool compressed_;
+    bc::data_chunk buffer_;
+};
+
+// Reads compact blocks published on compact-block-publish-endpoint:
+// the header of each block and its transaction hashes.
+class compact_block_subscriber
+{
+public:
+    compact_block_subscriber(
+        zmq::context_t& context, const std::string& endpoint);
+
+    // Same as block_subscriber::receive(). blk gets the header fields.
+    bool receive(uint32_t& depth, bc::block_type& blk,
+        std::vector<bc::hash_digest>& tx_hashes,
+        std::chrono::milliseconds timeout);
+
+private:
+    zmq::socket_t socket_;
+};
+
+#endif
+
@@ -13,7 +13,10 @@ struct BlockHeader {
   6: i64 nonce
 }
 
+typedef list<BlockHeader> BlockHeaderList
 typedef list<binary> HashList
+// Satoshi serialized blocks.
+typedef list<binary> RawBlockList
 
 struct OutputPoint {
   1: binary hash,
@@ -55,6 +58,84 @@ struct History {
 
 typedef list<i64> OutputValues
 
+// Funds moving from outpoint to the input spending it.
+struct TraceEdge {
+  1: OutputPoint outpoint,
+  2: InputPoint inpoint
+}
+
+struct TraceResult {
+  1: list<TraceEdge> edges,
+  // Set when max_nodes cut the walk short.
+  2: bool truncated
+}
+
+struct BlockStats {
+  1: i32 depth,
+  2: i32 tx_count,
+  3: i32 size,
+  4: i32 input_count,
+  5: i32 output_count,
+  6: i64 total_output_value,
+  7: i64 fees
+}
+typedef list<BlockStats> BlockStatsList
+
+// Row of an address's history. Spends carry the spending inpoint.
+struct HistoryRow {
+  1: OutputPoint outpoint,
+  2: InputPoint inpoint,
+  3: bool is_spend,
+  4: i32 depth
+}
+typedef list<HistoryRow> HistoryRowList
+
+struct HistoryDelta {
+  1: HistoryRowList rows,
+  // Rows from blocks that left the main chain since known_tip_hash.
+  2: HistoryRowList invalidated,
+  // -1 unless known_tip_hash was reorganized away.
+  3: i32 fork_depth,
+  4: binary tip_hash,
+  5: i32 tip_depth
+}
+
+struct FeeRateBucket {
+  // Satoshis per byte, up to the next bucket's bound.
+  1: double min_fee_rate,
+  2: i32 tx_count,
+  3: i64 total_size,
+  4: i64 total_fees
+}
+
+struct FeeHistogram {
+  1: list<FeeRateBucket> buckets,
+  2: i32 tx_count,
+  3: i64 total_size
+}
+
+enum BroadcastStatus {
+  ACCEPTED = 0,
+  // Couldn't be deserialized.
+  MALFORMED = 1,
+  // Failed validation against the transaction pool.
+  REJECTED = 2
+}
+
+struct BroadcastResult {
+  1: BroadcastStatus status,
+  2: string why
+}
+typedef list<BroadcastResult> BroadcastResultList
+
+// Sibling hashes from the transaction up to the merkle root.
+struct MerkleProof {
+  1: HashList branch,
+  2: i32 position,
+  3: i32 depth,
+  4: binary merkle
+}
+
 service QueryService {
   bool stop(1:string secret)
   // blockchain methods
@@ -64,16 +145,45 @@ service QueryService {
   HashList block_transaction_hashes_by_hash(1:binary hash)
   i32 block_depth(1:binary hash)
   i32 last_depth()
+  // Uses the running maximum of block timestamps, which is monotonic.
+  i32 depth_at_time(1:i64 timestamp)
+  // Returns at most the server's time-range-max-headers headers.
+  BlockHeaderList block_headers_in_time_range(1:i64 from_time, 2:i64 to_time)
   Transaction transaction(1:binary hash)
   TransactionIndex transaction_index(1:binary hash)
   InputPoint spend(1:OutputPoint outpoint)
   OutputPointList outputs(1:string address)
   // blockchain (composed) methods
   History history(1:string address)
+  // Outputs by hash_script() of their script, for scripts without an
+  // address. Needs the script index built by queryd --reindex scripts.
+  OutputPointList outputs_by_script(1:binary script_hash)
+  History history_by_script(1:binary script_hash)
   OutputValues output_values(1:OutputPointList outpoints)
+  MerkleProof merkle_proof(1:binary hash)
+  // Blocks without computed stats are left out.
+  // Covers at most the server's block-stats-max-rows depths.
+  BlockStatsList block_stats(1:i32 start_depth, 2:i32 count)
+  // Consecutive blocks for scanning the chain. Returns fewer than count
+  // blocks past blocks-raw-max-bytes or at the tip, so scans carry on
+  // from start_depth plus the number returned. Fails when a block
+  // returned earlier in the scan was replaced by a reorganization, and
+  // the scan must then restart from below the fork.
+  RawBlockList blocks_raw(1:i32 start_depth, 2:i32 count)
+  TraceResult trace_forward(
+    1:OutputPoint outpoint, 2:i32 max_hops, 3:i32 max_nodes)
+  TraceResult trace_backward(1:binary hash, 2:i32 max_hops, 3:i32 max_nodes)
+  // Rows at or above from_depth for the addresses. An empty
+  // known_tip_hash skips the reorganization check.
+  HistoryDelta history_since(1:list<string> addresses, 2:i32 from_depth,
+    3:binary known_tip_hash)
   // transaction pool methods
   Transaction transaction_pool_transaction(1:binary hash)
+  FeeHistogram mempool_fee_histogram()
   // protocol methods
   bool broadcast_transaction(1:binary data)
+  // Validates every transaction against the pool and relays the accepted
+  // ones. Results are in the same order as txs.
+  BroadcastResultList broadcast_transactions(1:list<binary> txs)
 }
 
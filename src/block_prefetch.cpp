@@ -0,0 +1,136 @@
+#include "block_prefetch.hpp"
+
+#include <limits>
+
+#include "request_trace.hpp"
+#include "server.hpp"
+
+using namespace bc;
+
+bool block_prefetcher::read(blockchain& chain, size_t start_depth,
+    size_t count, size_t read_ahead, size_t max_bytes,
+    std::vector<std::string>& blocks, std::error_code& ec)
+{
+    if (count == 0)
+        return true;
+    // Anything but the continuation of the last scan starts afresh, and
+    // reads no further than the blocks asked for.
+    const bool continued = scanning_ && start_depth == next_depth_;
+    if (!continued)
+    {
+        clear();
+        next_depth_ = start_depth;
+    }
+    const size_t window = std::max<size_t>(read_ahead, 1);
+    const size_t fetch_end = continued ?
+        std::numeric_limits<size_t>::max() : start_depth + count;
+    auto fill_window =
+        [&]()
+        {
+            while (pending_.size() < window &&
+                next_depth_ + pending_.size() < fetch_end)
+                fetch(chain, next_depth_ + pending_.size());
+        };
+    size_t bytes = 0;
+    // Depth read again after a reorganization.
+    size_t refetched_depth = std::numeric_limits<size_t>::max();
+    while (blocks.size() < count)
+    {
+        fill_window();
+        fetch_slot& slot = *pending_.front();
+        {
+            trace_stage stage("fetch");
+            std::unique_lock<std::mutex> lock(slot.mutex);
+            slot.done.wait(lock, [&slot] { return slot.finished; });
+        }
+        if (slot.ec)
+        {
+            // Past the tip. Later blocks may arrive by the next call,
+            // so nothing read ahead is kept.
+            if (blocks.empty())
+                ec = slot.ec;
+            clear();
+            return true;
+        }
+        if (last_hash_ != null_hash && slot.previous != last_hash_)
+        {
+            if (refetched_depth == next_depth_)
+            {
+                // The block handed out before this one is gone as well.
+                blocks.clear();
+                clear();
+                return false;
+            }
+            refetched_depth = next_depth_;
+            pending_.clear();
+            continue;
+        }
+        // Left in place for the next call.
+        if (!blocks.empty() && bytes + slot.raw.size() > max_bytes)
+            break;
+        bytes += slot.raw.size();
+        last_hash_ = slot.hash;
+        blocks.push_back(std::move(slot.raw));
+        pending_.pop_front();
+        ++next_depth_;
+    }
+    scanning_ = true;
+    // Keep reading while the caller sends this batch.
+    if (continued)
+        fill_window();
+    return true;
+}
+
+void block_prefetcher::clear()
+{
+    pending_.clear();
+    next_depth_ = 0;
+    scanning_ = false;
+    last_hash_ = null_hash;
+}
+
+void block_prefetcher::fetch(blockchain& chain, size_t depth)
+{
+    auto slot = std::make_shared<fetch_slot>();
+    pending_.push_back(slot);
+    // Serializes on the disk thread that finished the read.
+    auto handle_block =
+        [slot](const std::error_code& ec, const block_type& blk)
+        {
+            std::string raw;
+            hash_digest hash = null_hash;
+            if (!ec)
+            {
+                raw.resize(satoshi_raw_size(blk));
+                satoshi_save(blk, raw.begin());
+                hash = hash_block_header(blk);
+            }
+            std::lock_guard<std::mutex> lock(slot->mutex);
+            slot->ec = ec;
+            slot->raw = std::move(raw);
+            slot->hash = hash;
+            slot->previous = blk.previous_block_hash;
+            slot->finished = true;
+            slot->done.notify_one();
+        };
+    fetch_block(chain, depth, handle_block);
+}
+
+block_prefetcher& thread_block_prefetcher()
+{
+    thread_local block_prefetcher prefetcher;
+    thread_local bool hooked = false;
+    // Read-ahead belongs to one connection's scan.
+    if (!hooked)
+    {
+        hooked = true;
+        on_connection_close(
+            []
+            {
+                prefetcher.clear();
+                hooked = false;
+            });
+    }
+    return prefetcher;
+}
+
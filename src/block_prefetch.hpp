@@ -0,0 +1,67 @@
+#ifndef QUERY_BLOCK_PREFETCH_HPP
+#define QUERY_BLOCK_PREFETCH_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <bitcoin/bitcoin.hpp>
+
+// Serialized blocks for sequential scans. Once a call continues where
+// the last one stopped, fetches run up to read_ahead blocks ahead of the
+// caller, so while one batch is being sent the next is already being
+// read on the chain's disk threads. A connection is served by a single
+// server thread, so each thread keeps one prefetcher and a scan's
+// read-ahead carries over from call to call until the connection
+// closes. Memory stays within read_ahead blocks plus one batch per
+// connection.
+//
+// A block read ahead that no longer chains onto the one handed out
+// before it was replaced by a reorganization, and is read again. If the
+// fresh copy doesn't chain on either, the block handed out was replaced
+// too and the scan has to be rewound by the caller.
+class block_prefetcher
+{
+public:
+    // Appends blocks from start_depth on until count blocks or max_bytes
+    // (but at least one block) are reached, or the chain's tip. ec is
+    // only set when not even the first block could be read. Returns
+    // false with no blocks when a block handed out earlier in the scan
+    // was replaced by a reorganization.
+    bool read(bc::blockchain& chain, size_t start_depth, size_t count,
+        size_t read_ahead, size_t max_bytes,
+        std::vector<std::string>& blocks, std::error_code& ec);
+    // Drops the scan and its read-ahead.
+    void clear();
+
+private:
+    struct fetch_slot
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+        std::error_code ec;
+        std::string raw;
+        bc::hash_digest hash, previous;
+    };
+    typedef std::shared_ptr<fetch_slot> fetch_slot_ptr;
+
+    // Abandoned slots are kept alive by their fetch until it finishes.
+    void fetch(bc::blockchain& chain, size_t depth);
+
+    // Fetches for consecutive depths from next_depth_ on.
+    std::deque<fetch_slot_ptr> pending_;
+    size_t next_depth_ = 0;
+    // Set once a call returned blocks, so the next can continue it.
+    bool scanning_ = false;
+    // Last block handed out, or null_hash at the start of a scan.
+    bc::hash_digest last_hash_ = bc::null_hash;
+};
+
+// This thread's prefetcher, cleared when its connection closes.
+block_prefetcher& thread_block_prefetcher();
+
+#endif
+
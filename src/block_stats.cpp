@@ -0,0 +1,235 @@
+#include "block_stats.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "echo.hpp"
+
+#define LOG_STATS "stats"
+
+using namespace bc;
+
+block_stats_table::~block_stats_table()
+{
+    if (fd_ != -1)
+        close(fd_);
+}
+
+bool block_stats_table::open(const std::string& path)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ == -1)
+    {
+        log_error(LOG_STATS) << "Couldn't open " << path;
+        return false;
+    }
+    return true;
+}
+
+void block_stats_table::write(size_t depth, const block_stats_type& stats)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pwrite(fd_, &stats, sizeof(stats), depth * sizeof(stats)) !=
+        sizeof(stats))
+    {
+        log_warning(LOG_STATS) << "Couldn't write stats for block " << depth;
+    }
+}
+
+void block_stats_table::truncate(size_t depth)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size() > depth && ftruncate(fd_, depth * sizeof(block_stats_type)))
+        log_warning(LOG_STATS) << "Couldn't truncate stats at " << depth;
+}
+
+std::vector<block_stats_type> block_stats_table::read(
+    size_t start_depth, size_t count) const
+{
+    const size_t end_depth = std::min(start_depth + count, size());
+    std::vector<block_stats_type> rows;
+    if (start_depth >= end_depth)
+        return rows;
+    rows.resize(end_depth - start_depth);
+    const size_t length = rows.size() * sizeof(block_stats_type);
+    ssize_t result = pread(fd_, rows.data(), length,
+        start_depth * sizeof(block_stats_type));
+    if (result < 0)
+        rows.clear();
+    else
+        rows.resize(result / sizeof(block_stats_type));
+    return rows;
+}
+
+size_t block_stats_table::size() const
+{
+    struct stat info;
+    if (fstat(fd_, &info) == -1)
+        return 0;
+    return info.st_size / sizeof(block_stats_type);
+}
+
+block_stats_type compute_block_stats(const sync_blockchain& chain,
+    const block_type& blk, std::error_code& ec)
+{
+    block_stats_type stats{0, 0, 0, 0, 0, 0};
+    stats.tx_count = blk.transactions.size();
+    stats.size = satoshi_raw_size(blk);
+    output_point_list prevouts;
+    uint64_t spent_output_value = 0;
+    for (const transaction_type& tx: blk.transactions)
+    {
+        stats.input_count += tx.inputs.size();
+        stats.output_count += tx.outputs.size();
+        uint64_t tx_output_value = 0;
+        for (const transaction_output_type& output: tx.outputs)
+            tx_output_value += output.value;
+        stats.total_output_value += tx_output_value;
+        if (is_coinbase(tx))
+            continue;
+        spent_output_value += tx_output_value;
+        for (const transaction_input_type& input: tx.inputs)
+            prevouts.push_back(input.previous_output);
+    }
+    uint64_t input_value = 0;
+    for (uint64_t value: chain.output_values(prevouts, ec))
+        input_value += value;
+    if (!ec)
+        stats.fees = input_value - spent_output_value;
+    return stats;
+}
+
+bool backfill_block_stats(
+    const sync_blockchain& chain, block_stats_table& table)
+{
+    std::error_code ec;
+    const size_t last_depth = chain.last_depth(ec);
+    if (ec)
+    {
+        log_error(LOG_STATS) << "Couldn't fetch last depth: " << ec.message();
+        return false;
+    }
+    echo() << "Computing missing stats up to depth " << last_depth;
+    return backfill_block_stats(chain, table, 0, last_depth + 1);
+}
+
+bool backfill_block_stats(const sync_blockchain& chain,
+    block_stats_table& table, size_t start_depth, size_t end_depth)
+{
+    // Depths that still need computing.
+    std::vector<size_t> missing;
+    const std::vector<block_stats_type> rows =
+        table.read(start_depth, end_depth - start_depth);
+    for (size_t depth = start_depth; depth < end_depth; ++depth)
+    {
+        const size_t row = depth - start_depth;
+        if (row >= rows.size() || rows[row].tx_count == 0)
+            missing.push_back(depth);
+    }
+    if (missing.empty())
+        return true;
+    log_debug(LOG_STATS) << missing.size() << " blocks need stats.";
+    std::atomic<size_t> next(0), done(0);
+    std::atomic<bool> failed(false);
+    auto worker =
+        [&]()
+        {
+            // Workers take depths in small chunks so slow blocks don't
+            // leave other threads idle at the end.
+            const size_t chunk = 64;
+            for (size_t begin = next.fetch_add(chunk);
+                begin < missing.size() && !failed;
+                begin = next.fetch_add(chunk))
+            {
+                const size_t end = std::min(begin + chunk, missing.size());
+                for (size_t i = begin; i < end; ++i)
+                {
+                    std::error_code wec;
+                    const block_type blk = chain.block(missing[i], wec);
+                    block_stats_type stats{0, 0, 0, 0, 0, 0};
+                    if (!wec)
+                        stats = compute_block_stats(chain, blk, wec);
+                    if (wec)
+                    {
+                        log_error(LOG_STATS) << "Block " << missing[i]
+                            << ": " << wec.message();
+                        failed = true;
+                        return;
+                    }
+                    table.write(missing[i], stats);
+                }
+                size_t total = done += end - begin;
+                if (total / 10000 != (total - (end - begin)) / 10000)
+                    echo() << "Computed stats for " << total << " / "
+                        << missing.size() << " blocks";
+            }
+        };
+    const size_t thread_count =
+        std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    for (std::thread& thread: threads)
+        thread.join();
+    return !failed;
+}
+
+constexpr size_t stats_key_size = 4;
+
+block_stats_target::block_stats_target(block_stats_table& table)
+  : table_(table)
+{
+}
+
+std::string block_stats_target::name() const
+{
+    return "stats";
+}
+size_t block_stats_target::record_size() const
+{
+    return stats_key_size + sizeof(block_stats_type);
+}
+size_t block_stats_target::key_size() const
+{
+    return stats_key_size;
+}
+
+bool block_stats_target::extract(const sync_blockchain& chain, size_t depth,
+    const block_type& blk, data_chunk& records)
+{
+    std::error_code ec;
+    const block_stats_type stats = compute_block_stats(chain, blk, ec);
+    if (ec)
+        return false;
+    const size_t offset = records.size();
+    records.resize(offset + record_size());
+    uint8_t* record = records.data() + offset;
+    for (size_t i = 0; i < stats_key_size; ++i)
+        record[i] = depth >> (8 * (stats_key_size - 1 - i));
+    memcpy(record + stats_key_size, &stats, sizeof(stats));
+    return true;
+}
+
+bool block_stats_target::load(const std::string& path)
+{
+    // Rows above the reindexed depths would outlive the rebuild.
+    table_.truncate(0);
+    std::ifstream file(path, std::ios::binary);
+    data_chunk record(record_size());
+    while (file.read(reinterpret_cast<char*>(record.data()), record.size()))
+    {
+        size_t depth = 0;
+        for (size_t i = 0; i < stats_key_size; ++i)
+            depth = (depth << 8) | record[i];
+        block_stats_type stats;
+        memcpy(&stats, record.data() + stats_key_size, sizeof(stats));
+        table_.write(depth, stats);
+    }
+    return file.eof();
+}
+
@@ -0,0 +1,75 @@
+#ifndef QUERY_BLOCK_STATS_HPP
+#define QUERY_BLOCK_STATS_HPP
+
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+#include "reindex.hpp"
+#include "sync_blockchain.hpp"
+
+// Fixed width row of the stats table. Every block has a coinbase, so a
+// zero tx_count marks a row that hasn't been computed yet.
+struct block_stats_type
+{
+    uint32_t tx_count, size, input_count, output_count;
+    uint64_t total_output_value, fees;
+};
+
+// Side table of block_stats_type rows indexed by depth, stored in a
+// flat file in host byte order.
+class block_stats_table
+{
+public:
+    block_stats_table() = default;
+    block_stats_table(const block_stats_table&) = delete;
+    void operator=(const block_stats_table&) = delete;
+    ~block_stats_table();
+
+    bool open(const std::string& path);
+
+    void write(size_t depth, const block_stats_type& stats);
+    // Drops every row from depth upwards.
+    void truncate(size_t depth);
+    // Rows in [start_depth, start_depth + count) that exist in the file.
+    std::vector<block_stats_type> read(size_t start_depth, size_t count) const;
+    size_t size() const;
+
+private:
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+};
+
+// Fees need the values of every spent output, which are looked up
+// through the chain. Coinbase inputs are skipped.
+block_stats_type compute_block_stats(const sync_blockchain& chain,
+    const bc::block_type& blk, std::error_code& ec);
+
+// Computes every missing row up to the chain's last depth, spreading the
+// depth range across all cores.
+bool backfill_block_stats(
+    const sync_blockchain& chain, block_stats_table& table);
+// Same for the rows in [start_depth, end_depth) only.
+bool backfill_block_stats(const sync_blockchain& chain,
+    block_stats_table& table, size_t start_depth, size_t end_depth);
+
+// Rebuilds the table through reindex(). Records are a big endian
+// depth followed by the row.
+class block_stats_target
+  : public reindex_target
+{
+public:
+    block_stats_target(block_stats_table& table);
+
+    std::string name() const;
+    size_t record_size() const;
+    size_t key_size() const;
+    bool extract(const sync_blockchain& chain, size_t depth,
+        const bc::block_type& blk, bc::data_chunk& records);
+    bool load(const std::string& path);
+
+private:
+    block_stats_table& table_;
+};
+
+#endif
+
@@ -0,0 +1,161 @@
+#include "compressed_transport.hpp"
+
+#include <chrono>
+#include <zlib.h>
+#include <thrift/transport/TTransportException.h>
+
+using namespace apache::thrift::transport;
+
+constexpr uint8_t codec_none = 0;
+constexpr uint8_t codec_zlib = 1;
+constexpr size_t frame_header_size = 4 + 1 + 4;
+
+transport_stats_type transport_stats;
+
+static void write_uint32(uint8_t* data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+static uint32_t read_uint32(const uint8_t* data)
+{
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+compressed_transport::compressed_transport(
+    transport_ptr transport, size_t threshold, size_t max_frame_size)
+  : transport_(transport), threshold_(threshold),
+    max_frame_size_(max_frame_size)
+{
+}
+
+bool compressed_transport::isOpen()
+{
+    return transport_->isOpen();
+}
+bool compressed_transport::peek()
+{
+    return read_position_ < read_buffer_.size() || transport_->peek();
+}
+void compressed_transport::open()
+{
+    transport_->open();
+}
+void compressed_transport::close()
+{
+    flush();
+    transport_->close();
+}
+
+uint32_t compressed_transport::read(uint8_t* buffer, uint32_t length)
+{
+    if (read_position_ == read_buffer_.size() && !read_frame())
+        return 0;
+    uint32_t available = read_buffer_.size() - read_position_;
+    uint32_t give = std::min(available, length);
+    std::copy(read_buffer_.begin() + read_position_,
+        read_buffer_.begin() + read_position_ + give, buffer);
+    read_position_ += give;
+    return give;
+}
+
+bool compressed_transport::read_frame()
+{
+    uint8_t header[frame_header_size];
+    // A clean EOF before any frame byte just means the peer hung up.
+    if (transport_->read(header, 1) == 0)
+        return false;
+    transport_->readAll(header + 1, frame_header_size - 1);
+    uint32_t frame_size = read_uint32(header);
+    uint8_t codec = header[4];
+    uint32_t raw_size = read_uint32(header + 5);
+    if (frame_size < frame_header_size - 4)
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+            "Frame size too small");
+    const size_t payload_size = frame_size - (frame_header_size - 4);
+    if (payload_size > max_frame_size_ || raw_size > max_frame_size_)
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+            "Frame too large");
+    std::vector<uint8_t> payload(payload_size);
+    transport_->readAll(payload.data(), payload.size());
+    read_position_ = 0;
+    if (codec == codec_none)
+    {
+        read_buffer_.swap(payload);
+        return true;
+    }
+    if (codec != codec_zlib)
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+            "Unknown frame codec");
+    read_buffer_.resize(raw_size);
+    uLongf dest_size = raw_size;
+    int result = uncompress(read_buffer_.data(), &dest_size,
+        payload.data(), payload.size());
+    if (result != Z_OK || dest_size != raw_size)
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+            "Unable to decompress frame");
+    return true;
+}
+
+void compressed_transport::write(const uint8_t* buffer, uint32_t length)
+{
+    write_buffer_.insert(write_buffer_.end(), buffer, buffer + length);
+}
+
+void compressed_transport::flush()
+{
+    if (write_buffer_.empty())
+        return;
+    const uint32_t raw_size = write_buffer_.size();
+    std::vector<uint8_t> frame(frame_header_size);
+    uint8_t codec = codec_none;
+    if (raw_size >= threshold_)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uLongf compressed_size = compressBound(raw_size);
+        frame.resize(frame_header_size + compressed_size);
+        int result = compress2(frame.data() + frame_header_size,
+            &compressed_size, write_buffer_.data(), raw_size,
+            Z_BEST_SPEED);
+        auto duration = std::chrono::steady_clock::now() - start;
+        transport_stats.compress_microseconds +=
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                duration).count();
+        // Incompressible payloads are sent as is.
+        if (result == Z_OK && compressed_size < raw_size)
+        {
+            frame.resize(frame_header_size + compressed_size);
+            codec = codec_zlib;
+            ++transport_stats.compressed_frames;
+        }
+    }
+    if (codec == codec_none)
+    {
+        frame.resize(frame_header_size);
+        frame.insert(frame.end(), write_buffer_.begin(), write_buffer_.end());
+    }
+    write_uint32(frame.data(), frame.size() - 4);
+    frame[4] = codec;
+    write_uint32(frame.data() + 5, raw_size);
+    write_buffer_.clear();
+    transport_stats.raw_bytes += raw_size;
+    transport_stats.wire_bytes += frame.size();
+    transport_->write(frame.data(), frame.size());
+    transport_->flush();
+}
+
+compressed_transport_factory::compressed_transport_factory(
+    size_t threshold, size_t max_frame_size)
+  : threshold_(threshold), max_frame_size_(max_frame_size)
+{
+}
+
+boost::shared_ptr<TTransport> compressed_transport_factory::getTransport(
+    boost::shared_ptr<TTransport> transport)
+{
+    return boost::shared_ptr<TTransport>(
+        new compressed_transport(transport, threshold_, max_frame_size_));
+}
+
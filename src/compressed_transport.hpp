@@ -0,0 +1,64 @@
+#ifndef QUERY_COMPRESSED_TRANSPORT_HPP
+#define QUERY_COMPRESSED_TRANSPORT_HPP
+
+#include <atomic>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+// Totals across every compressed connection, reported on server stop.
+struct transport_stats_type
+{
+    std::atomic<uint64_t> raw_bytes, wire_bytes;
+    std::atomic<uint64_t> compressed_frames, compress_microseconds;
+};
+extern transport_stats_type transport_stats;
+
+// Framed transport where each frame is zlib compressed once its payload
+// reaches the threshold. Frame layout (big endian):
+//   [4 bytes frame size] [1 byte codec] [4 bytes raw size] [payload]
+// Codec 0 is uncompressed and codec 1 is zlib.
+class compressed_transport
+  : public apache::thrift::transport::TVirtualTransport<compressed_transport>
+{
+public:
+    typedef boost::shared_ptr<apache::thrift::transport::TTransport>
+        transport_ptr;
+
+    // Frames whose payload or decompressed size exceeds max_frame_size
+    // are rejected before anything is allocated for them.
+    compressed_transport(transport_ptr transport, size_t threshold,
+        size_t max_frame_size);
+
+    bool isOpen();
+    bool peek();
+    void open();
+    void close();
+
+    uint32_t read(uint8_t* buffer, uint32_t length);
+    void write(const uint8_t* buffer, uint32_t length);
+    void flush();
+
+private:
+    bool read_frame();
+
+    transport_ptr transport_;
+    const size_t threshold_, max_frame_size_;
+    std::vector<uint8_t> write_buffer_, read_buffer_;
+    size_t read_position_ = 0;
+};
+
+class compressed_transport_factory
+  : public apache::thrift::transport::TTransportFactory
+{
+public:
+    compressed_transport_factory(size_t threshold, size_t max_frame_size);
+    boost::shared_ptr<apache::thrift::transport::TTransport> getTransport(
+        boost::shared_ptr<apache::thrift::transport::TTransport> transport);
+private:
+    const size_t threshold_, max_frame_size_;
+};
+
+#endif
+
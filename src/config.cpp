@@ -14,24 +14,116 @@ void get_value(const libconfig::Setting& root, config_map_type& config,
         config[key_name] = boost::lexical_cast<std::string>(fallback_value);
 }
 
-void load_config(config_map_type& config, const std::string& config_path)
+bool load_config(config_map_type& config, const std::string& config_path)
 {
     libconfig::Config cfg;
-    // Ignore error if unable to read config file.
+    bool success = true;
+    // Startup carries on with defaults if unable to read config file.
     try
     {
         cfg.readFile(config_path.c_str());
     }
-    catch (const libconfig::FileIOException&) {}
-    catch (const libconfig::ParseException&) {}
+    catch (const libconfig::FileIOException&)
+    {
+        success = false;
+    }
+    catch (const libconfig::ParseException&)
+    {
+        success = false;
+    }
+    // Reread on SIGHUP.
+    config["config-file"] = config_path;
     // Read off values
     const libconfig::Setting& root = cfg.getRoot();
     get_value<std::string>(root, config, "output-file", "debug.log");
     get_value<std::string>(root, config, "error-file", "error.log");
+    // Lowest level written out: debug, info, warning or error.
+    get_value<std::string>(root, config, "log-level", "debug");
     get_value<std::string>(root, config, "database", "database");
+    get_value<std::string>(root, config, "block-stats-file", "block_stats");
+    // Built by queryd --reindex scripts. Blocks since are kept in memory
+    // and merged into the file every script-index-flush-blocks blocks.
+    get_value<std::string>(root, config, "script-index-file", "script_index");
+    get_value(root, config, "script-index-flush-blocks", 1000);
     get_value(root, config, "block-publish-port", 5563);
     get_value(root, config, "tx-publish-port", 5564);
+    // Depth, header and tx hashes of each block, for subscribers that
+    // already follow the tx feed.
+    get_value(root, config, "compact-block-publish-port", 5565);
+    // Optional extra endpoints such as "ipc:///tmp/queryd-block".
+    get_value<std::string>(root, config, "block-publish-endpoint", "");
+    get_value<std::string>(root, config, "tx-publish-endpoint", "");
+    get_value<std::string>(root, config,
+        "compact-block-publish-endpoint", "");
+    // none or zlib, per socket. Subscribers must use the same setting.
+    get_value<std::string>(root, config, "block-publish-compression", "none");
+    get_value<std::string>(root, config, "tx-publish-compression", "none");
     get_value(root, config, "service-port", 9090);
+    // binary or compact
+    get_value<std::string>(root, config, "service-protocol", "binary");
+    // buffered, framed or compressed
+    get_value<std::string>(root, config, "service-transport", "buffered");
+    get_value(root, config, "compression-threshold", 4096);
+    // Largest compressed transport frame accepted, compressed or not.
+    get_value(root, config, "compression-max-frame", 64 * 1024 * 1024);
+    // Server threads per listener. Each open connection holds one.
+    get_value(root, config, "service-threads", 10);
+    // Unix domain socket listener served alongside service-port.
+    // Disabled when the path is empty.
+    get_value<std::string>(root, config, "unix-socket", "");
+    get_value<std::string>(root, config, "unix-socket-protocol", "binary");
+    get_value<std::string>(root, config, "unix-socket-transport", "buffered");
+    get_value(root, config, "unix-socket-threads", 10);
     get_value<std::string>(root, config, "stop-secret", "");
+    // Seconds requests in flight get to finish once stopping.
+    get_value(root, config, "drain-timeout", 10);
+    // Requests slower than this many milliseconds are written with their
+    // stage timings to slow-query-file. Disabled when 0.
+    get_value(root, config, "slow-query-threshold", 1000);
+    get_value<std::string>(root, config,
+        "slow-query-file", "slow-queries.log");
+    // Number of blocks whose merkle trees are kept for merkle_proof.
+    get_value(root, config, "merkle-cache-size", 256);
+    // Upper bound on transactions visited by trace_forward/backward.
+    get_value(root, config, "trace-max-nodes", 10000);
+    // blocks_raw reads up to blocks-read-ahead blocks ahead of each scan
+    // and returns at most blocks-raw-max-bytes per call.
+    get_value(root, config, "blocks-read-ahead", 32);
+    get_value(root, config, "blocks-raw-max-bytes", 16777216);
+    // Most headers block_headers_in_time_range returns per call.
+    get_value(root, config, "time-range-max-headers", 2016);
+    // Most rows block_stats returns per call.
+    get_value(root, config, "block-stats-max-rows", 2016);
+    // Recent blocks kept in memory to answer history_since cheaply.
+    get_value(root, config, "history-window", 1000);
+    // Output values kept to price pool transactions without lookups.
+    get_value(root, config, "mempool-value-cache-size", 100000);
+    // Pool saved on stop and every mempool-save-interval seconds.
+    // Disabled when the path is empty; an interval of 0 only saves on stop.
+    get_value<std::string>(root, config, "mempool-file", "mempool");
+    get_value(root, config, "mempool-save-interval", 600);
+    // queryd --reindex keeps its sorted runs and checkpoints here.
+    get_value<std::string>(root, config, "reindex-dir", "reindex");
+    get_value(root, config, "reindex-partition-size", 10000);
+    // queryd syncs without serving extras until its tip is younger than
+    // sync-tip-age seconds, with sync-disk-threads more disk threads.
+    // libbitcoin doesn't expose the start heights peers advertise, so
+    // the tip's age stands in for them. The extra threads stay in the
+    // pool after the switch since a threadpool can't shrink.
+    get_value(root, config, "sync-tip-age", 7200);
+    get_value(root, config, "sync-disk-threads", 6);
+    // query-router settings
+    get_value<std::string>(root, config, "router-backends", "");
+    get_value<std::string>(root, config, "router-backend-protocol", "binary");
+    get_value<std::string>(root, config,
+        "router-backend-transport", "buffered");
+    get_value(root, config, "router-hedge-delay", 50);
+    get_value(root, config, "router-poll-interval", 500);
+    // Threads running backend calls, and backend socket timeouts in
+    // milliseconds.
+    get_value(root, config, "router-threads", 32);
+    get_value(root, config, "router-connect-timeout", 1000);
+    get_value(root, config, "router-request-timeout", 30000);
+    return success;
 }
 
@@ -5,7 +5,9 @@
 #include <string>
 
 typedef std::map<std::string, std::string> config_map_type;
-void load_config(config_map_type& config, const std::string& config_path);
+// Missing settings get their defaults. Returns false when the file
+// couldn't be read or parsed, leaving every setting at its default.
+bool load_config(config_map_type& config, const std::string& config_path);
 
 #endif
 
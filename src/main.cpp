@@ -1,11 +1,111 @@
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+
 #include "node_impl.hpp"
+#include "block_stats.hpp"
 #include "echo.hpp"
+#include "reindex.hpp"
+#include "script_index.hpp"
 #include "service.hpp"
+#include "snapshot.hpp"
+#include "snapshot_export.hpp"
+#include "snapshot_service.hpp"
+
+int export_snapshot(config_map_type& config, const std::string& path)
+{
+    node_impl node;
+    echo() << "Opening blockchain...";
+    if (!node.start_blockchain(config))
+        return 1;
+    sync_blockchain chain(node.blockchain());
+    bool success = export_snapshot(chain, path);
+    node.stop();
+    return success ? 0 : 1;
+}
+
+int backfill_stats(config_map_type& config)
+{
+    node_impl node;
+    echo() << "Opening blockchain...";
+    if (!node.start_blockchain(config))
+        return 1;
+    sync_blockchain chain(node.blockchain());
+    bool success = backfill_block_stats(chain, node.block_stats());
+    node.stop();
+    return success ? 0 : 1;
+}
+
+int reindex_index(config_map_type& config, const std::string& name)
+{
+    node_impl node;
+    echo() << "Opening blockchain...";
+    if (!node.start_blockchain(config))
+        return 1;
+    std::unique_ptr<reindex_target> target;
+    if (name == "stats")
+        target.reset(new block_stats_target(node.block_stats()));
+    else if (name == "scripts")
+        target.reset(new script_index_target(config["script-index-file"],
+            sync_blockchain(node.blockchain())));
+    else
+    {
+        std::cerr << "Unknown index: " << name << std::endl;
+        node.stop();
+        return 1;
+    }
+    sync_blockchain chain(node.blockchain());
+    bool success = reindex(chain, *target, config["reindex-dir"],
+        boost::lexical_cast<size_t>(config["reindex-partition-size"]));
+    node.stop();
+    return success ? 0 : 1;
+}
+
+int serve_snapshot(config_map_type& config, const std::string& path)
+{
+    block_server_signals();
+    snapshot snap;
+    if (!snap.open(path))
+        return 1;
+    echo() << "Serving snapshot " << path;
+    start_snapshot_server(config, snap);
+    echo() << "Server stopped.";
+    return 0;
+}
 
 int main(int argc, char** argv)
 {
+    std::string config_path = "query.cfg", mode, mode_arg;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string option = argv[i];
+        const bool has_value = i + 1 < argc && argv[i + 1][0] != '-';
+        if (option == "--config" && has_value)
+            config_path = argv[++i];
+        else
+        {
+            mode = option;
+            if (has_value)
+                mode_arg = argv[++i];
+        }
+    }
     config_map_type config;
-    load_config(config, "query.cfg");
+    load_config(config, config_path);
+    if (mode == "--export-snapshot")
+        return export_snapshot(config, mode_arg);
+    if (mode == "--serve-snapshot")
+        return serve_snapshot(config, mode_arg);
+    if (mode == "--backfill-stats")
+        return backfill_stats(config);
+    if (mode == "--reindex")
+        return reindex_index(config, mode_arg);
+    if (!mode.empty())
+    {
+        std::cerr << "Unknown option: " << mode << std::endl;
+        return 1;
+    }
+    // The node's threads inherit the mask, leaving SIGHUP, SIGINT and
+    // SIGTERM to the server.
+    block_server_signals();
     node_impl node;
     echo() << "Starting node...";
     if (!node.start(config))
@@ -0,0 +1,81 @@
+#include "mempool_file.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+using namespace bc;
+
+const std::string mempool_magic = "QMP1";
+// Transactions can't outgrow a block.
+constexpr uint32_t mempool_max_tx_size = 1000000;
+
+bool save_mempool(const std::string& path,
+    const std::vector<transaction_type>& txs)
+{
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary);
+    file.write(mempool_magic.data(), mempool_magic.size());
+    data_chunk raw_tx;
+    for (const transaction_type& tx: txs)
+    {
+        raw_tx.resize(satoshi_raw_size(tx));
+        satoshi_save(tx, raw_tx.begin());
+        uint8_t length[4];
+        auto serial = make_serializer(length);
+        serial.write_4_bytes(raw_tx.size());
+        file.write(reinterpret_cast<const char*>(length), sizeof(length));
+        file.write(reinterpret_cast<const char*>(raw_tx.data()),
+            raw_tx.size());
+    }
+    file.close();
+    if (!file)
+    {
+        log_error() << "Couldn't write " << temp_path;
+        return false;
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        log_error() << "Couldn't rename " << temp_path << " to " << path;
+        return false;
+    }
+    return true;
+}
+
+bool load_mempool(const std::string& path, std::vector<std::string>& txs_data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return true;
+    const std::streamoff file_size = file.tellg();
+    file.seekg(0);
+    std::string magic(mempool_magic.size(), '\0');
+    file.read(&magic[0], magic.size());
+    if (!file || magic != mempool_magic)
+    {
+        log_error() << "Unrecognised mempool file " << path;
+        return false;
+    }
+    uint8_t length[4];
+    while (file.read(reinterpret_cast<char*>(length), sizeof(length)))
+    {
+        auto deserial = make_deserializer(length, length + sizeof(length));
+        const uint32_t tx_size = deserial.read_4_bytes();
+        // A corrupt length would otherwise allocate up to 4 GB.
+        if (tx_size > mempool_max_tx_size ||
+            tx_size > file_size - std::streamoff(file.tellg()))
+        {
+            log_error() << "Corrupt mempool file " << path;
+            txs_data.clear();
+            return false;
+        }
+        std::string tx_data(tx_size, '\0');
+        if (!file.read(&tx_data[0], tx_data.size()))
+        {
+            log_warning() << "Truncated mempool file " << path;
+            break;
+        }
+        txs_data.push_back(std::move(tx_data));
+    }
+    return true;
+}
+
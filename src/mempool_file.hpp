@@ -0,0 +1,19 @@
+#ifndef QUERY_MEMPOOL_FILE_HPP
+#define QUERY_MEMPOOL_FILE_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+// The pool is saved as a 4 byte magic followed by one record per
+// transaction: a little endian uint32 length and the satoshi serialized
+// transaction. Records are in no particular order.
+
+// Writes to a temporary file renamed over path, so a crash mid-save
+// leaves the previous file intact.
+bool save_mempool(const std::string& path,
+    const std::vector<bc::transaction_type>& txs);
+
+// Reads the raw records. A missing file yields no records.
+bool load_mempool(const std::string& path, std::vector<std::string>& txs_data);
+
+#endif
+
@@ -0,0 +1,152 @@
+#include "mempool_stats.hpp"
+
+using namespace bc;
+
+// Buckets grow by a quarter from 1 satoshi per byte, with the first
+// bucket catching anything cheaper.
+constexpr double bucket_ratio = 1.25;
+constexpr double max_bucket_fee_rate = 10000;
+
+mempool_stats::mempool_stats(blockchain& chain, transaction_pool& txpool,
+    size_t value_cache_size)
+  : chain_(chain), txpool_(txpool), value_cache_size_(value_cache_size)
+{
+    histogram_.buckets.push_back(fee_bucket_type{0, 0, 0, 0});
+    for (double rate = 1; rate < max_bucket_fee_rate; rate *= bucket_ratio)
+        histogram_.buckets.push_back(fee_bucket_type{rate, 0, 0, 0});
+    histogram_.tx_count = 0;
+    histogram_.total_size = 0;
+}
+
+void mempool_stats::add(const transaction_type& tx)
+{
+    const hash_digest tx_hash = hash_transaction(tx);
+    cache_outputs(tx_hash, tx);
+    entry_type entry{false, 0, satoshi_raw_size(tx), 0};
+    uint64_t input_total = 0;
+    bool resolved = true;
+    for (const transaction_input_type& input: tx.inputs)
+    {
+        uint64_t value = 0;
+        resolved = resolved && input_value(input.previous_output, value);
+        input_total += value;
+    }
+    uint64_t output_total = 0;
+    for (const transaction_output_type& output: tx.outputs)
+        output_total += output.value;
+    if (resolved && input_total >= output_total)
+    {
+        entry.priced = true;
+        entry.fee = input_total - output_total;
+        entry.bucket = bucket_index(double(entry.fee) / entry.size);
+    }
+    else
+        log_debug() << "Couldn't price pool transaction " << tx_hash;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!entries_.emplace(tx_hash, entry).second || !entry.priced)
+        return;
+    fee_bucket_type& bucket = histogram_.buckets[entry.bucket];
+    ++bucket.tx_count;
+    bucket.total_size += entry.size;
+    bucket.total_fees += entry.fee;
+    ++histogram_.tx_count;
+    histogram_.total_size += entry.size;
+}
+
+void mempool_stats::remove(const hash_digest& tx_hash)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(tx_hash);
+    if (it == entries_.end())
+        return;
+    const entry_type& entry = it->second;
+    if (!entry.priced)
+    {
+        entries_.erase(it);
+        return;
+    }
+    fee_bucket_type& bucket = histogram_.buckets[entry.bucket];
+    --bucket.tx_count;
+    bucket.total_size -= entry.size;
+    bucket.total_fees -= entry.fee;
+    --histogram_.tx_count;
+    histogram_.total_size -= entry.size;
+    entries_.erase(it);
+}
+
+fee_histogram_type mempool_stats::histogram() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return histogram_;
+}
+
+std::vector<hash_digest> mempool_stats::hashes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<hash_digest> result;
+    result.reserve(entries_.size());
+    for (const auto& item: entries_)
+        result.push_back(item.first);
+    return result;
+}
+
+void mempool_stats::set_value_cache_size(size_t value_cache_size)
+{
+    value_cache_size_ = value_cache_size;
+}
+
+size_t mempool_stats::bucket_index(double fee_rate) const
+{
+    // Bucket bounds never change after construction.
+    const auto& buckets = histogram_.buckets;
+    auto it = std::upper_bound(buckets.begin(), buckets.end(), fee_rate,
+        [](double rate, const fee_bucket_type& bucket)
+        {
+            return rate < bucket.min_fee_rate;
+        });
+    return it - buckets.begin() - 1;
+}
+
+bool mempool_stats::input_value(const output_point& prevout, uint64_t& value)
+{
+    auto it = value_cache_.find(prevout.hash);
+    if (it != value_cache_.end())
+    {
+        if (prevout.index >= it->second.size())
+            return false;
+        value = it->second[prevout.index];
+        return true;
+    }
+    // Unconfirmed parents are in the pool, the rest in the chain.
+    std::error_code ec;
+    transaction_type prev_tx = txpool_.get(prevout.hash, ec);
+    if (ec)
+        prev_tx = chain_.transaction(prevout.hash, ec);
+    if (ec)
+        return false;
+    // Caching may evict the entry straight away when the cache is
+    // small, so read the value from the transaction itself.
+    cache_outputs(prevout.hash, prev_tx);
+    if (prevout.index >= prev_tx.outputs.size())
+        return false;
+    value = prev_tx.outputs[prevout.index].value;
+    return true;
+}
+
+void mempool_stats::cache_outputs(const hash_digest& tx_hash,
+    const transaction_type& tx)
+{
+    std::vector<uint64_t> values;
+    values.reserve(tx.outputs.size());
+    for (const transaction_output_type& output: tx.outputs)
+        values.push_back(output.value);
+    if (!value_cache_.emplace(tx_hash, std::move(values)).second)
+        return;
+    value_cache_order_.push_back(tx_hash);
+    while (value_cache_order_.size() > value_cache_size_)
+    {
+        value_cache_.erase(value_cache_order_.front());
+        value_cache_order_.pop_front();
+    }
+}
+
@@ -0,0 +1,77 @@
+#ifndef QUERY_MEMPOOL_STATS_HPP
+#define QUERY_MEMPOOL_STATS_HPP
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+#include "sync_blockchain.hpp"
+#include "sync_transaction_pool.hpp"
+
+struct fee_bucket_type
+{
+    // Lower bound in satoshis per byte.
+    double min_fee_rate;
+    size_t tx_count;
+    uint64_t total_size, total_fees;
+};
+
+struct fee_histogram_type
+{
+    std::vector<fee_bucket_type> buckets;
+    size_t tx_count;
+    uint64_t total_size;
+};
+
+// Fee rate histogram of the transaction pool, updated as transactions
+// enter and leave so reading it costs O(buckets).
+// add() and remove() must be called from a single thread in pool order.
+class mempool_stats
+{
+public:
+    mempool_stats(bc::blockchain& chain, bc::transaction_pool& txpool,
+        size_t value_cache_size);
+
+    // Transactions whose inputs can't be resolved are tracked but left
+    // out of the histogram.
+    void add(const bc::transaction_type& tx);
+    // Confirmed or evicted.
+    void remove(const bc::hash_digest& tx_hash);
+
+    fee_histogram_type histogram() const;
+    // Hashes of every tracked transaction.
+    std::vector<bc::hash_digest> hashes() const;
+    // A smaller cache shrinks as new outputs are cached.
+    void set_value_cache_size(size_t value_cache_size);
+
+private:
+    struct entry_type
+    {
+        bool priced;
+        size_t bucket;
+        uint64_t size, fee;
+    };
+
+    size_t bucket_index(double fee_rate) const;
+    bool input_value(const bc::output_point& prevout, uint64_t& value);
+    void cache_outputs(const bc::hash_digest& tx_hash,
+        const bc::transaction_type& tx);
+
+    sync_blockchain chain_;
+    sync_transaction_pool txpool_;
+    // Output values by transaction hash. Outputs of pool transactions
+    // are cached on arrival since their children tend to follow.
+    // Only touched by the updating thread, apart from the size.
+    std::atomic<size_t> value_cache_size_;
+    std::map<bc::hash_digest, std::vector<uint64_t>> value_cache_;
+    std::deque<bc::hash_digest> value_cache_order_;
+
+    mutable std::mutex mutex_;
+    std::map<bc::hash_digest, entry_type> entries_;
+    fee_histogram_type histogram_;
+};
+
+#endif
+
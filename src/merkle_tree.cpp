@@ -0,0 +1,268 @@
+#include "merkle_tree.hpp"
+
+using namespace bc;
+
+// SHA256 round constants and initial state.
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+static const uint32_t sha256_init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+// Several independent pairs go through SHA256 side by side, one per
+// lane. GCC and Clang lower the vector type to SSE2 or NEON and fall
+// back to plain integer code elsewhere. Leftover pairs use one lane.
+constexpr size_t hash_lanes = 4;
+typedef uint32_t lane_vector
+    __attribute__((vector_size(sizeof(uint32_t) * hash_lanes)));
+
+template <typename Word>
+static Word broadcast(uint32_t value)
+{
+    return Word{} + value;
+}
+
+template <typename Word>
+static Word rotate(Word value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+template <typename Word>
+static void sha256_transform(Word* state, const Word* block)
+{
+    Word w[64];
+    std::copy(block, block + 16, w);
+    for (size_t i = 16; i < 64; ++i)
+    {
+        const Word s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^
+            (w[i - 15] >> 3);
+        const Word s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^
+            (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    Word a = state[0], b = state[1], c = state[2], d = state[3],
+        e = state[4], f = state[5], g = state[6], h = state[7];
+    for (size_t i = 0; i < 64; ++i)
+    {
+        const Word s1 = rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+        const Word choose = (e & f) ^ (~e & g);
+        const Word t1 =
+            h + s1 + choose + broadcast<Word>(sha256_k[i]) + w[i];
+        const Word s0 = rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+        const Word majority = (a & b) ^ (a & c) ^ (b & c);
+        const Word t2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void set_lane(uint32_t& word, size_t, uint32_t value)
+{
+    word = value;
+}
+static void set_lane(lane_vector& word, size_t lane, uint32_t value)
+{
+    word[lane] = value;
+}
+static uint32_t get_lane(uint32_t word, size_t)
+{
+    return word;
+}
+static uint32_t get_lane(const lane_vector& word, size_t lane)
+{
+    return word[lane];
+}
+
+// Hashes are stored reversed, so the big endian words SHA256 reads are
+// little endian words taken from the end of each hash.
+static uint32_t load_word(const hash_digest& hash, size_t word)
+{
+    const uint8_t* data = hash.data() + 28 - 4 * word;
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        (uint32_t(data[3]) << 24);
+}
+static void store_word(hash_digest& hash, size_t word, uint32_t value)
+{
+    uint8_t* data = hash.data() + 28 - 4 * word;
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+// Double hashes Lanes pairs at once. The second block of the first
+// hash and the single block of the second are all padding but for the
+// first digest.
+template <typename Word, size_t Lanes>
+static void hash_pair_lanes(const hash_digest* in, hash_digest* out)
+{
+    Word block[16], state[8];
+    for (size_t word = 0; word < 16; ++word)
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            set_lane(block[word], lane,
+                load_word(in[2 * lane + word / 8], word % 8));
+    for (size_t i = 0; i < 8; ++i)
+        state[i] = broadcast<Word>(sha256_init[i]);
+    sha256_transform(state, block);
+    // 64 byte message.
+    block[0] = broadcast<Word>(0x80000000);
+    std::fill(block + 1, block + 15, broadcast<Word>(0));
+    block[15] = broadcast<Word>(512);
+    sha256_transform(state, block);
+    // 32 byte digest.
+    std::copy(state, state + 8, block);
+    block[8] = broadcast<Word>(0x80000000);
+    std::fill(block + 9, block + 15, broadcast<Word>(0));
+    block[15] = broadcast<Word>(256);
+    for (size_t i = 0; i < 8; ++i)
+        state[i] = broadcast<Word>(sha256_init[i]);
+    sha256_transform(state, block);
+    for (size_t word = 0; word < 8; ++word)
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            store_word(out[lane], word, get_lane(state[word], lane));
+}
+
+void hash_pairs(const hash_digest* in, size_t pairs, hash_digest* out)
+{
+    size_t i = 0;
+    for (; i + hash_lanes <= pairs; i += hash_lanes)
+        hash_pair_lanes<lane_vector, hash_lanes>(in + 2 * i, out + i);
+    for (; i < pairs; ++i)
+        hash_pair_lanes<uint32_t, 1>(in + 2 * i, out + i);
+}
+
+merkle_tree::merkle_tree(const hash_list& tx_hashes)
+{
+    BITCOIN_ASSERT(!tx_hashes.empty());
+    levels_.push_back(tx_hashes);
+    while (levels_.back().size() > 1)
+    {
+        const hash_list& level = levels_.back();
+        const size_t pairs = level.size() / 2;
+        hash_list parents((level.size() + 1) / 2);
+        hash_pairs(level.data(), pairs, parents.data());
+        // Odd levels pair their last hash with itself.
+        if (pairs < parents.size())
+        {
+            const hash_digest last[2] = {level.back(), level.back()};
+            hash_pairs(last, 1, &parents.back());
+        }
+        levels_.push_back(std::move(parents));
+    }
+}
+
+const hash_digest& merkle_tree::root() const
+{
+    return levels_.back().front();
+}
+
+const hash_digest& merkle_tree::leaf(size_t position) const
+{
+    return levels_.front()[position];
+}
+
+size_t merkle_tree::size() const
+{
+    return levels_.front().size();
+}
+
+hash_list merkle_tree::branch(size_t position) const
+{
+    hash_list branch;
+    for (size_t i = 0; i + 1 < levels_.size(); ++i)
+    {
+        const hash_list& level = levels_[i];
+        size_t sibling = position ^ 1;
+        // Missing right sibling on an odd level is the node itself.
+        if (sibling >= level.size())
+            sibling = position;
+        branch.push_back(level[sibling]);
+        position /= 2;
+    }
+    return branch;
+}
+
+merkle_cache::merkle_cache(size_t capacity)
+  : capacity_(capacity)
+{
+}
+
+merkle_tree_ptr merkle_cache::get(const hash_digest& block_hash)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(block_hash);
+    if (it == entries_.end())
+        return nullptr;
+    usage_.splice(usage_.begin(), usage_, it->second.usage);
+    return it->second.tree;
+}
+
+void merkle_cache::put(const hash_digest& block_hash, merkle_tree_ptr tree)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0 || entries_.count(block_hash))
+        return;
+    usage_.push_front(block_hash);
+    entries_[block_hash] = entry{tree, usage_.begin()};
+    evict();
+}
+
+void merkle_cache::set_capacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    evict();
+}
+
+void merkle_cache::evict()
+{
+    while (entries_.size() > capacity_)
+    {
+        entries_.erase(usage_.back());
+        usage_.pop_back();
+    }
+}
+
+merkle_tree_ptr make_merkle_tree(const inventory_list& txs)
+{
+    hash_list tx_hashes;
+    tx_hashes.reserve(txs.size());
+    for (const inventory_vector_type& inv: txs)
+        tx_hashes.push_back(inv.hash);
+    return std::make_shared<merkle_tree>(tx_hashes);
+}
+
+merkle_tree_ptr make_merkle_tree(const transaction_list& txs)
+{
+    hash_list tx_hashes;
+    tx_hashes.reserve(txs.size());
+    for (const transaction_type& tx: txs)
+        tx_hashes.push_back(hash_transaction(tx));
+    return std::make_shared<merkle_tree>(tx_hashes);
+}
+
@@ -0,0 +1,111 @@
+#ifndef QUERY_MERKLE_TREE_HPP
+#define QUERY_MERKLE_TREE_HPP
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+#include "sync_blockchain.hpp"
+
+// Batched kernel for one tree level: out[i] = double SHA256 of
+// in[2 * i] and in[2 * i + 1], several pairs at a time in SIMD lanes.
+// Hashes are in libbitcoin's big endian order, same as
+// generate_merkle_root.
+void hash_pairs(const bc::hash_digest* in, size_t pairs, bc::hash_digest* out);
+
+// Every level of a block's merkle tree, leaves first.
+class merkle_tree
+{
+public:
+    merkle_tree(const bc::hash_list& tx_hashes);
+
+    const bc::hash_digest& root() const;
+    const bc::hash_digest& leaf(size_t position) const;
+    size_t size() const;
+    // Sibling hashes from the leaf up to just below the root.
+    bc::hash_list branch(size_t position) const;
+
+private:
+    std::vector<bc::hash_list> levels_;
+};
+
+typedef std::shared_ptr<const merkle_tree> merkle_tree_ptr;
+
+// Bounded LRU of built trees keyed by block hash. Keying by block hash
+// means reorganizations can never serve a stale tree.
+class merkle_cache
+{
+public:
+    merkle_cache(size_t capacity);
+    merkle_tree_ptr get(const bc::hash_digest& block_hash);
+    void put(const bc::hash_digest& block_hash, merkle_tree_ptr tree);
+    // Evicts down to a smaller capacity straight away.
+    void set_capacity(size_t capacity);
+
+private:
+    typedef std::list<bc::hash_digest> usage_list;
+    struct entry
+    {
+        merkle_tree_ptr tree;
+        usage_list::iterator usage;
+    };
+
+    void evict();
+
+    size_t capacity_;
+    std::mutex mutex_;
+    usage_list usage_;
+    std::map<bc::hash_digest, entry> entries_;
+};
+
+merkle_tree_ptr make_merkle_tree(const bc::inventory_list& txs);
+merkle_tree_ptr make_merkle_tree(const bc::transaction_list& txs);
+
+struct merkle_branch_t
+{
+    bc::hash_list branch;
+    size_t position, depth;
+    bc::hash_digest root;
+};
+
+// Locates tx_hash through the chain's transaction index and answers
+// from the cache, building and caching the block's tree on a miss.
+// Works with sync_blockchain and snapshot alike.
+template <typename Chain>
+merkle_branch_t merkle_branch(const Chain& chain, merkle_cache& cache,
+    const bc::hash_digest& tx_hash, std::error_code& ec)
+{
+    merkle_branch_t result{bc::hash_list(), 0, 0, bc::null_hash};
+    transaction_index_t index = chain.transaction_index(tx_hash, ec);
+    if (ec)
+        return result;
+    const bc::block_type header = chain.block_header(index.depth, ec);
+    if (ec)
+        return result;
+    const bc::hash_digest block_hash = bc::hash_block_header(header);
+    merkle_tree_ptr tree = cache.get(block_hash);
+    if (!tree)
+    {
+        auto txs = chain.block_transaction_hashes(block_hash, ec);
+        if (ec)
+            return result;
+        tree = make_merkle_tree(txs);
+        cache.put(block_hash, tree);
+    }
+    // The block at this depth changed under us during a reorganize.
+    if (index.offset >= tree->size() || tree->leaf(index.offset) != tx_hash)
+    {
+        ec = bc::error::not_found;
+        return result;
+    }
+    result.branch = tree->branch(index.offset);
+    result.position = index.offset;
+    result.depth = index.depth;
+    result.root = tree->root();
+    return result;
+}
+
+#endif
+
@@ -1,6 +1,13 @@
 #include "node_impl.hpp"
 
 #include <future>
+#include <boost/lexical_cast.hpp>
+
+#include "echo.hpp"
+#include "mempool_file.hpp"
+#include "sync_blockchain.hpp"
+#include "sync_get_impl.hpp"
+#include "transaction_batch.hpp"
 
 using namespace bc;
 using std::placeholders::_1;
@@ -8,10 +15,31 @@ using std::placeholders::_2;
 using std::placeholders::_3;
 using std::placeholders::_4;
 
+// Set from log-level, and again on every reload.
+std::atomic<log_level> min_log_level{log_level::debug};
+
+bool apply_log_level(const std::string& name)
+{
+    if (name == "debug")
+        min_log_level = log_level::debug;
+    else if (name == "info")
+        min_log_level = log_level::info;
+    else if (name == "warning")
+        min_log_level = log_level::warning;
+    else if (name == "error")
+        min_log_level = log_level::error;
+    else
+    {
+        log_error() << "Unknown log-level: " << name;
+        return false;
+    }
+    return true;
+}
+
 void output_to_file(std::ofstream& file, log_level level,
     const std::string& domain, const std::string& body)
 {
-    if (body.empty())
+    if (body.empty() || level < min_log_level)
         return;
     file << level_repr(level);
     if (!domain.empty())
@@ -21,7 +49,7 @@ void output_to_file(std::ofstream& file, log_level level,
 void output_cerr_and_file(std::ofstream& file, log_level level,
     const std::string& domain, const std::string& body)
 {
-    if (body.empty())
+    if (body.empty() || level < min_log_level)
         return;
     std::ostringstream output;
     output << level_repr(level);
@@ -34,6 +62,7 @@ void output_cerr_and_file(std::ofstream& file, log_level level,
 
 node_impl::node_impl()
   : network_pool_(1), disk_pool_(6), mem_pool_(1), publish_pool_(2),
+    index_pool_(1),
     hosts_(network_pool_),
     handshake_(network_pool_),
     network_(network_pool_),
@@ -48,6 +77,111 @@ node_impl::node_impl()
 
 bool node_impl::start(config_map_type& config)
 {
+    if (!start_blockchain(config))
+        return false;
+    echo() << "Loading block headers...";
+    std::error_code ec;
+    if (!timestamps_.build(sync_blockchain(chain_), ec))
+    {
+        log_error() << "Couldn't load block headers: " << ec.message();
+        return false;
+    }
+    sync_tip_age_ = std::chrono::seconds(
+        boost::lexical_cast<size_t>(config["sync-tip-age"]));
+    sync_blockchain sync_chain(chain_);
+    const size_t last_depth = sync_chain.last_depth(ec);
+    block_type last_header;
+    if (!ec)
+        last_header = sync_chain.block_header(last_depth, ec);
+    if (ec)
+    {
+        log_error() << "Couldn't fetch last block: " << ec.message();
+        return false;
+    }
+    syncing_ = !tip_is_recent(last_header);
+    if (syncing_)
+    {
+        echo() << "Blockchain is behind, starting in sync mode.";
+        // Threads can't be taken back out, so bulk ingest leaves the
+        // pool bigger for the rest of the run.
+        const size_t extra_threads =
+            boost::lexical_cast<size_t>(config["sync-disk-threads"]);
+        for (size_t i = 0; i < extra_threads; ++i)
+            disk_pool_.spawn();
+        sync_report_time_ = std::chrono::steady_clock::now();
+    }
+    else
+    {
+        echo() << "Loading recent blocks...";
+        if (!history_->build(sync_chain, ec))
+        {
+            log_error() << "Couldn't load recent blocks: " << ec.message();
+            return false;
+        }
+    }
+    // Blocks since the script index was last flushed are indexed again
+    // before any reorganization reaches it on the same thread.
+    if (!scripts_->open(sync_chain))
+        return false;
+    auto catch_up_scripts =
+        [this]()
+        {
+            std::error_code ec;
+            if (!scripts_->catch_up(sync_blockchain(chain_), ec))
+                log_error() << "Couldn't update script index: "
+                    << ec.message();
+        };
+    index_pool_.service().post(catch_up_scripts);
+    // Subscribe before the session starts so the in-memory indexes
+    // don't miss blocks downloaded in between.
+    if (!publish_.start(config))
+        return false;
+    chain_.subscribe_reorganize(
+        std::bind(&node_impl::reorganize,
+            this, _1, _2, _3, _4));
+    protocol_.subscribe_channel(
+        std::bind(&node_impl::monitor_tx, this, _1, _2));
+    // Transaction pool
+    txpool_.start();
+    mempool_file_ = config["mempool-file"];
+    mempool_save_interval_ = std::chrono::seconds(
+        boost::lexical_cast<size_t>(config["mempool-save-interval"]));
+    // Saved transactions go in before peers can relay theirs. They can't
+    // validate against a stale chain, so when syncing they wait for the
+    // switch to serving mode.
+    if (!syncing_)
+        restore_mempool();
+    // Start session
+    std::promise<std::error_code> ec_session;
+    auto session_started =
+        [&](const std::error_code& ec)
+        {
+            ec_session.set_value(ec);
+        };
+    session_.start(session_started);
+    // Query the error_code and wait for startup completion.
+    ec = ec_session.get_future().get();
+    if (ec)
+    {
+        log_error() << "Unable to start session: " << ec.message();
+        return false;
+    }
+    session_started_ = true;
+    if (!mempool_file_.empty() && mempool_save_interval_.count() > 0)
+        mempool_saver_ = std::thread(&node_impl::run_mempool_saver, this);
+    return true;
+}
+
+bool node_impl::start_blockchain(config_map_type& config)
+{
+    merkle_.reset(new merkle_cache(
+        boost::lexical_cast<size_t>(config["merkle-cache-size"])));
+    history_.reset(new recent_history(chain_,
+        boost::lexical_cast<size_t>(config["history-window"])));
+    mempool_.reset(new mempool_stats(chain_, txpool_,
+        boost::lexical_cast<size_t>(config["mempool-value-cache-size"])));
+    scripts_.reset(new script_index(config["script-index-file"],
+        boost::lexical_cast<size_t>(config["script-index-flush-blocks"])));
     outfile_.open(config["output-file"]);
     errfile_.open(config["error-file"].c_str());
     log_debug().set_output_function(
@@ -60,8 +194,10 @@ bool node_impl::start(config_map_type& config)
         std::bind(output_cerr_and_file, std::ref(errfile_), _1, _2, _3));
     log_fatal().set_output_function(
         std::bind(output_cerr_and_file, std::ref(errfile_), _1, _2, _3));
-    protocol_.subscribe_channel(
-        std::bind(&node_impl::monitor_tx, this, _1, _2));
+    if (!apply_log_level(config["log-level"]))
+        return false;
+    if (!stats_.open(config["block-stats-file"]))
+        return false;
     // Start blockchain.
     std::promise<std::error_code> ec_chain;
     auto blockchain_started =
@@ -77,28 +213,6 @@ bool node_impl::start(config_map_type& config)
         log_error() << "Couldn't start blockchain: " << ec.message();
         return false;
     }
-    // Transaction pool
-    txpool_.start();
-    // Start session
-    std::promise<std::error_code> ec_session;
-    auto session_started =
-        [&](const std::error_code& ec)
-        {
-            ec_session.set_value(ec);
-        };
-    session_.start(session_started);
-    // Query the error_code and wait for startup completion.
-    ec = ec_session.get_future().get();
-    if (ec)
-    {
-        log_error() << "Unable to start session: " << ec.message();
-        return false;
-    }
-    // Ready to begin publishing new blocks and txs.
-    publish_.start(config);
-    chain_.subscribe_reorganize(
-        std::bind(&node_impl::reorganize,
-            this, _1, _2, _3, _4));
     return true;
 }
 
@@ -109,19 +223,44 @@ void session_stop(const std::error_code& ec)
 }
 bool node_impl::stop()
 {
-    session_.stop(session_stop);
+    if (mempool_saver_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(saver_mutex_);
+            saver_stopped_ = true;
+        }
+        saver_wakeup_.notify_one();
+        mempool_saver_.join();
+    }
+    if (session_started_)
+    {
+        // Saved while the pool's threads are still running.
+        persist_mempool();
+        session_.stop(session_stop);
+    }
     network_pool_.stop();
     disk_pool_.stop();
     mem_pool_.stop();
     publish_pool_.stop();
+    index_pool_.stop();
     network_pool_.join();
     disk_pool_.join();
     mem_pool_.join();
     publish_pool_.join();
+    index_pool_.join();
     chain_.stop();
     return true;
 }
 
+void node_impl::reload(config_map_type& config)
+{
+    apply_log_level(config["log-level"]);
+    merkle_->set_capacity(
+        boost::lexical_cast<size_t>(config["merkle-cache-size"]));
+    mempool_->set_value_cache_size(
+        boost::lexical_cast<size_t>(config["mempool-value-cache-size"]));
+}
+
 blockchain& node_impl::blockchain()
 {
     return chain_;
@@ -134,14 +273,92 @@ protocol& node_impl::protocol()
 {
     return protocol_;
 }
+merkle_cache& node_impl::merkle_trees()
+{
+    return *merkle_;
+}
+timestamp_index& node_impl::timestamps()
+{
+    return timestamps_;
+}
+block_stats_table& node_impl::block_stats()
+{
+    return stats_;
+}
+script_index& node_impl::scripts()
+{
+    return *scripts_;
+}
+recent_history& node_impl::history_window()
+{
+    return *history_;
+}
+mempool_stats& node_impl::mempool()
+{
+    return *mempool_;
+}
+
+void cache_merkle_tree(merkle_cache& cache, const block_type& blk)
+{
+    cache.put(hash_block_header(blk), make_merkle_tree(blk.transactions));
+}
+
+void update_block_stats(blockchain& chain, block_stats_table& stats,
+    size_t fork_point, const blockchain::block_list& new_blocks)
+{
+    // Rows for replaced blocks are dropped before the new ones land.
+    stats.truncate(fork_point + 1);
+    sync_blockchain sync_chain(chain);
+    for (size_t i = 0; i < new_blocks.size(); ++i)
+    {
+        size_t depth = fork_point + i + 1;
+        std::error_code ec;
+        block_stats_type row =
+            compute_block_stats(sync_chain, *new_blocks[i], ec);
+        if (ec)
+        {
+            log_warning() << "Couldn't compute stats for block "
+                << depth << ": " << ec.message();
+            return;
+        }
+        stats.write(depth, row);
+    }
+}
 
 void node_impl::reorganize(const std::error_code& ec,
     size_t fork_point,
     const bc::blockchain::block_list& new_blocks,
     const bc::blockchain::block_list& replaced_blocks)
 {
-    // Don't bother publishing blocks when in the initial blockchain download.
-    if (fork_point > 235866)
+    timestamps_.reorganize(fork_point, new_blocks);
+    // Computing fees looks up every input, which can't keep up with bulk
+    // sync. Rows for replaced blocks are still dropped so the backfill
+    // in switch_to_serving() recomputes them.
+    if (syncing_)
+        index_pool_.service().post(
+            std::bind(&block_stats_table::truncate, &stats_,
+                fork_point + 1));
+    else
+        index_pool_.service().post(
+            std::bind(update_block_stats, std::ref(chain_),
+                std::ref(stats_), fork_point, new_blocks));
+    index_pool_.service().post(
+        std::bind(&script_index::reorganize, scripts_.get(),
+            fork_point, new_blocks));
+    if (syncing_)
+    {
+        // Nobody wants these blocks published or cached yet.
+        report_sync_progress(fork_point, new_blocks);
+        if (!new_blocks.empty() && tip_is_recent(*new_blocks.back()))
+            switch_to_serving();
+    }
+    else
+    {
+        // Same thread as the build in switch_to_serving(), so the
+        // window never sees blocks out of order.
+        index_pool_.service().post(
+            std::bind(&recent_history::reorganize, history_.get(),
+                fork_point, new_blocks));
         for (size_t i = 0; i < new_blocks.size(); ++i)
         {
             size_t depth = fork_point + i + 1;
@@ -149,6 +366,11 @@ void node_impl::reorganize(const std::error_code& ec,
             publish_pool_.service().post(
                 std::bind(&publisher::send_blk, &publish_, depth, blk));
         }
+        // Proofs are usually wanted for the newest blocks.
+        for (const auto& blk: new_blocks)
+            publish_pool_.service().post(
+                std::bind(cache_merkle_tree, std::ref(*merkle_), *blk));
+    }
     chain_.subscribe_reorganize(
         std::bind(&node_impl::reorganize,
             this, _1, _2, _3, _4));
@@ -161,12 +383,112 @@ void node_impl::monitor_tx(const std::error_code& ec, channel_ptr node)
         log_warning() << "Couldn't start connection: " << ec.message();
         return;
     }
-    node->subscribe_transaction(
-        std::bind(&node_impl::recv_transaction, this, _1, _2, node));
+    node->subscribe_stop(
+        std::bind(&node_impl::remove_channel, this, _1, node));
+    {
+        // Checked under the lock so switch_to_serving() subscribes every
+        // channel exactly once.
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        channels_.push_back(node);
+        if (!syncing_)
+            node->subscribe_transaction(
+                std::bind(&node_impl::recv_transaction, this, _1, _2, node));
+    }
     protocol_.subscribe_channel(
         std::bind(&node_impl::monitor_tx, this, _1, _2));
 }
 
+bool node_impl::syncing() const
+{
+    return syncing_;
+}
+
+bool node_impl::tip_is_recent(const block_type& header) const
+{
+    const int64_t age = time(nullptr) - int64_t(header.timestamp);
+    return age < sync_tip_age_.count();
+}
+
+void node_impl::report_sync_progress(size_t fork_point,
+    const blockchain::block_list& new_blocks)
+{
+    for (const auto& blk: new_blocks)
+    {
+        ++sync_report_blocks_;
+        sync_report_bytes_ += satoshi_raw_size(*blk);
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds =
+        std::chrono::duration<double>(now - sync_report_time_).count();
+    if (seconds < 10)
+        return;
+    echo() << "Syncing at depth " << fork_point + new_blocks.size() << ": "
+        << size_t(sync_report_blocks_ / seconds) << " blocks/s, "
+        << sync_report_bytes_ / seconds / 1000000 << " MB/s";
+    sync_report_time_ = now;
+    sync_report_blocks_ = 0;
+    sync_report_bytes_ = 0;
+}
+
+void node_impl::switch_to_serving()
+{
+    echo() << "Caught up with the network, switching to serving mode.";
+    std::vector<channel_ptr> channels;
+    {
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        syncing_ = false;
+        channels = channels_;
+    }
+    for (channel_ptr node: channels)
+        node->subscribe_transaction(
+            std::bind(&node_impl::recv_transaction, this, _1, _2, node));
+    // Loading blocks, backfilling stats skipped while syncing and
+    // revalidating the saved pool block on the chain, so they can't run
+    // on the chain's own threads.
+    auto load_caches =
+        [this]()
+        {
+            std::error_code ec;
+            if (!history_->build(sync_blockchain(chain_), ec))
+                log_error() << "Couldn't load recent blocks: "
+                    << ec.message();
+            restore_mempool();
+            backfill_stats_from(0);
+        };
+    index_pool_.service().post(load_caches);
+}
+
+void node_impl::backfill_stats_from(size_t depth)
+{
+    // A day's worth of blocks keeps each step short next to a reorganize.
+    constexpr size_t backfill_chunk = 144;
+    sync_blockchain chain(chain_);
+    std::error_code ec;
+    const size_t last_depth = chain.last_depth(ec);
+    if (ec)
+    {
+        log_error() << "Couldn't fetch last depth: " << ec.message();
+        return;
+    }
+    if (depth > last_depth)
+    {
+        echo() << "Block stats backfilled up to depth " << last_depth;
+        return;
+    }
+    const size_t end_depth = std::min(depth + backfill_chunk, last_depth + 1);
+    if (!backfill_block_stats(chain, stats_, depth, end_depth))
+        return;
+    index_pool_.service().post(
+        std::bind(&node_impl::backfill_stats_from, this, end_depth));
+}
+
+void node_impl::remove_channel(const std::error_code& ec, channel_ptr node)
+{
+    std::lock_guard<std::mutex> lock(channels_mutex_);
+    channels_.erase(std::remove(channels_.begin(), channels_.end(), node),
+        channels_.end());
+}
+
 void node_impl::recv_transaction(const std::error_code& ec,
     const transaction_type& tx, channel_ptr node)
 {
@@ -175,12 +497,9 @@ void node_impl::recv_transaction(const std::error_code& ec,
         log_error() << "recv_transaction: " << ec.message();
         return;
     }
-    auto handle_confirm = [](const std::error_code& ec)
-        {
-            if (ec)
-                log_warning() << "Confirm error: " << ec.message();
-        };
-    txpool_.store(tx, handle_confirm,
+    txpool_.store(tx,
+        std::bind(&node_impl::handle_mempool_confirm,
+            this, _1, hash_transaction(tx)),
         std::bind(&node_impl::handle_mempool_store, this, _1, _2, tx, node));
     node->subscribe_transaction(
         std::bind(&node_impl::recv_transaction, this, _1, _2, node));
@@ -190,8 +509,154 @@ void node_impl::handle_mempool_store(
     const std::error_code& ec, const index_list& unconfirmed,
     const transaction_type& tx, channel_ptr node)
 {
+    if (ec)
+        return;
     log_info() << "Accepted transaction: " << hash_transaction(tx);
     publish_pool_.service().post(
         std::bind(&publisher::send_tx, &publish_, tx));
+    // Input lookups block, so they can't run on the pool's own thread.
+    index_pool_.service().post(
+        std::bind(&mempool_stats::add, mempool_.get(), tx));
+}
+
+void node_impl::handle_mempool_confirm(
+    const std::error_code& ec, const hash_digest& tx_hash)
+{
+    // Called once the transaction leaves the pool, whether confirmed
+    // or evicted.
+    if (ec)
+        log_debug() << "Transaction " << tx_hash
+            << " left the pool: " << ec.message();
+    index_pool_.service().post(
+        std::bind(&mempool_stats::remove, mempool_.get(), tx_hash));
+}
+
+void node_impl::store_transaction(const transaction_type& tx,
+    transaction_pool::store_handler handle_store)
+{
+    auto handle_stored =
+        [this, tx, handle_store](
+            const std::error_code& ec, const index_list& unconfirmed)
+        {
+            handle_mempool_store(ec, unconfirmed, tx, channel_ptr());
+            handle_store(ec, unconfirmed);
+        };
+    txpool_.store(tx,
+        std::bind(&node_impl::handle_mempool_confirm,
+            this, _1, hash_transaction(tx)),
+        handle_stored);
+}
+
+void node_impl::broadcast_transactions(const std::vector<transaction_type>& txs)
+{
+    if (txs.empty())
+        return;
+    std::vector<channel_ptr> channels;
+    {
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        channels = channels_;
+    }
+    auto handle_send = [](const std::error_code& ec)
+        {
+            if (ec)
+                log_warning() << "Broadcast error: " << ec.message();
+        };
+    for (channel_ptr node: channels)
+        for (const transaction_type& tx: txs)
+            node->send(tx, handle_send);
+    log_info() << "Broadcast " << txs.size() << " transactions to "
+        << channels.size() << " peers";
+}
+
+std::vector<transaction_type> node_impl::store_transactions(
+    const std::vector<transaction_type>& txs,
+    std::vector<std::error_code>& errors)
+{
+    errors.assign(txs.size(), std::error_code());
+    std::vector<size_t> pending(txs.size());
+    for (size_t i = 0; i < txs.size(); ++i)
+        pending[i] = i;
+    auto store =
+        [this, &txs](size_t i, transaction_pool::store_handler handle)
+        {
+            store_transaction(txs[i], handle);
+        };
+    std::vector<transaction_type> accepted;
+    while (!pending.empty())
+    {
+        auto stored = sync_fetch_all<index_list>(store, pending);
+        const size_t accepted_before = accepted.size();
+        std::vector<size_t> retry;
+        for (size_t j = 0; j < pending.size(); ++j)
+        {
+            const size_t i = pending[j];
+            errors[i] = stored.errors[j];
+            if (!errors[i])
+                accepted.push_back(txs[i]);
+            else if (errors[i] == error::input_not_found)
+                retry.push_back(i);
+        }
+        if (accepted.size() == accepted_before)
+            break;
+        pending.swap(retry);
+    }
+    return accepted;
+}
+
+void node_impl::restore_mempool()
+{
+    if (mempool_file_.empty())
+        return;
+    std::vector<std::string> txs_data;
+    if (!load_mempool(mempool_file_, txs_data) || txs_data.empty())
+        return;
+    echo() << "Reloading " << txs_data.size() << " pool transactions...";
+    std::vector<transaction_type> txs;
+    std::vector<uint8_t> parsed;
+    parse_transactions(txs_data, txs, parsed);
+    std::vector<transaction_type> valid_txs;
+    for (size_t i = 0; i < txs.size(); ++i)
+        if (parsed[i])
+            valid_txs.push_back(std::move(txs[i]));
+    std::vector<std::error_code> errors;
+    const size_t accepted = store_transactions(valid_txs, errors).size();
+    log_info() << "Reloaded " << accepted << " of " << txs_data.size()
+        << " saved pool transactions";
+}
+
+bool node_impl::persist_mempool()
+{
+    // The pool stays empty while syncing; keep the last saved one.
+    if (mempool_file_.empty() || syncing_)
+        return true;
+    const std::vector<hash_digest> hashes = mempool_->hashes();
+    auto fetch =
+        [this](const hash_digest& tx_hash,
+            transaction_pool::fetch_handler handle)
+        {
+            txpool_.fetch(tx_hash, handle);
+        };
+    auto fetched = sync_fetch_all<transaction_type>(fetch, hashes);
+    // Some may have left the pool since the hashes were read.
+    std::vector<transaction_type> txs;
+    for (size_t i = 0; i < hashes.size(); ++i)
+        if (!fetched.errors[i])
+            txs.push_back(std::move(fetched.results[i]));
+    if (!save_mempool(mempool_file_, txs))
+        return false;
+    log_info() << "Saved " << txs.size() << " pool transactions";
+    return true;
+}
+
+void node_impl::run_mempool_saver()
+{
+    std::unique_lock<std::mutex> lock(saver_mutex_);
+    while (!saver_wakeup_.wait_for(lock, mempool_save_interval_,
+        [this] { return saver_stopped_; }))
+    {
+        lock.unlock();
+        persist_mempool();
+        lock.lock();
+    }
 }
 
@@ -1,37 +1,96 @@
 #ifndef QUERY_NODE_IMPL_HPP
 #define QUERY_NODE_IMPL_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <bitcoin/bitcoin.hpp>
 
+#include "block_stats.hpp"
 #include "config.hpp"
+#include "mempool_stats.hpp"
+#include "merkle_tree.hpp"
 #include "publisher.hpp"
+#include "recent_history.hpp"
+#include "script_index.hpp"
+#include "timestamp_index.hpp"
 
 class node_impl
 {
 public:
     node_impl();
     bool start(config_map_type& config);
+    // Opens the logs and blockchain only, without networking.
+    // Used by the offline tools.
+    bool start_blockchain(config_map_type& config);
     bool stop();
+    // Applies reloadable settings: log level and cache sizes.
+    void reload(config_map_type& config);
 
     bc::blockchain& blockchain();
     bc::transaction_pool& transaction_pool();
     bc::protocol& protocol();
+    merkle_cache& merkle_trees();
+    timestamp_index& timestamps();
+    block_stats_table& block_stats();
+    script_index& scripts();
+    recent_history& history_window();
+    mempool_stats& mempool();
+    // True while the chain catches up with the network. Publishing,
+    // caches and the transaction pool stay off until the tip is recent.
+    bool syncing() const;
+
+    // Validates tx against the pool. Accepted transactions are published
+    // like those received from peers, but aren't relayed.
+    void store_transaction(const bc::transaction_type& tx,
+        bc::transaction_pool::store_handler handle_store);
+    // Stores every transaction at once. A child can be validated before
+    // its parent from the same batch reaches the pool, so transactions
+    // with missing inputs get another pass for as long as the previous
+    // pass accepted something. errors lines up with txs, and the accepted
+    // transactions are returned in the order they got in.
+    std::vector<bc::transaction_type> store_transactions(
+        const std::vector<bc::transaction_type>& txs,
+        std::vector<std::error_code>& errors);
+    // Sends every transaction to each connected peer in a single pass
+    // over the channels.
+    void broadcast_transactions(const std::vector<bc::transaction_type>& txs);
 
 private:
+    bool tip_is_recent(const bc::block_type& header) const;
+    void report_sync_progress(size_t fork_point,
+        const bc::blockchain::block_list& new_blocks);
+    void switch_to_serving();
+    // Backfills stats a chunk at a time from depth, reposting itself so
+    // reorganizations queued on the index pool run in between.
+    void backfill_stats_from(size_t depth);
+
+    // Reloads the saved pool, revalidating against the current chain.
+    void restore_mempool();
+    bool persist_mempool();
+    void run_mempool_saver();
+
     void reorganize(const std::error_code& ec,
         size_t fork_point,
         const bc::blockchain::block_list& new_blocks,
         const bc::blockchain::block_list& replaced_blocks);
 
     void monitor_tx(const std::error_code& ec, bc::channel_ptr node);
+    void remove_channel(const std::error_code& ec, bc::channel_ptr node);
     void recv_transaction(const std::error_code& ec,
         const bc::transaction_type& tx, bc::channel_ptr node);
+    void handle_mempool_confirm(
+        const std::error_code& ec, const bc::hash_digest& tx_hash);
     void handle_mempool_store(
         const std::error_code& ec, const bc::index_list& unconfirmed,
         const bc::transaction_type& tx, bc::channel_ptr node);
 
     std::ofstream outfile_, errfile_;
     bc::threadpool network_pool_, disk_pool_, mem_pool_, publish_pool_;
+    // Single thread so derived index updates apply in reorganize order.
+    bc::threadpool index_pool_;
     // Services
     bc::hosts hosts_;
     bc::handshake handshake_;
@@ -41,8 +100,33 @@ private:
     bc::poller poller_;
     bc::transaction_pool txpool_;
     bc::session session_;
+    bool session_started_ = false;
+    // Connected peers, for broadcast_transactions.
+    std::mutex channels_mutex_;
+    std::vector<bc::channel_ptr> channels_;
     // Publisher
     publisher publish_;
+    // Trees for recent blocks are built as they arrive.
+    std::unique_ptr<merkle_cache> merkle_;
+    timestamp_index timestamps_;
+    block_stats_table stats_;
+    std::unique_ptr<script_index> scripts_;
+    std::unique_ptr<recent_history> history_;
+    std::unique_ptr<mempool_stats> mempool_;
+    // Sync mode
+    std::atomic<bool> syncing_{false};
+    std::chrono::seconds sync_tip_age_{0};
+    // Sync rate since the last report.
+    std::chrono::steady_clock::time_point sync_report_time_;
+    size_t sync_report_blocks_ = 0;
+    uint64_t sync_report_bytes_ = 0;
+    // Pool persistence
+    std::string mempool_file_;
+    std::chrono::seconds mempool_save_interval_{0};
+    std::thread mempool_saver_;
+    std::mutex saver_mutex_;
+    std::condition_variable saver_wakeup_;
+    bool saver_stopped_ = false;
 };
 
 #endif
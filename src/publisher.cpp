@@ -1,18 +1,56 @@
 #include "publisher.hpp"
 
+#include <zlib.h>
+
+#include "snapshot_format.hpp"
+
 #define LOG_PUBLISHER "publisher"
 
+constexpr uint8_t codec_none = 0;
+constexpr uint8_t codec_zlib = 1;
+constexpr size_t codec_header_size = 1 + 4;
+
 publisher::publisher()
   : context_(1),
-    socket_block_(context_, ZMQ_PUB), socket_tx_(context_, ZMQ_PUB)
+    socket_block_(context_, ZMQ_PUB), socket_tx_(context_, ZMQ_PUB),
+    socket_compact_(context_, ZMQ_PUB)
+{
+}
+
+bool parse_compression(config_map_type& config,
+    const std::string& key, bool& compress)
 {
+    const std::string& name = config[key];
+    if (name != "none" && name != "zlib")
+    {
+        bc::log_error(LOG_PUBLISHER) << "Unknown " << key << ": " << name;
+        return false;
+    }
+    compress = name == "zlib";
+    return true;
 }
 
-void publisher::start(config_map_type& config)
+bool publisher::start(config_map_type& config)
 {
+    if (!parse_compression(config, "block-publish-compression",
+            compress_block_) ||
+        !parse_compression(config, "tx-publish-compression", compress_tx_))
+        return false;
     std::string bind_addr = "tcp://*:";
     socket_block_.bind((bind_addr + config["block-publish-port"]).c_str());
     socket_tx_.bind((bind_addr + config["tx-publish-port"]).c_str());
+    socket_compact_.bind(
+        (bind_addr + config["compact-block-publish-port"]).c_str());
+    // ZMQ sockets can bind several endpoints, so ipc:// subscribers on
+    // the same host are served by the same socket.
+    if (!config["block-publish-endpoint"].empty())
+        socket_block_.bind(config["block-publish-endpoint"].c_str());
+    if (!config["tx-publish-endpoint"].empty())
+        socket_tx_.bind(config["tx-publish-endpoint"].c_str());
+    if (!config["compact-block-publish-endpoint"].empty())
+        socket_compact_.bind(
+            config["compact-block-publish-endpoint"].c_str());
+    return true;
 }
 
 bool send_raw(const bc::data_chunk& raw,
@@ -23,18 +61,83 @@ bool send_raw(const bc::data_chunk& raw,
     return socket.send(message, send_more ? ZMQ_SNDMORE : 0);
 }
 
+// Uncompressed messages are serialised straight into the frame.
+// Incompressible messages on a compressed socket go out with codec 0.
+template <typename Message>
+void make_frame(const Message& message, bool compress,
+    zmq::message_t& frame)
+{
+    const size_t raw_size = bc::satoshi_raw_size(message);
+    if (!compress)
+    {
+        frame.rebuild(raw_size);
+        bc::satoshi_save(message, static_cast<uint8_t*>(frame.data()));
+        return;
+    }
+    bc::data_chunk raw(raw_size);
+    bc::satoshi_save(message, raw.begin());
+    uLongf compressed_size = compressBound(raw_size);
+    bc::data_chunk data(codec_header_size + compressed_size);
+    int result = compress2(data.data() + codec_header_size,
+        &compressed_size, raw.data(), raw_size, Z_BEST_SPEED);
+    data[0] = codec_zlib;
+    if (result != Z_OK || compressed_size >= raw_size)
+    {
+        data[0] = codec_none;
+        compressed_size = raw_size;
+        std::copy(raw.begin(), raw.end(), data.begin() + codec_header_size);
+    }
+    data[1] = raw_size >> 24;
+    data[2] = raw_size >> 16;
+    data[3] = raw_size >> 8;
+    data[4] = raw_size;
+    frame.rebuild(codec_header_size + compressed_size);
+    memcpy(frame.data(), data.data(), frame.size());
+}
+
+// Header and tx hash frames of a compact block.
+void make_compact(const bc::block_type& blk,
+    zmq::message_t& header, zmq::message_t& tx_hashes)
+{
+    header.rebuild(snapshot_header_size);
+    snapshot_save_header(blk, static_cast<uint8_t*>(header.data()));
+    tx_hashes.rebuild(blk.transactions.size() * bc::hash_digest_size);
+    uint8_t* position = static_cast<uint8_t*>(tx_hashes.data());
+    for (const bc::transaction_type& tx: blk.transactions)
+    {
+        const bc::hash_digest tx_hash = bc::hash_transaction(tx);
+        position = std::copy(tx_hash.begin(), tx_hash.end(), position);
+    }
+}
+
 bool publisher::send_blk(uint32_t depth, const bc::block_type& blk)
 {
     bc::data_chunk raw_depth = bc::uncast_type(depth);
     BITCOIN_ASSERT(raw_depth.size() == 4);
-    bool success = send_raw(raw_depth, socket_block_, true);
-    if (!success)
-        bc::log_warning(LOG_PUBLISHER) << "Problem publishing block depth.";
-    bc::data_chunk raw_block(bc::satoshi_raw_size(blk));
-    bc::satoshi_save(blk, raw_block.begin());
-    if (!send_raw(raw_block, socket_block_))
+    // Frames are built before taking the socket locks so compression and
+    // hashing on the publish threads still overlap.
+    zmq::message_t data, header, tx_hashes;
+    make_frame(blk, compress_block_, data);
+    make_compact(blk, header, tx_hashes);
     {
-        bc::log_warning(LOG_PUBLISHER) << "Problem publishing block data.";
+        std::lock_guard<std::mutex> lock(block_mutex_);
+        bool success = send_raw(raw_depth, socket_block_, true);
+        if (!success)
+            bc::log_warning(LOG_PUBLISHER)
+                << "Problem publishing block depth.";
+        if (!socket_block_.send(data))
+        {
+            bc::log_warning(LOG_PUBLISHER)
+                << "Problem publishing block data.";
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(compact_mutex_);
+    if (!send_raw(raw_depth, socket_compact_, true) ||
+        !socket_compact_.send(header, ZMQ_SNDMORE) ||
+        !socket_compact_.send(tx_hashes))
+    {
+        bc::log_warning(LOG_PUBLISHER) << "Problem publishing compact block.";
         return false;
     }
     return true;
@@ -42,9 +145,13 @@ bool publisher::send_blk(uint32_t depth, const bc::block_type& blk)
 
 bool publisher::send_tx(const bc::transaction_type& tx)
 {
-    bc::data_chunk raw_tx(bc::satoshi_raw_size(tx));
-    bc::satoshi_save(tx, raw_tx.begin());
-    if (!send_raw(raw_tx, socket_tx_))
+    zmq::message_t data;
+    make_frame(tx, compress_tx_, data);
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    if (!socket_tx_.send(data))
+    {
         bc::log_warning(LOG_PUBLISHER) << "Problem publishing tx data.";
+        return false;
+    }
+    return true;
 }
-
@@ -1,22 +1,37 @@
 #ifndef QUERY_PUBLISHER_HPP
 #define QUERY_PUBLISHER_HPP
 
+#include <mutex>
 #include <zmq.hpp>
 #include <bitcoin/bitcoin.hpp>
 
 #include "config.hpp"
 
+// Publishes on three sockets:
+//   block    [4 bytes depth] [block]
+//   tx       [tx]
+//   compact  [4 bytes depth] [80 byte header] [32 byte tx hashes...]
+// Depth is little endian and tx hashes are in the same byte order as
+// the Thrift interface. With block-publish-compression or
+// tx-publish-compression set to zlib, the block and tx frames on that
+// socket become [1 byte codec] [4 bytes raw size] [payload], with the
+// same codecs and big endian size as compressed_transport.
+// ZMQ sockets aren't thread safe, so each one has its own mutex and
+// the send methods can be called from any thread.
 class publisher
 {
 public:
     publisher();
-    void start(config_map_type& config);
+    // Returns false for an unknown compression setting.
+    bool start(config_map_type& config);
     bool send_blk(uint32_t depth, const bc::block_type& blk);
     bool send_tx(const bc::transaction_type& tx);
 
 private:
     zmq::context_t context_;
-    zmq::socket_t socket_block_, socket_tx_;
+    zmq::socket_t socket_block_, socket_tx_, socket_compact_;
+    std::mutex block_mutex_, tx_mutex_, compact_mutex_;
+    bool compress_block_ = false, compress_tx_ = false;
 };
 
 #endif
@@ -0,0 +1,278 @@
+#include "recent_history.hpp"
+
+#include <set>
+
+#include "sync_get_impl.hpp"
+
+using namespace bc;
+
+const input_point null_inpoint{
+    null_hash, std::numeric_limits<uint32_t>::max()};
+
+recent_history::recent_history(blockchain& chain, size_t window_size)
+  : chain_(chain), window_size_(window_size)
+{
+}
+
+bool recent_history::build(const sync_blockchain& chain, std::error_code& ec)
+{
+    const size_t last_depth = chain.last_depth(ec);
+    if (ec)
+        return false;
+    const size_t first_depth =
+        last_depth + 1 > window_size_ ? last_depth + 1 - window_size_ : 0;
+    std::vector<block_entry> entries;
+    for (size_t depth = first_depth; depth <= last_depth; ++depth)
+    {
+        const block_type blk = chain.block(depth, ec);
+        if (ec)
+            return false;
+        entries.push_back(make_entry(blk, depth));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks_.clear();
+    for (block_entry& entry: entries)
+        append(std::move(entry));
+    return true;
+}
+
+void recent_history::reorganize(size_t fork_point,
+    const blockchain::block_list& new_blocks)
+{
+    std::vector<block_entry> entries;
+    for (size_t i = 0; i < new_blocks.size(); ++i)
+        entries.push_back(make_entry(*new_blocks[i], fork_point + i + 1));
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Blocks that arrived while build() ran are already in the window.
+    if (!blocks_.empty() && !new_blocks.empty() &&
+        blocks_.back().depth == fork_point + new_blocks.size() &&
+        blocks_.back().hash == hash_block_header(*new_blocks.back()))
+        return;
+    if (!blocks_.empty() && blocks_.back().depth > fork_point)
+    {
+        ++reorg_count_;
+        // Keep the replaced blocks' rows so callers still on the old
+        // branch can be told what to drop.
+        auto first_replaced = std::find_if(blocks_.begin(), blocks_.end(),
+            [fork_point](const block_entry& entry)
+            {
+                return entry.depth > fork_point;
+            });
+        for (auto it = first_replaced; it != blocks_.end(); ++it)
+        {
+            it->reorg_id = reorg_count_;
+            it->fork_point = fork_point;
+            replaced_.push_back(std::move(*it));
+        }
+        blocks_.erase(first_replaced, blocks_.end());
+        while (replaced_.size() > window_size_)
+            replaced_.pop_front();
+    }
+    // A gap would leave holes in the window, so start it afresh.
+    if (!blocks_.empty() && blocks_.back().depth != fork_point)
+        blocks_.clear();
+    for (block_entry& entry: entries)
+        append(std::move(entry));
+}
+
+void recent_history::since(const std::vector<payment_address>& addresses,
+    size_t from_depth, const hash_digest& known_tip,
+    history_delta_t& delta, bool& tip_known, bool& covered) const
+{
+    std::vector<std::string> keys;
+    for (const payment_address& address: addresses)
+        keys.push_back(address.encoded());
+    std::lock_guard<std::mutex> lock(mutex_);
+    delta.fork_depth = -1;
+    delta.tip_hash = blocks_.empty() ? null_hash : blocks_.back().hash;
+    delta.tip_depth = blocks_.empty() ? 0 : blocks_.back().depth;
+    // Callers without a known tip skip the reorganize check.
+    tip_known = known_tip == null_hash;
+    for (const block_entry& entry: blocks_)
+        if (entry.hash == known_tip)
+            tip_known = true;
+    for (auto it = replaced_.rbegin(); !tip_known && it != replaced_.rend();
+        ++it)
+    {
+        if (it->hash != known_tip)
+            continue;
+        tip_known = true;
+        delta.fork_depth = it->fork_point;
+        from_depth = std::min(from_depth, it->fork_point + 1);
+        // Blocks replaced by this or any later reorganization above the
+        // fork may have been on the caller's branch.
+        for (const block_entry& entry: replaced_)
+            if (entry.reorg_id >= it->reorg_id && entry.depth > it->fork_point)
+                collect(entry, keys, delta.invalidated);
+    }
+    covered = !blocks_.empty() && from_depth >= blocks_.front().depth;
+    if (!covered)
+        return;
+    for (const block_entry& entry: blocks_)
+        if (entry.depth >= from_depth)
+            collect(entry, keys, delta.rows);
+}
+
+recent_history::block_entry recent_history::make_entry(
+    const block_type& blk, size_t depth) const
+{
+    block_entry entry{hash_block_header(blk), depth, address_rows_map(), 0, 0};
+    // Only pay to pubkey hash inputs carry their address. Other spends
+    // are matched against the output they spend.
+    std::vector<history_row_t> unresolved;
+    for (const transaction_type& tx: blk.transactions)
+    {
+        const hash_digest tx_hash = hash_transaction(tx);
+        for (uint32_t i = 0; i < tx.outputs.size(); ++i)
+        {
+            payment_address address;
+            if (extract(address, tx.outputs[i].output_script))
+                entry.rows[address.encoded()].push_back(history_row_t{
+                    output_point{tx_hash, i}, null_inpoint, false, depth});
+        }
+        for (uint32_t i = 0; i < tx.inputs.size() && !is_coinbase(tx); ++i)
+        {
+            const history_row_t row{tx.inputs[i].previous_output,
+                input_point{tx_hash, i}, true, depth};
+            payment_address address;
+            if (extract(address, tx.inputs[i].input_script))
+                entry.rows[address.encoded()].push_back(row);
+            else
+                unresolved.push_back(row);
+        }
+    }
+    if (unresolved.empty())
+        return entry;
+    std::set<hash_digest> unique_hashes;
+    for (const history_row_t& row: unresolved)
+        unique_hashes.insert(row.outpoint.hash);
+    const std::vector<hash_digest> tx_hashes(
+        unique_hashes.begin(), unique_hashes.end());
+    auto txs = sync_fetch_all<transaction_type>(
+        std::bind(&blockchain::fetch_transaction, &chain_,
+            std::placeholders::_1, std::placeholders::_2),
+        tx_hashes);
+    for (const history_row_t& row: unresolved)
+    {
+        const size_t i = std::lower_bound(tx_hashes.begin(),
+            tx_hashes.end(), row.outpoint.hash) - tx_hashes.begin();
+        if (txs.errors[i])
+        {
+            log_warning() << "Couldn't fetch output spent by "
+                << row.inpoint.hash << ": " << txs.errors[i].message();
+            continue;
+        }
+        const transaction_output_list& outputs = txs.results[i].outputs;
+        payment_address address;
+        if (row.outpoint.index < outputs.size() &&
+            extract(address, outputs[row.outpoint.index].output_script))
+        {
+            entry.rows[address.encoded()].push_back(row);
+        }
+    }
+    return entry;
+}
+
+void recent_history::append(block_entry entry)
+{
+    blocks_.push_back(std::move(entry));
+    while (blocks_.size() > window_size_)
+        blocks_.pop_front();
+}
+
+void recent_history::collect(const block_entry& entry,
+    const std::vector<std::string>& keys, history_row_list& rows) const
+{
+    for (const std::string& key: keys)
+    {
+        auto it = entry.rows.find(key);
+        if (it != entry.rows.end())
+            rows.insert(rows.end(), it->second.begin(), it->second.end());
+    }
+}
+
+history_row_list fetch_history_since(blockchain& chain,
+    const std::vector<payment_address>& addresses, size_t from_depth,
+    std::error_code& ec)
+{
+    typedef std::function<void (const std::error_code&, const history_t&)>
+        history_handler;
+    auto fetch_address_history =
+        [&chain](const payment_address& address, history_handler handle)
+        {
+            fetch_history(chain, address,
+                [handle](const std::error_code& ec,
+                    const output_point_list& outpoints,
+                    const input_point_list& inpoints)
+                {
+                    handle(ec, history_t{outpoints, inpoints});
+                });
+        };
+    auto histories = sync_fetch_all<history_t>(
+        fetch_address_history, addresses);
+    // Every distinct transaction needs its depth.
+    std::set<hash_digest> unique_hashes;
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        if (histories.errors[i])
+        {
+            ec = histories.errors[i];
+            return history_row_list();
+        }
+        const history_t& history = histories.results[i];
+        for (const output_point& outpoint: history.outpoints)
+            unique_hashes.insert(outpoint.hash);
+        for (const input_point& inpoint: history.inpoints)
+            if (inpoint.hash != null_hash)
+                unique_hashes.insert(inpoint.hash);
+    }
+    typedef std::function<
+        void (const std::error_code&, const transaction_index_t&)>
+            index_handler;
+    auto fetch_index =
+        [&chain](const hash_digest& tx_hash, index_handler handle)
+        {
+            chain.fetch_transaction_index(tx_hash,
+                [handle](const std::error_code& ec,
+                    size_t depth, size_t offset)
+                {
+                    handle(ec, transaction_index_t{depth, offset});
+                });
+        };
+    const std::vector<hash_digest> tx_hashes(
+        unique_hashes.begin(), unique_hashes.end());
+    auto indexes = sync_fetch_all<transaction_index_t>(fetch_index, tx_hashes);
+    std::map<hash_digest, size_t> depths;
+    for (size_t i = 0; i < tx_hashes.size(); ++i)
+        if (!indexes.errors[i])
+            depths[tx_hashes[i]] = indexes.results[i].depth;
+    auto depth_of =
+        [&depths](const hash_digest& tx_hash, size_t& depth)
+        {
+            auto it = depths.find(tx_hash);
+            if (it == depths.end())
+                return false;
+            depth = it->second;
+            return true;
+        };
+    history_row_list rows;
+    for (const history_t& history: histories.results)
+        for (size_t i = 0; i < history.outpoints.size(); ++i)
+        {
+            const output_point& outpoint = history.outpoints[i];
+            size_t depth = 0;
+            if (depth_of(outpoint.hash, depth) && depth >= from_depth)
+                rows.push_back(
+                    history_row_t{outpoint, null_inpoint, false, depth});
+            if (i >= history.inpoints.size())
+                continue;
+            const input_point& inpoint = history.inpoints[i];
+            if (inpoint.hash != null_hash &&
+                depth_of(inpoint.hash, depth) && depth >= from_depth)
+            {
+                rows.push_back(history_row_t{outpoint, inpoint, true, depth});
+            }
+        }
+    return rows;
+}
+
@@ -0,0 +1,92 @@
+#ifndef QUERY_RECENT_HISTORY_HPP
+#define QUERY_RECENT_HISTORY_HPP
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+#include "sync_blockchain.hpp"
+
+struct history_row_t
+{
+    // Output received by the address, or the output being spent.
+    bc::output_point outpoint;
+    // Spending input for spends, otherwise unset.
+    bc::input_point inpoint;
+    bool is_spend;
+    size_t depth;
+};
+
+typedef std::vector<history_row_t> history_row_list;
+
+struct history_delta_t
+{
+    history_row_list rows, invalidated;
+    // Depth where the caller's tip forked off, or -1 if it's still in
+    // the main chain.
+    int64_t fork_depth;
+    bc::hash_digest tip_hash;
+    size_t tip_depth;
+};
+
+// Address rows for the last window_size blocks, plus rows of recently
+// replaced blocks, so wallet resyncs cost work proportional to recent
+// activity instead of total history.
+class recent_history
+{
+public:
+    // chain looks up spent outputs whose address the input doesn't show.
+    recent_history(bc::blockchain& chain, size_t window_size);
+
+    // Loads the last window_size blocks of the chain.
+    bool build(const sync_blockchain& chain, std::error_code& ec);
+    void reorganize(size_t fork_point,
+        const bc::blockchain::block_list& new_blocks);
+
+    // Fills delta from the window. tip_known is false when known_tip is
+    // neither in the window nor a recently replaced block. covered is
+    // false when from_depth is older than the window, in which case
+    // delta.rows is left empty for the caller to fetch.
+    void since(const std::vector<bc::payment_address>& addresses,
+        size_t from_depth, const bc::hash_digest& known_tip,
+        history_delta_t& delta, bool& tip_known, bool& covered) const;
+
+private:
+    typedef std::map<std::string, history_row_list> address_rows_map;
+    struct block_entry
+    {
+        bc::hash_digest hash;
+        size_t depth;
+        address_rows_map rows;
+        // Set once the block is replaced, to tell reorganizations apart.
+        size_t reorg_id;
+        size_t fork_point;
+    };
+
+    // Address rows are worked out before taking the lock, since spends
+    // may need their previous outputs fetched.
+    block_entry make_entry(const bc::block_type& blk, size_t depth) const;
+    void append(block_entry entry);
+    void collect(const block_entry& entry,
+        const std::vector<std::string>& keys, history_row_list& rows) const;
+
+    bc::blockchain& chain_;
+    const size_t window_size_;
+    mutable std::mutex mutex_;
+    // Main chain blocks in ascending depth.
+    std::deque<block_entry> blocks_;
+    // Replaced blocks, oldest reorganization first.
+    std::deque<block_entry> replaced_;
+    size_t reorg_count_ = 0;
+};
+
+// Slow path for a from_depth older than the window: every address's
+// history is fetched in parallel, then the depth of every row's
+// transaction, keeping rows at or above from_depth.
+history_row_list fetch_history_since(bc::blockchain& chain,
+    const std::vector<bc::payment_address>& addresses, size_t from_depth,
+    std::error_code& ec);
+
+#endif
+
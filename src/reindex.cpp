@@ -0,0 +1,276 @@
+#include "reindex.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <thread>
+#include <sys/stat.h>
+
+#include "echo.hpp"
+
+#define LOG_REINDEX "reindex"
+
+using namespace bc;
+
+// Written once so a resumed reindex covers the same depths and
+// partitions even though the chain has grown since, and only resumes
+// runs of the same target.
+struct reindex_manifest
+{
+    uint64_t last_depth, partition_size, record_size;
+    char target_name[16];
+};
+
+bool file_exists(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+std::string run_path(const std::string& work_dir, size_t partition)
+{
+    return work_dir + "/run-" + std::to_string(partition);
+}
+
+bool read_manifest(const std::string& path, reindex_manifest& manifest)
+{
+    std::ifstream file(path, std::ios::binary);
+    file.read(reinterpret_cast<char*>(&manifest), sizeof(manifest));
+    return file.good();
+}
+
+bool write_manifest(const std::string& path, const reindex_manifest& manifest)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&manifest), sizeof(manifest));
+    return file.good();
+}
+
+bool write_run(const std::string& path, const data_chunk& records,
+    size_t record_size, size_t key_size)
+{
+    const size_t count = records.size() / record_size;
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    const uint8_t* data = records.data();
+    std::sort(order.begin(), order.end(),
+        [=](uint32_t left, uint32_t right)
+        {
+            return memcmp(data + left * record_size,
+                data + right * record_size, key_size) < 0;
+        });
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary);
+    for (uint32_t i: order)
+        file.write(reinterpret_cast<const char*>(data + i * record_size),
+            record_size);
+    file.close();
+    return file && std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool merge_runs(const std::vector<std::string>& run_paths,
+    const std::string& path, size_t record_size, size_t key_size)
+{
+    struct run_reader
+    {
+        std::ifstream file;
+        data_chunk record;
+        bool next(size_t record_size)
+        {
+            record.resize(record_size);
+            file.read(reinterpret_cast<char*>(record.data()), record_size);
+            return file.good();
+        }
+    };
+    std::vector<run_reader> readers(run_paths.size());
+    // Smallest key on top, ties broken by run so equal keys stay in
+    // depth order.
+    auto greater =
+        [&](size_t left, size_t right)
+        {
+            int result = memcmp(readers[left].record.data(),
+                readers[right].record.data(), key_size);
+            return result > 0 || (result == 0 && left > right);
+        };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)>
+        heads(greater);
+    for (size_t i = 0; i < run_paths.size(); ++i)
+    {
+        readers[i].file.open(run_paths[i], std::ios::binary);
+        if (!readers[i].file)
+            return false;
+        if (readers[i].next(record_size))
+            heads.push(i);
+    }
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary);
+    while (!heads.empty())
+    {
+        const size_t i = heads.top();
+        heads.pop();
+        file.write(reinterpret_cast<const char*>(readers[i].record.data()),
+            record_size);
+        if (readers[i].next(record_size))
+            heads.push(i);
+    }
+    file.close();
+    return file && std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool reindex(const sync_blockchain& chain, reindex_target& target,
+    const std::string& work_dir, size_t partition_size)
+{
+    mkdir(work_dir.c_str(), 0755);
+    const std::string manifest_path = work_dir + "/manifest";
+    reindex_manifest manifest;
+    const bool resumed = read_manifest(manifest_path, manifest);
+    if (!resumed)
+    {
+        std::error_code ec;
+        manifest.last_depth = chain.last_depth(ec);
+        if (ec)
+        {
+            log_error(LOG_REINDEX) << "Couldn't fetch last depth: "
+                << ec.message();
+            return false;
+        }
+        manifest.partition_size = partition_size;
+        manifest.record_size = target.record_size();
+        memset(manifest.target_name, 0, sizeof(manifest.target_name));
+        target.name().copy(manifest.target_name,
+            sizeof(manifest.target_name) - 1);
+        if (!write_manifest(manifest_path, manifest))
+        {
+            log_error(LOG_REINDEX) << "Couldn't write " << manifest_path;
+            return false;
+        }
+    }
+    else if (manifest.record_size != target.record_size() ||
+        std::string(manifest.target_name, strnlen(manifest.target_name,
+            sizeof(manifest.target_name))) != target.name())
+    {
+        log_error(LOG_REINDEX) << work_dir
+            << " holds a reindex of another index";
+        return false;
+    }
+    const size_t block_count = manifest.last_depth + 1;
+    const size_t partition_count =
+        (block_count + manifest.partition_size - 1) / manifest.partition_size;
+    std::vector<std::string> run_paths;
+    std::vector<size_t> pending;
+    size_t resumed_blocks = 0;
+    for (size_t i = 0; i < partition_count; ++i)
+    {
+        run_paths.push_back(run_path(work_dir, i));
+        // Runs without a manifest were left by an unknown reindex.
+        if (!resumed)
+            std::remove(run_paths.back().c_str());
+        if (!file_exists(run_paths.back()))
+            pending.push_back(i);
+        else
+            resumed_blocks += std::min<size_t>(manifest.partition_size,
+                block_count - i * manifest.partition_size);
+    }
+    echo() << "Reindexing " << block_count << " blocks in "
+        << partition_count << " partitions, " << partition_count -
+        pending.size() << " already done.";
+    std::atomic<size_t> next(0), blocks_done(0), bytes_done(0);
+    std::atomic<bool> failed(false);
+    auto worker =
+        [&]()
+        {
+            data_chunk records;
+            for (size_t index = next++; index < pending.size() && !failed;
+                index = next++)
+            {
+                const size_t partition = pending[index];
+                const size_t begin = partition * manifest.partition_size;
+                const size_t end = std::min<size_t>(
+                    begin + manifest.partition_size, block_count);
+                records.clear();
+                for (size_t depth = begin; depth < end && !failed; ++depth)
+                {
+                    std::error_code ec;
+                    const block_type blk = chain.block(depth, ec);
+                    if (ec || !target.extract(chain, depth, blk, records))
+                    {
+                        log_error(LOG_REINDEX) << "Block " << depth << ": "
+                            << (ec ? ec.message() : "extract failed");
+                        failed = true;
+                        return;
+                    }
+                    ++blocks_done;
+                    bytes_done += satoshi_raw_size(blk);
+                }
+                if (!write_run(run_paths[partition], records,
+                    target.record_size(), target.key_size()))
+                {
+                    log_error(LOG_REINDEX) << "Couldn't write "
+                        << run_paths[partition];
+                    failed = true;
+                }
+            }
+        };
+    // Reports progress until the workers finish.
+    std::mutex progress_mutex;
+    std::condition_variable progress_done;
+    bool workers_finished = false;
+    auto reporter =
+        [&]()
+        {
+            const auto start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(progress_mutex);
+            while (!progress_done.wait_for(lock, std::chrono::seconds(10),
+                [&] { return workers_finished; }))
+            {
+                const double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+                echo() << "Reindexed " << resumed_blocks + blocks_done
+                    << " / " << block_count << " blocks, "
+                    << size_t(blocks_done / seconds) << " blocks/s, "
+                    << bytes_done / seconds / 1000000 << " MB/s";
+            }
+        };
+    std::thread progress(reporter);
+    const size_t thread_count =
+        std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    for (std::thread& thread: threads)
+        thread.join();
+    {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        workers_finished = true;
+    }
+    progress_done.notify_one();
+    progress.join();
+    if (failed)
+        return false;
+    const std::string merged_path = work_dir + "/merged";
+    if (!file_exists(merged_path))
+    {
+        echo() << "Merging " << partition_count << " runs...";
+        if (!merge_runs(run_paths, merged_path,
+            target.record_size(), target.key_size()))
+        {
+            log_error(LOG_REINDEX) << "Couldn't merge runs";
+            return false;
+        }
+    }
+    echo() << "Loading index...";
+    if (!target.load(merged_path))
+        return false;
+    for (const std::string& path: run_paths)
+        std::remove(path.c_str());
+    std::remove(merged_path.c_str());
+    std::remove(manifest_path.c_str());
+    echo() << "Reindex complete.";
+    return true;
+}
+
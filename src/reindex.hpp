@@ -0,0 +1,47 @@
+#ifndef QUERY_REINDEX_HPP
+#define QUERY_REINDEX_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+#include "sync_blockchain.hpp"
+
+// An index derived from the blocks. Every block turns into fixed size
+// records ordered by their leading key_size bytes (compared with
+// memcmp, so keys are big endian). The reindexer sorts and merges them
+// and hands the target one sorted file.
+class reindex_target
+{
+public:
+    virtual ~reindex_target() {}
+
+    // Recorded in the work directory so a resumed reindex can't mix in
+    // runs of another index.
+    virtual std::string name() const = 0;
+    virtual size_t record_size() const = 0;
+    virtual size_t key_size() const = 0;
+    // Appends the records for blk. Called from many threads at once.
+    virtual bool extract(const sync_blockchain& chain, size_t depth,
+        const bc::block_type& blk, bc::data_chunk& records) = 0;
+    // Replaces the index contents with the sorted records in path.
+    virtual bool load(const std::string& path) = 0;
+};
+
+// Sorts fixed size records on their leading key_size bytes and writes
+// them to path through a temporary file, so only complete runs exist.
+bool write_run(const std::string& path, const bc::data_chunk& records,
+    size_t record_size, size_t key_size);
+// Merges sorted runs into path. Equal keys keep the order of the runs.
+bool merge_runs(const std::vector<std::string>& run_paths,
+    const std::string& path, size_t record_size, size_t key_size);
+
+// Rebuilds target from every block up to the chain's last depth using
+// all cores. The depth range is split into partitions of partition_size
+// blocks, and each finished partition is saved under work_dir as a
+// sorted run. A restarted reindex skips partitions that already have a
+// run, so runs double as checkpoints. Once every run exists they're
+// merged and loaded, and work_dir is cleared.
+bool reindex(const sync_blockchain& chain, reindex_target& target,
+    const std::string& work_dir, size_t partition_size);
+
+#endif
+
@@ -0,0 +1,15 @@
+#include "request_arena.hpp"
+
+// Past this many outpoints a list is released instead of kept, so one
+// huge request doesn't pin its memory on the thread for good.
+constexpr size_t arena_max_outpoints = 65536;
+
+request_arena& begin_request_arena()
+{
+    thread_local request_arena arena;
+    if (arena.outpoints.capacity() > arena_max_outpoints)
+        bc::output_point_list().swap(arena.outpoints);
+    arena.outpoints.clear();
+    return arena;
+}
+
@@ -0,0 +1,20 @@
+#ifndef QUERY_REQUEST_ARENA_HPP
+#define QUERY_REQUEST_ARENA_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+// Scratch containers for the request running on the current thread.
+// Server threads handle one request at a time, so a handler owns them
+// for the length of a call. Their capacity carries over to the next
+// request, up to a limit, so steady state requests don't allocate
+// temporaries.
+struct request_arena
+{
+    bc::output_point_list outpoints;
+};
+
+// This thread's arena with every container emptied.
+request_arena& begin_request_arena();
+
+#endif
+
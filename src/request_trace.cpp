@@ -0,0 +1,315 @@
+#include "request_trace.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include <bitcoin/bitcoin.hpp>
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+// Longer lists are cut short in the log.
+constexpr size_t max_listed = 3;
+
+thread_local request_trace* active_trace = nullptr;
+// Set once a server thread picks up a connection, for its first request.
+thread_local trace_clock::duration pending_queue_time;
+
+void request_trace::begin(const char* method, trace_clock::duration queued)
+{
+    method_ = method;
+    start_ = trace_clock::now();
+    failed_ = false;
+    arguments_size_ = 0;
+    stages_size_ = 0;
+    if (queued != trace_clock::duration::zero())
+        add("queue", queued);
+}
+
+void request_trace::finish(bool failed)
+{
+    end_ = trace_clock::now();
+    failed_ = failed_ || failed;
+}
+
+void request_trace::add(const char* stage, trace_clock::duration duration)
+{
+    for (size_t i = 0; i < stages_size_; ++i)
+        if (stages_[i].name == stage || !strcmp(stages_[i].name, stage))
+        {
+            stages_[i].duration += duration;
+            return;
+        }
+    if (stages_size_ < max_stages)
+        stages_[stages_size_++] = stage_time{stage, duration};
+}
+
+void request_trace::push_argument(
+    argument_kind kind, const void* value, int64_t number)
+{
+    if (arguments_size_ < max_arguments)
+        arguments_[arguments_size_++] = argument_slot{kind, value, number};
+}
+
+void request_trace::argument(const std::string& text)
+{
+    push_argument(argument_kind::text, &text, 0);
+}
+void request_trace::binary_argument(const std::string& data)
+{
+    push_argument(argument_kind::binary, &data, 0);
+}
+void request_trace::argument(int64_t value)
+{
+    push_argument(argument_kind::number, nullptr, value);
+}
+void request_trace::argument(const OutputPointList& outpoints)
+{
+    push_argument(argument_kind::outpoints, &outpoints, 0);
+}
+void request_trace::argument(const std::vector<std::string>& texts)
+{
+    push_argument(argument_kind::texts, &texts, 0);
+}
+
+const char* request_trace::method() const
+{
+    return method_;
+}
+
+trace_clock::duration request_trace::total() const
+{
+    trace_clock::duration queued = trace_clock::duration::zero();
+    if (stages_size_ && !strcmp(stages_[0].name, "queue"))
+        queued = stages_[0].duration;
+    return end_ - start_ + queued;
+}
+
+void write_milliseconds(std::ostream& stream, trace_clock::duration duration)
+{
+    stream << std::fixed << std::setprecision(1)
+        << std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void write_hex(std::ostream& stream, const std::string& data)
+{
+    bc::data_chunk raw(data.begin(), data.end());
+    stream << bc::encode_hex(raw);
+}
+
+void request_trace::write(std::ostream& stream) const
+{
+    stream << method_ << ' ';
+    write_milliseconds(stream, total());
+    stream << "ms";
+    if (failed_)
+        stream << " failed";
+    for (size_t i = 0; i < stages_size_; ++i)
+    {
+        stream << ' ' << stages_[i].name << '=';
+        write_milliseconds(stream, stages_[i].duration);
+    }
+    for (size_t i = 0; i < arguments_size_; ++i)
+    {
+        const argument_slot& slot = arguments_[i];
+        stream << (i == 0 ? " args: " : ", ");
+        if (slot.kind == argument_kind::text)
+            stream << *static_cast<const std::string*>(slot.value);
+        else if (slot.kind == argument_kind::binary)
+            write_hex(stream, *static_cast<const std::string*>(slot.value));
+        else if (slot.kind == argument_kind::number)
+            stream << slot.number;
+        else if (slot.kind == argument_kind::outpoints)
+        {
+            const auto& outpoints =
+                *static_cast<const OutputPointList*>(slot.value);
+            stream << outpoints.size() << " outpoints";
+            for (size_t j = 0; j < outpoints.size() && j < max_listed; ++j)
+            {
+                stream << ' ';
+                write_hex(stream, outpoints[j].hash);
+                stream << ':' << outpoints[j].index;
+            }
+            if (outpoints.size() > max_listed)
+                stream << " ...";
+        }
+        else
+        {
+            const auto& texts =
+                *static_cast<const std::vector<std::string>*>(slot.value);
+            stream << texts.size() << " items";
+            for (size_t j = 0; j < texts.size() && j < max_listed; ++j)
+                stream << ' ' << texts[j];
+            if (texts.size() > max_listed)
+                stream << " ...";
+        }
+    }
+}
+
+request_trace* current_trace()
+{
+    return active_trace;
+}
+
+trace_stage::trace_stage(const char* name)
+  : trace_(active_trace), name_(name)
+{
+    if (trace_)
+        start_ = trace_clock::now();
+}
+
+trace_stage::~trace_stage()
+{
+    if (trace_)
+        trace_->add(name_, trace_clock::now() - start_);
+}
+
+void trace_add(const char* stage, trace_clock::duration duration)
+{
+    if (active_trace)
+        active_trace->add(stage, duration);
+}
+
+void trace_binary_argument(const std::string& data)
+{
+    if (active_trace)
+        active_trace->binary_argument(data);
+}
+
+boost::shared_ptr<slow_query_log> slow_query_log::create(
+    config_map_type& config)
+{
+    const auto threshold =
+        boost::lexical_cast<size_t>(config["slow-query-threshold"]);
+    if (threshold == 0)
+        return nullptr;
+    return boost::shared_ptr<slow_query_log>(new slow_query_log(
+        config["slow-query-file"], std::chrono::milliseconds(threshold)));
+}
+
+slow_query_log::slow_query_log(const std::string& path,
+    std::chrono::milliseconds threshold)
+  : path_(path), threshold_(threshold),
+    file_(path.c_str(), std::ios::app)
+{
+    if (!file_)
+        bc::log_error() << "Couldn't open slow query log " << path;
+}
+
+void slow_query_log::set_threshold(std::chrono::milliseconds threshold)
+{
+    if (threshold == threshold.zero())
+        threshold_ = trace_clock::duration::max();
+    else
+        threshold_ = threshold;
+}
+
+// Each stage ends where the next one starts, so a single mark suffices.
+thread_local trace_clock::time_point stage_mark;
+// Undeclared exceptions skip postWrite, so either event may log first.
+thread_local bool trace_logged = false;
+
+void* slow_query_log::getContext(const char* fn_name, void*)
+{
+    thread_local request_trace trace;
+    trace.begin(fn_name, pending_queue_time);
+    pending_queue_time = trace_clock::duration::zero();
+    active_trace = &trace;
+    stage_mark = trace_clock::now();
+    trace_logged = false;
+    return &trace;
+}
+
+void mark_stage(void* ctx, const char* stage)
+{
+    const auto now = trace_clock::now();
+    static_cast<request_trace*>(ctx)->add(stage, now - stage_mark);
+    stage_mark = now;
+}
+
+void slow_query_log::preRead(void*, const char*)
+{
+    stage_mark = trace_clock::now();
+}
+void slow_query_log::postRead(void* ctx, const char*, uint32_t)
+{
+    mark_stage(ctx, "read");
+}
+void slow_query_log::preWrite(void* ctx, const char*)
+{
+    mark_stage(ctx, "handler");
+}
+void slow_query_log::postWrite(void* ctx, const char*, uint32_t)
+{
+    mark_stage(ctx, "write");
+    log_if_slow(*static_cast<request_trace*>(ctx), false);
+}
+
+void slow_query_log::handlerError(void* ctx, const char*)
+{
+    mark_stage(ctx, "handler");
+    log_if_slow(*static_cast<request_trace*>(ctx), true);
+}
+
+void slow_query_log::freeContext(void*, const char*)
+{
+    active_trace = nullptr;
+}
+
+void slow_query_log::log_if_slow(request_trace& trace, bool failed)
+{
+    if (trace_logged)
+        return;
+    trace_logged = true;
+    trace.finish(failed);
+    if (trace.total() < threshold_.load())
+        return;
+    std::ostringstream line;
+    const std::time_t now = std::time(nullptr);
+    std::tm local;
+    localtime_r(&now, &local);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp),
+        "%Y-%m-%d %H:%M:%S", &local);
+    line << timestamp << ' ';
+    trace.write(line);
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ << line.str() << std::endl;
+}
+
+queue_timer::queue_timer(boost::shared_ptr<TTransportFactory> factory)
+  : factory_(factory)
+{
+}
+
+boost::shared_ptr<TTransport> queue_timer::getTransport(
+    boost::shared_ptr<TTransport> transport)
+{
+    boost::shared_ptr<TTransport> result = factory_->getTransport(transport);
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Entries for connections that never reached a thread are dropped
+    // wholesale rather than tracked.
+    if (accepted_.size() > 10000)
+        accepted_.clear();
+    accepted_[result.get()] = trace_clock::now();
+    return result;
+}
+
+void* queue_timer::createContext(
+    boost::shared_ptr<TProtocol> input, boost::shared_ptr<TProtocol> output)
+{
+    const auto now = trace_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = accepted_.find(input->getTransport().get());
+    if (found != accepted_.end())
+    {
+        pending_queue_time = now - found->second;
+        accepted_.erase(found);
+    }
+    // The output side is stamped separately by the same accept.
+    accepted_.erase(output->getTransport().get());
+    return nullptr;
+}
+
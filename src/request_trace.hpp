@@ -0,0 +1,169 @@
+#ifndef QUERY_REQUEST_TRACE_HPP
+#define QUERY_REQUEST_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/TProcessor.h>
+#include <thrift/server/TServer.h>
+#include <thrift/transport/TTransport.h>
+
+#include "thrift/interface_types.h"
+#include "config.hpp"
+
+typedef std::chrono::steady_clock trace_clock;
+
+// Stage timings and arguments of the request running on this thread.
+// Server threads handle one request at a time, so each keeps a single
+// trace and reuses it. Recording costs a few clock reads per request;
+// nothing is formatted unless the request turns out to be slow.
+class request_trace
+{
+public:
+    void begin(const char* method, trace_clock::duration queued);
+    void finish(bool failed);
+
+    // Durations for the same stage add up.
+    void add(const char* stage, trace_clock::duration duration);
+
+    // Arguments are kept by reference, so the trace must be written
+    // before the generated process_ method returns. Its argument struct
+    // is destroyed before freeContext runs.
+    void argument(const std::string& text);
+    void binary_argument(const std::string& data);
+    void argument(int64_t value);
+    void argument(const OutputPointList& outpoints);
+    void argument(const std::vector<std::string>& texts);
+
+    const char* method() const;
+    trace_clock::duration total() const;
+    // One line: method, total and each stage in milliseconds, arguments.
+    void write(std::ostream& stream) const;
+
+private:
+    enum class argument_kind { text, binary, number, outpoints, texts };
+    struct argument_slot
+    {
+        argument_kind kind;
+        const void* value;
+        int64_t number;
+    };
+    struct stage_time
+    {
+        const char* name;
+        trace_clock::duration duration;
+    };
+    static constexpr size_t max_arguments = 4, max_stages = 12;
+
+    void push_argument(argument_kind kind, const void* value, int64_t number);
+
+    const char* method_ = "";
+    trace_clock::time_point start_, end_;
+    bool failed_ = false;
+    argument_slot arguments_[max_arguments];
+    size_t arguments_size_ = 0;
+    stage_time stages_[max_stages];
+    size_t stages_size_ = 0;
+};
+
+// Trace of the request this thread is serving, or nullptr when the
+// thread isn't serving one or slow query logging is off.
+request_trace* current_trace();
+
+// Adds the time until the end of the enclosing scope to a stage.
+class trace_stage
+{
+public:
+    trace_stage(const char* name);
+    ~trace_stage();
+
+private:
+    request_trace* trace_;
+    const char* name_;
+    trace_clock::time_point start_;
+};
+
+void trace_add(const char* stage, trace_clock::duration duration);
+
+template <typename Value>
+void trace_argument(const Value& value)
+{
+    request_trace* trace = current_trace();
+    if (trace)
+        trace->argument(value);
+}
+void trace_binary_argument(const std::string& data);
+
+// Traces every request and appends those slower than
+// slow-query-threshold milliseconds to slow-query-file. Stages:
+//   queue     accepted until a server thread took the connection
+//             (first request on a connection only)
+//   read      reading the arguments
+//   handler   running the handler, which includes
+//     fetch     blockchain fetches posted until their handler ran
+//     wake      fetch handler done until the server thread resumed
+//     thriftify converting results to Thrift types
+//   write     serialising and sending the reply
+class slow_query_log
+  : public apache::thrift::TProcessorEventHandler
+{
+public:
+    // Null when slow-query-threshold is 0.
+    static boost::shared_ptr<slow_query_log> create(config_map_type& config);
+
+    slow_query_log(const std::string& path,
+        std::chrono::milliseconds threshold);
+    // From a reloaded config. 0 stops logging but keeps tracing.
+    void set_threshold(std::chrono::milliseconds threshold);
+
+    void* getContext(const char* fn_name, void* server_context);
+    void freeContext(void* ctx, const char* fn_name);
+    void preRead(void* ctx, const char* fn_name);
+    void postRead(void* ctx, const char* fn_name, uint32_t bytes);
+    void preWrite(void* ctx, const char* fn_name);
+    void postWrite(void* ctx, const char* fn_name, uint32_t bytes);
+    void handlerError(void* ctx, const char* fn_name);
+
+private:
+    // Runs while the handler's arguments still exist.
+    void log_if_slow(request_trace& trace, bool failed);
+
+    const std::string path_;
+    std::atomic<trace_clock::duration> threshold_;
+    std::mutex mutex_;
+    std::ofstream file_;
+};
+
+// Measures how long accepted connections wait for a server thread.
+// Wraps a server's transport factory to stamp connections as they are
+// accepted, and is the server's event handler so it sees when a thread
+// starts serving them.
+class queue_timer
+  : public apache::thrift::transport::TTransportFactory,
+    public apache::thrift::server::TServerEventHandler
+{
+public:
+    queue_timer(
+        boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+            factory);
+
+    boost::shared_ptr<apache::thrift::transport::TTransport> getTransport(
+        boost::shared_ptr<apache::thrift::transport::TTransport> transport);
+    void* createContext(
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> input,
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> output);
+
+private:
+    boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+        factory_;
+    std::mutex mutex_;
+    std::unordered_map<const void*, trace_clock::time_point> accepted_;
+};
+
+#endif
+
@@ -0,0 +1,632 @@
+#include "router.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <thrift/transport/TSocket.h>
+#include <bitcoin/bitcoin.hpp>
+
+#include "echo.hpp"
+#include "server.hpp"
+#include "thrift_factories.hpp"
+#include "thriftify.hpp"
+
+#define LOG_ROUTER "router"
+
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+backend::backend(const std::string& host, int port,
+    boost::shared_ptr<TProtocolFactory> protocol_factory,
+    boost::shared_ptr<TTransportFactory> transport_factory,
+    int connect_timeout, int request_timeout)
+  : outstanding(0), depth(-1),
+    host_(host), name_(host + ":" + boost::lexical_cast<std::string>(port)),
+    port_(port), connect_timeout_(connect_timeout),
+    request_timeout_(request_timeout), protocol_factory_(protocol_factory),
+    transport_factory_(transport_factory)
+{
+}
+
+backend::connection_ptr backend::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty())
+        {
+            connection_ptr conn = std::move(idle_.back());
+            idle_.pop_back();
+            return conn;
+        }
+    }
+    connection_ptr conn(new connection);
+    boost::shared_ptr<TSocket> socket(new TSocket(host_, port_));
+    socket->setConnTimeout(connect_timeout_);
+    socket->setRecvTimeout(request_timeout_);
+    socket->setSendTimeout(request_timeout_);
+    conn->transport = transport_factory_->getTransport(socket);
+    conn->client.reset(new QueryServiceClient(
+        protocol_factory_->getProtocol(conn->transport)));
+    conn->transport->open();
+    return conn;
+}
+
+void backend::release(connection_ptr conn, bool healthy)
+{
+    if (!healthy)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(std::move(conn));
+}
+
+const std::string& backend::name() const
+{
+    return name_;
+}
+
+struct query_router::call_state
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+    bool finished = false;
+    // Set when every attempt so far failed at the transport level,
+    // meaning another backend is worth trying.
+    bool retryable = false;
+    std::exception_ptr error;
+};
+
+query_router::query_router(config_map_type& config)
+  : best_tip_(-1),
+    hedge_delay_(std::chrono::milliseconds(
+        boost::lexical_cast<size_t>(config["router-hedge-delay"]))),
+    poll_interval_(std::chrono::milliseconds(
+        boost::lexical_cast<size_t>(config["router-poll-interval"]))),
+    stopped_(false)
+{
+    auto protocol_factory =
+        make_protocol_factory(config["router-backend-protocol"]);
+    auto transport_factory = make_transport_factory(
+        config["router-backend-transport"],
+        boost::lexical_cast<size_t>(config["compression-threshold"]),
+        boost::lexical_cast<size_t>(config["compression-max-frame"]));
+    BITCOIN_ASSERT(protocol_factory && transport_factory);
+    const int connect_timeout =
+        boost::lexical_cast<int>(config["router-connect-timeout"]);
+    const int request_timeout =
+        boost::lexical_cast<int>(config["router-request-timeout"]);
+    std::vector<std::string> addresses;
+    boost::split(addresses, config["router-backends"],
+        boost::is_any_of(", "), boost::token_compress_on);
+    for (const std::string& address: addresses)
+    {
+        if (address.empty())
+            continue;
+        size_t colon = address.rfind(':');
+        std::string host = address.substr(0, colon);
+        int port = 9090;
+        if (colon != std::string::npos)
+            port = boost::lexical_cast<int>(address.substr(colon + 1));
+        backends_.push_back(std::make_shared<backend>(
+            host, port, protocol_factory, transport_factory,
+            connect_timeout, request_timeout));
+    }
+    const size_t thread_count =
+        boost::lexical_cast<size_t>(config["router-threads"]);
+    for (size_t i = 0; i < thread_count; ++i)
+        attempt_threads_.emplace_back(&query_router::run_attempts, this);
+}
+
+void query_router::start()
+{
+    // Poll once up front so the first requests have a tip to route by.
+    for (backend_ptr target: backends_)
+        echo() << "Backend " << target->name();
+    poll_tips();
+    poller_ = std::thread(
+        [this]
+        {
+            std::unique_lock<std::mutex> lock(poller_mutex_);
+            while (!poller_wakeup_.wait_for(lock, poll_interval_.load(),
+                [this] { return stopped_; }))
+            {
+                lock.unlock();
+                poll_tips();
+                lock.lock();
+            }
+        });
+}
+
+void query_router::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(poller_mutex_);
+        stopped_ = true;
+    }
+    poller_wakeup_.notify_one();
+    if (poller_.joinable())
+        poller_.join();
+    {
+        std::lock_guard<std::mutex> lock(attempts_mutex_);
+        attempts_stopped_ = true;
+    }
+    attempts_ready_.notify_all();
+    for (std::thread& thread: attempt_threads_)
+        thread.join();
+    attempt_threads_.clear();
+}
+
+void query_router::run_attempts()
+{
+    std::unique_lock<std::mutex> lock(attempts_mutex_);
+    while (true)
+    {
+        ++idle_threads_;
+        attempts_ready_.wait(lock,
+            [this] { return attempts_stopped_ || !attempts_.empty(); });
+        --idle_threads_;
+        if (attempts_.empty())
+            return;
+        std::function<void ()> run = std::move(attempts_.front());
+        attempts_.pop_front();
+        lock.unlock();
+        run();
+        lock.lock();
+    }
+}
+
+bool query_router::post_attempt(backend_ptr target, method_type method,
+    call_state_ptr state)
+{
+    {
+        std::lock_guard<std::mutex> lock(attempts_mutex_);
+        // Queued attempts would only wait behind slow ones.
+        if (attempts_stopped_ || idle_threads_ <= attempts_.size())
+            return false;
+        attempts_.push_back(std::bind(attempt, target, method, state));
+    }
+    attempts_ready_.notify_one();
+    return true;
+}
+
+void query_router::reload(config_map_type& config)
+{
+    hedge_delay_ = std::chrono::milliseconds(
+        boost::lexical_cast<size_t>(config["router-hedge-delay"]));
+    poll_interval_ = std::chrono::milliseconds(
+        boost::lexical_cast<size_t>(config["router-poll-interval"]));
+}
+
+int32_t query_router::best_tip() const
+{
+    return best_tip_;
+}
+
+void query_router::poll_tips()
+{
+    int32_t best = -1;
+    for (backend_ptr target: backends_)
+    {
+        backend::connection_ptr conn;
+        try
+        {
+            conn = target->acquire();
+            target->depth = conn->client->last_depth();
+            target->release(std::move(conn), true);
+        }
+        catch (const TException& ex)
+        {
+            if (target->depth != -1)
+                bc::log_warning(LOG_ROUTER) << "Backend " << target->name()
+                    << " unreachable: " << ex.what();
+            target->depth = -1;
+        }
+        best = std::max<int32_t>(best, target->depth);
+    }
+    best_tip_ = best;
+}
+
+backend_ptr query_router::select(backend_ptr exclude)
+{
+    const int32_t tip = best_tip_;
+    backend_ptr best;
+    for (backend_ptr target: backends_)
+    {
+        if (target == exclude || target->depth < 0 || target->depth < tip)
+            continue;
+        if (!best || target->outstanding < best->outstanding)
+            best = target;
+    }
+    return best;
+}
+
+void query_router::call(method_type method, bool idempotent)
+{
+    backend_ptr primary = select(nullptr);
+    if (!primary)
+        throw_error("No backend available at the best known tip");
+    auto state = std::make_shared<call_state>();
+    state->pending = 1;
+    if (!idempotent || !post_attempt(primary, method, state))
+        attempt(primary, method, state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait_for(lock, hedge_delay_.load(),
+        [state] { return state->finished; });
+    // Hedge a slow call, or fail over a broken one, to a second backend.
+    // A write that failed in transit may still have been applied.
+    if (idempotent && (!state->finished || state->retryable))
+    {
+        backend_ptr secondary = select(primary);
+        if (secondary)
+        {
+            state->finished = false;
+            state->retryable = false;
+            state->error = nullptr;
+            ++state->pending;
+            if (!post_attempt(secondary, method, state))
+            {
+                lock.unlock();
+                attempt(secondary, method, state);
+                lock.lock();
+            }
+        }
+    }
+    state->done.wait(lock, [state] { return state->finished; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+void query_router::attempt(backend_ptr target, method_type method,
+    call_state_ptr state)
+{
+    ++target->outstanding;
+    commit_type commit;
+    std::exception_ptr error;
+    bool healthy = true;
+    backend::connection_ptr conn;
+    try
+    {
+        conn = target->acquire();
+        commit = method(*conn->client);
+    }
+    catch (const ErrorCode&)
+    {
+        // The backend answered; its error is the answer.
+        error = std::current_exception();
+    }
+    catch (const TException& ex)
+    {
+        healthy = false;
+        target->depth = -1;
+        ErrorCode except;
+        except.what = 0;
+        except.why = "Backend " + target->name() + " failed: " + ex.what();
+        error = std::make_exception_ptr(except);
+    }
+    if (conn)
+        target->release(std::move(conn), healthy);
+    --target->outstanding;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    --state->pending;
+    if (state->finished)
+        return;
+    if (commit)
+        commit();
+    else if (healthy || state->pending == 0)
+    {
+        state->error = error;
+        state->retryable = !healthy;
+    }
+    else
+        // Another attempt is still running and may yet succeed.
+        return;
+    state->finished = true;
+    state->done.notify_all();
+}
+
+// Each attempt fills its own result since a hedged call can run the
+// same method on two backends at once.
+template <typename Result, typename Method>
+void forward(query_router& router, Result& result, Method method,
+    bool idempotent=true)
+{
+    router.call(
+        [method, &result](QueryServiceClient& client)
+        {
+            auto attempt_result = std::make_shared<Result>();
+            method(client, *attempt_result);
+            return query_router::commit_type(
+                [&result, attempt_result] { result = *attempt_result; });
+        }, idempotent);
+}
+
+router_service_handler::router_service_handler(
+    config_map_type& config, query_router& router, server_control& control)
+  : router_(router), control_(control), stop_secret_(config["stop-secret"])
+{
+}
+
+bool router_service_handler::stop(const std::string& secret)
+{
+    if (secret != stop_secret_)
+        return false;
+    echo() << "Stopping router...";
+    control_.stop();
+    return true;
+}
+
+void router_service_handler::block_header_by_depth(
+    BlockHeader& blk, const int32_t depth)
+{
+    forward(router_, blk,
+        [depth](QueryServiceClient& client, BlockHeader& result)
+        {
+            client.block_header_by_depth(result, depth);
+        });
+}
+
+void router_service_handler::block_header_by_hash(
+    BlockHeader& blk, const std::string& hash)
+{
+    forward(router_, blk,
+        [hash](QueryServiceClient& client, BlockHeader& result)
+        {
+            client.block_header_by_hash(result, hash);
+        });
+}
+
+void router_service_handler::block_transaction_hashes_by_depth(
+    HashList& tx_hashes, const int32_t depth)
+{
+    forward(router_, tx_hashes,
+        [depth](QueryServiceClient& client, HashList& result)
+        {
+            client.block_transaction_hashes_by_depth(result, depth);
+        });
+}
+
+void router_service_handler::block_transaction_hashes_by_hash(
+    HashList& tx_hashes, const std::string& hash)
+{
+    forward(router_, tx_hashes,
+        [hash](QueryServiceClient& client, HashList& result)
+        {
+            client.block_transaction_hashes_by_hash(result, hash);
+        });
+}
+
+int32_t router_service_handler::block_depth(const std::string& hash)
+{
+    int32_t depth = 0;
+    forward(router_, depth,
+        [hash](QueryServiceClient& client, int32_t& result)
+        {
+            result = client.block_depth(hash);
+        });
+    return depth;
+}
+
+int32_t router_service_handler::last_depth()
+{
+    int32_t depth = 0;
+    forward(router_, depth,
+        [](QueryServiceClient& client, int32_t& result)
+        {
+            result = client.last_depth();
+        });
+    return depth;
+}
+
+int32_t router_service_handler::depth_at_time(const int64_t timestamp)
+{
+    int32_t depth = 0;
+    forward(router_, depth,
+        [timestamp](QueryServiceClient& client, int32_t& result)
+        {
+            result = client.depth_at_time(timestamp);
+        });
+    return depth;
+}
+
+void router_service_handler::block_headers_in_time_range(
+    BlockHeaderList& headers, const int64_t from_time, const int64_t to_time)
+{
+    forward(router_, headers,
+        [from_time, to_time](
+            QueryServiceClient& client, BlockHeaderList& result)
+        {
+            client.block_headers_in_time_range(result, from_time, to_time);
+        });
+}
+
+void router_service_handler::transaction(
+    Transaction& tx, const std::string& hash)
+{
+    forward(router_, tx,
+        [hash](QueryServiceClient& client, Transaction& result)
+        {
+            client.transaction(result, hash);
+        });
+}
+
+void router_service_handler::transaction_index(
+    TransactionIndex& tx_index, const std::string& hash)
+{
+    forward(router_, tx_index,
+        [hash](QueryServiceClient& client, TransactionIndex& result)
+        {
+            client.transaction_index(result, hash);
+        });
+}
+
+void router_service_handler::spend(
+    InputPoint& inpoint, const OutputPoint& outpoint)
+{
+    forward(router_, inpoint,
+        [outpoint](QueryServiceClient& client, InputPoint& result)
+        {
+            client.spend(result, outpoint);
+        });
+}
+
+void router_service_handler::outputs(
+    OutputPointList& outpoints, const std::string& address)
+{
+    forward(router_, outpoints,
+        [address](QueryServiceClient& client, OutputPointList& result)
+        {
+            client.outputs(result, address);
+        });
+}
+
+void router_service_handler::history(
+    History& history, const std::string& address)
+{
+    forward(router_, history,
+        [address](QueryServiceClient& client, History& result)
+        {
+            client.history(result, address);
+        });
+}
+
+void router_service_handler::outputs_by_script(
+    OutputPointList& outpoints, const std::string& script_hash)
+{
+    forward(router_, outpoints,
+        [script_hash](QueryServiceClient& client, OutputPointList& result)
+        {
+            client.outputs_by_script(result, script_hash);
+        });
+}
+
+void router_service_handler::history_by_script(
+    History& history, const std::string& script_hash)
+{
+    forward(router_, history,
+        [script_hash](QueryServiceClient& client, History& result)
+        {
+            client.history_by_script(result, script_hash);
+        });
+}
+
+void router_service_handler::output_values(
+    OutputValues& values, const OutputPointList& outpoints)
+{
+    forward(router_, values,
+        [outpoints](QueryServiceClient& client, OutputValues& result)
+        {
+            client.output_values(result, outpoints);
+        });
+}
+
+void router_service_handler::merkle_proof(
+    MerkleProof& proof, const std::string& hash)
+{
+    forward(router_, proof,
+        [hash](QueryServiceClient& client, MerkleProof& result)
+        {
+            client.merkle_proof(result, hash);
+        });
+}
+
+void router_service_handler::block_stats(BlockStatsList& stats,
+    const int32_t start_depth, const int32_t count)
+{
+    forward(router_, stats,
+        [start_depth, count](
+            QueryServiceClient& client, BlockStatsList& result)
+        {
+            client.block_stats(result, start_depth, count);
+        });
+}
+
+void router_service_handler::blocks_raw(RawBlockList& blocks,
+    const int32_t start_depth, const int32_t count)
+{
+    forward(router_, blocks,
+        [start_depth, count](
+            QueryServiceClient& client, RawBlockList& result)
+        {
+            client.blocks_raw(result, start_depth, count);
+        });
+}
+
+void router_service_handler::trace_forward(TraceResult& trace,
+    const OutputPoint& outpoint,
+    const int32_t max_hops, const int32_t max_nodes)
+{
+    forward(router_, trace,
+        [outpoint, max_hops, max_nodes](
+            QueryServiceClient& client, TraceResult& result)
+        {
+            client.trace_forward(result, outpoint, max_hops, max_nodes);
+        });
+}
+
+void router_service_handler::trace_backward(TraceResult& trace,
+    const std::string& hash, const int32_t max_hops, const int32_t max_nodes)
+{
+    forward(router_, trace,
+        [hash, max_hops, max_nodes](
+            QueryServiceClient& client, TraceResult& result)
+        {
+            client.trace_backward(result, hash, max_hops, max_nodes);
+        });
+}
+
+void router_service_handler::history_since(HistoryDelta& delta,
+    const std::vector<std::string>& addresses,
+    const int32_t from_depth, const std::string& known_tip_hash)
+{
+    forward(router_, delta,
+        [addresses, from_depth, known_tip_hash](
+            QueryServiceClient& client, HistoryDelta& result)
+        {
+            client.history_since(
+                result, addresses, from_depth, known_tip_hash);
+        });
+}
+
+void router_service_handler::transaction_pool_transaction(
+    Transaction& tx, const std::string& hash)
+{
+    forward(router_, tx,
+        [hash](QueryServiceClient& client, Transaction& result)
+        {
+            client.transaction_pool_transaction(result, hash);
+        });
+}
+
+void router_service_handler::mempool_fee_histogram(FeeHistogram& histogram)
+{
+    forward(router_, histogram,
+        [](QueryServiceClient& client, FeeHistogram& result)
+        {
+            client.mempool_fee_histogram(result);
+        });
+}
+
+bool router_service_handler::broadcast_transaction(
+    const std::string& tx_data)
+{
+    bool success = false;
+    forward(router_, success,
+        [tx_data](QueryServiceClient& client, bool& result)
+        {
+            result = client.broadcast_transaction(tx_data);
+        }, false);
+    return success;
+}
+
+void router_service_handler::broadcast_transactions(
+    BroadcastResultList& results, const std::vector<std::string>& txs_data)
+{
+    forward(router_, results,
+        [txs_data](QueryServiceClient& client, BroadcastResultList& result)
+        {
+            client.broadcast_transactions(result, txs_data);
+        }, false);
+}
+
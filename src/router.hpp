@@ -0,0 +1,184 @@
+#ifndef QUERY_ROUTER_HPP
+#define QUERY_ROUTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TTransport.h>
+
+#include "thrift/QueryService.h"
+#include "config.hpp"
+#include "server.hpp"
+
+// Pool of connections to a single queryd.
+class backend
+{
+public:
+    struct connection
+    {
+        boost::shared_ptr<apache::thrift::transport::TTransport> transport;
+        std::unique_ptr<QueryServiceClient> client;
+    };
+    typedef std::unique_ptr<connection> connection_ptr;
+
+    // Timeouts are in milliseconds, so a hung backend fails its calls
+    // instead of holding a thread.
+    backend(const std::string& host, int port,
+        boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>
+            protocol_factory,
+        boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+            transport_factory,
+        int connect_timeout, int request_timeout);
+
+    // Borrows an idle connection or opens a new one. May throw.
+    connection_ptr acquire();
+    // Broken connections are dropped rather than returned to the pool.
+    void release(connection_ptr conn, bool healthy);
+
+    const std::string& name() const;
+
+    // Requests currently in flight on this backend.
+    std::atomic<size_t> outstanding;
+    // Last depth reported by the tip poller, or -1 when unreachable.
+    std::atomic<int32_t> depth;
+
+private:
+    const std::string host_, name_;
+    const int port_, connect_timeout_, request_timeout_;
+    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>
+        protocol_factory_;
+    boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+        transport_factory_;
+    std::mutex mutex_;
+    std::vector<connection_ptr> idle_;
+};
+
+typedef std::shared_ptr<backend> backend_ptr;
+
+// Forwards calls to the least loaded backend at the best known tip.
+// Calls still running after the hedge delay are raced against a second
+// backend and whichever answers first wins. Attempts run on a fixed
+// pool of router-threads threads; when none is free the caller's own
+// thread runs them, one at a time.
+class query_router
+{
+public:
+    // A method runs against one backend and returns a commit function
+    // that copies its result out. Only the winning attempt commits, so
+    // a hedged loser finishing late never touches the caller's result.
+    typedef std::function<void ()> commit_type;
+    typedef std::function<commit_type (QueryServiceClient&)> method_type;
+
+    query_router(config_map_type& config);
+    void start();
+    void stop();
+    // Applies the hedge delay and poll interval of a reloaded config.
+    void reload(config_map_type& config);
+
+    // Runs method against a backend. Rethrows ErrorCode from the backend,
+    // or throws ErrorCode when no backend could answer. Methods that
+    // aren't idempotent are neither hedged nor retried elsewhere.
+    void call(method_type method, bool idempotent=true);
+
+    int32_t best_tip() const;
+
+private:
+    struct call_state;
+    typedef std::shared_ptr<call_state> call_state_ptr;
+
+    void poll_tips();
+    // Least outstanding requests among backends at the tip, skipping
+    // exclude. Returns an empty pointer when none qualify.
+    backend_ptr select(backend_ptr exclude);
+    static void attempt(backend_ptr target, method_type method,
+        call_state_ptr state);
+    // Runs the attempt on an idle pool thread, or returns false.
+    bool post_attempt(backend_ptr target, method_type method,
+        call_state_ptr state);
+    void run_attempts();
+
+    std::vector<backend_ptr> backends_;
+    std::atomic<int32_t> best_tip_;
+    std::atomic<std::chrono::milliseconds> hedge_delay_, poll_interval_;
+    // Wakes the poller early on stop.
+    std::mutex poller_mutex_;
+    std::condition_variable poller_wakeup_;
+    bool stopped_;
+    std::thread poller_;
+    // Attempt pool
+    std::mutex attempts_mutex_;
+    std::condition_variable attempts_ready_;
+    std::deque<std::function<void ()>> attempts_;
+    size_t idle_threads_ = 0;
+    bool attempts_stopped_ = false;
+    std::vector<std::thread> attempt_threads_;
+};
+
+class router_service_handler
+  : public QueryServiceIf
+{
+public:
+    router_service_handler(config_map_type& config, query_router& router,
+        server_control& control);
+
+    bool stop(const std::string& secret);
+    // blockchain methods
+    void block_header_by_depth(BlockHeader& blk, const int32_t depth);
+    void block_header_by_hash(BlockHeader& blk, const std::string& hash);
+    void block_transaction_hashes_by_depth(
+        HashList& tx_hashes, const int32_t depth);
+    void block_transaction_hashes_by_hash(
+        HashList& tx_hashes, const std::string& hash);
+    int32_t block_depth(const std::string& hash);
+    int32_t last_depth();
+    int32_t depth_at_time(const int64_t timestamp);
+    void block_headers_in_time_range(BlockHeaderList& headers,
+        const int64_t from_time, const int64_t to_time);
+    void transaction(Transaction& tx, const std::string& hash);
+    void transaction_index(
+        TransactionIndex& tx_index, const std::string& hash);
+    void spend(InputPoint& inpoint, const OutputPoint& outpoint);
+    void outputs(OutputPointList& outpoints, const std::string& address);
+    // blockchain (composed) methods
+    void history(History& history, const std::string& address);
+    void outputs_by_script(OutputPointList& outpoints,
+        const std::string& script_hash);
+    void history_by_script(History& history, const std::string& script_hash);
+    void output_values(OutputValues& values, const OutputPointList& outpoints);
+    void merkle_proof(MerkleProof& proof, const std::string& hash);
+    void block_stats(BlockStatsList& stats,
+        const int32_t start_depth, const int32_t count);
+    void blocks_raw(RawBlockList& blocks,
+        const int32_t start_depth, const int32_t count);
+    void trace_forward(TraceResult& trace, const OutputPoint& outpoint,
+        const int32_t max_hops, const int32_t max_nodes);
+    void trace_backward(TraceResult& trace, const std::string& hash,
+        const int32_t max_hops, const int32_t max_nodes);
+    void history_since(HistoryDelta& delta,
+        const std::vector<std::string>& addresses,
+        const int32_t from_depth, const std::string& known_tip_hash);
+    // transaction pool methods
+    void transaction_pool_transaction(
+        Transaction& tx, const std::string& hash);
+    void mempool_fee_histogram(FeeHistogram& histogram);
+    // protocol methods
+    bool broadcast_transaction(const std::string& tx_data);
+    void broadcast_transactions(BroadcastResultList& results,
+        const std::vector<std::string>& txs_data);
+
+private:
+    query_router& router_;
+    server_control& control_;
+    const std::string stop_secret_;
+};
+
+#endif
+
@@ -0,0 +1,31 @@
+#include "echo.hpp"
+#include "router.hpp"
+#include "server.hpp"
+
+int main(int argc, char** argv)
+{
+    std::string config_path = "router.cfg";
+    if (argc == 3 && std::string(argv[1]) == "--config")
+        config_path = argv[2];
+    config_map_type config;
+    load_config(config, config_path);
+    // Before the poller and server threads start, so they inherit it.
+    block_server_signals();
+    query_router router(config);
+    echo() << "Polling backends...";
+    router.start();
+    echo() << "Best tip: " << router.best_tip();
+    server_control control;
+    boost::shared_ptr<router_service_handler> handler(
+        new router_service_handler(config, router, control));
+    auto reload =
+        [&router](config_map_type& fresh)
+        {
+            router.reload(fresh);
+        };
+    run_thrift_server(config, handler, control, reload);
+    router.stop();
+    echo() << "Router stopped.";
+    return 0;
+}
+
@@ -0,0 +1,468 @@
+#include "script_index.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+#include "echo.hpp"
+#include "snapshot_format.hpp"
+
+#define LOG_SCRIPTS "scripts"
+
+using namespace bc;
+
+constexpr uint8_t script_file_magic[4] = {'Q', 'S', 'I', '2'};
+// Magic, big endian tip depth and tip block hash.
+constexpr size_t script_file_header_size = 4 + 4 + hash_digest_size;
+constexpr size_t script_key_size = hash_digest_size + 4;
+constexpr size_t script_record_size = script_key_size + hash_digest_size + 4;
+// Records read per call while scanning one script's postings.
+constexpr size_t script_read_batch = 256;
+
+static void script_save_record(uint8_t* record, const hash_digest& script_hash,
+    size_t depth, const output_point& outpoint)
+{
+    std::copy(script_hash.begin(), script_hash.end(), record);
+    snapshot_set_uint32(record + hash_digest_size, depth);
+    std::copy(outpoint.hash.begin(), outpoint.hash.end(),
+        record + script_key_size);
+    snapshot_set_uint32(record + script_key_size + hash_digest_size,
+        outpoint.index);
+}
+
+hash_digest hash_script(const script& output_script)
+{
+    const data_chunk raw = save_script(output_script);
+    hash_digest digest;
+    SHA256(raw.data(), raw.size(), digest.data());
+    return digest;
+}
+
+struct script_posting_file
+{
+    ~script_posting_file()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+    int fd = -1;
+    size_t tip = 0, count = 0;
+    hash_digest tip_hash = null_hash;
+};
+
+// Opens a posting list file, checking its header.
+static script_posting_file_ptr open_posting_file(const std::string& path)
+{
+    auto file = std::make_shared<script_posting_file>();
+    file->fd = ::open(path.c_str(), O_RDONLY);
+    if (file->fd == -1)
+        return nullptr;
+    uint8_t header[script_file_header_size];
+    struct stat info;
+    if (pread(file->fd, header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header, script_file_magic, sizeof(script_file_magic)) ||
+        fstat(file->fd, &info) == -1)
+    {
+        log_error(LOG_SCRIPTS) << "Unrecognised script index " << path;
+        return nullptr;
+    }
+    file->tip = snapshot_get_uint32(header + 4);
+    std::copy(header + 8, header + 8 + hash_digest_size,
+        file->tip_hash.begin());
+    file->count =
+        (info.st_size - script_file_header_size) / script_record_size;
+    return file;
+}
+
+// Writes records through a temporary file, which replaces path once
+// complete. Calls next(record) until it returns false, then keeps the
+// old file unless read_ok() says the records all arrived.
+template <typename NextRecord, typename ReadOk>
+static bool write_posting_file(const std::string& path, size_t tip,
+    const hash_digest& tip_hash, NextRecord next, ReadOk read_ok)
+{
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary);
+        uint8_t header[script_file_header_size];
+        std::copy(script_file_magic, script_file_magic + 4, header);
+        snapshot_set_uint32(header + 4, tip);
+        std::copy(tip_hash.begin(), tip_hash.end(), header + 8);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        uint8_t record[script_record_size];
+        while (file && next(record))
+            file.write(reinterpret_cast<const char*>(record),
+                sizeof(record));
+        if (!file)
+        {
+            log_error(LOG_SCRIPTS) << "Couldn't write " << temp_path;
+            return false;
+        }
+    }
+    if (!read_ok())
+    {
+        log_error(LOG_SCRIPTS) << "Couldn't read the records for " << path;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()))
+    {
+        log_error(LOG_SCRIPTS) << "Couldn't rename " << temp_path
+            << " to " << path;
+        return false;
+    }
+    return true;
+}
+
+script_index::script_index(const std::string& path, size_t flush_blocks)
+  : path_(path), flush_blocks_(std::max<size_t>(flush_blocks, 1))
+{
+}
+
+bool script_index::open(const sync_blockchain& chain)
+{
+    if (path_.empty())
+        return true;
+    script_posting_file_ptr file = open_posting_file(path_);
+    if (!file)
+    {
+        echo() << "No script index, run queryd --reindex scripts "
+            "to build one.";
+        return true;
+    }
+    // The chain reorganized below the file's tip after it was written,
+    // and which of its records are stale can't be told any more.
+    std::error_code ec;
+    const block_type header = chain.block_header(file->tip, ec);
+    if (ec || hash_block_header(header) != file->tip_hash)
+    {
+        log_error(LOG_SCRIPTS) << "Script index tip " << file->tip
+            << " left the chain, run queryd --reindex scripts";
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ = file;
+    file_visible_tip_ = file->tip;
+    indexed_tip_ = file->tip;
+    indexed_tip_hash_ = file->tip_hash;
+    return true;
+}
+
+bool script_index::enabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_ != nullptr;
+}
+
+bool script_index::ready() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_;
+}
+
+bool script_index::catch_up(const sync_blockchain& chain, std::error_code& ec)
+{
+    if (!enabled())
+        return true;
+    const size_t last_depth = chain.last_depth(ec);
+    if (ec)
+        return false;
+    for (size_t depth = indexed_tip_ + 1; depth <= last_depth; ++depth)
+    {
+        const block_type blk = chain.block(depth, ec);
+        if (ec)
+            return false;
+        add_block(blk, depth);
+        if (indexed_tip_ - file_visible_tip_ >= flush_blocks_ && !flush())
+            return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_ = true;
+    return true;
+}
+
+void script_index::reorganize(size_t fork_point,
+    const blockchain::block_list& new_blocks)
+{
+    if (!enabled())
+        return;
+    bool replaced_file_blocks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Postings are in ascending depth, so replaced ones are at the end.
+        for (auto it = memory_.begin(); it != memory_.end(); )
+        {
+            posting_list& postings = it->second;
+            while (!postings.empty() && postings.back().depth > fork_point)
+                postings.pop_back();
+            if (postings.empty())
+                it = memory_.erase(it);
+            else
+                ++it;
+        }
+        replaced_file_blocks = file_visible_tip_ > fork_point;
+        file_visible_tip_ = std::min(file_visible_tip_, fork_point);
+        indexed_tip_ = std::min(indexed_tip_, fork_point);
+    }
+    for (size_t i = 0; i < new_blocks.size(); ++i)
+    {
+        const size_t depth = fork_point + i + 1;
+        // catch_up() may already have seen this block.
+        if (depth == indexed_tip_ + 1)
+            add_block(*new_blocks[i], depth);
+    }
+    // Rewrite a file holding replaced blocks before a restart can
+    // trust it.
+    if (replaced_file_blocks ||
+        indexed_tip_ - file_visible_tip_ >= flush_blocks_)
+        flush();
+}
+
+void script_index::add_block(const block_type& blk, size_t depth)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const transaction_type& tx: blk.transactions)
+    {
+        const hash_digest tx_hash = hash_transaction(tx);
+        for (uint32_t i = 0; i < tx.outputs.size(); ++i)
+            memory_[hash_script(tx.outputs[i].output_script)].push_back(
+                posting{output_point{tx_hash, i}, depth});
+    }
+    indexed_tip_ = depth;
+    indexed_tip_hash_ = hash_block_header(blk);
+}
+
+bool script_index::flush()
+{
+    // Only this thread changes the index, so reading it unlocked is safe.
+    script_posting_file_ptr old_file = file_;
+    const size_t visible_tip = file_visible_tip_;
+    size_t position = 0;
+    std::vector<uint8_t> batch;
+    size_t batch_offset = 0;
+    bool read_failed = false;
+    // Next visible record from the old file, or false at its end.
+    auto next_file_record =
+        [&](const uint8_t*& record)
+        {
+            while (true)
+            {
+                if (batch_offset == batch.size())
+                {
+                    if (position == old_file->count)
+                        return false;
+                    const size_t count = std::min(
+                        script_read_batch, old_file->count - position);
+                    batch.resize(count * script_record_size);
+                    if (pread(old_file->fd, batch.data(), batch.size(),
+                            script_file_header_size +
+                            position * script_record_size) !=
+                        static_cast<ssize_t>(batch.size()))
+                    {
+                        read_failed = true;
+                        return false;
+                    }
+                    position += count;
+                    batch_offset = 0;
+                }
+                record = batch.data() + batch_offset;
+                batch_offset += script_record_size;
+                if (snapshot_get_uint32(record + hash_digest_size) <=
+                    visible_tip)
+                    return true;
+            }
+        };
+    const uint8_t* file_record = nullptr;
+    bool file_more = next_file_record(file_record);
+    auto memory_it = memory_.begin();
+    size_t memory_offset = 0;
+    // Memory postings are all deeper than the file's, so for equal
+    // script hashes the file's go first.
+    auto next =
+        [&](uint8_t* record)
+        {
+            const bool memory_more = memory_it != memory_.end();
+            if (!file_more && !memory_more)
+                return false;
+            if (file_more && (!memory_more ||
+                memcmp(file_record, memory_it->first.data(),
+                    hash_digest_size) <= 0))
+            {
+                std::copy(file_record, file_record + script_record_size,
+                    record);
+                file_more = next_file_record(file_record);
+                return true;
+            }
+            const posting& entry = memory_it->second[memory_offset];
+            script_save_record(record, memory_it->first,
+                entry.depth, entry.outpoint);
+            if (++memory_offset == memory_it->second.size())
+            {
+                ++memory_it;
+                memory_offset = 0;
+            }
+            return true;
+        };
+    if (!write_posting_file(path_, indexed_tip_, indexed_tip_hash_, next,
+            [&read_failed] { return !read_failed; }))
+        return false;
+    script_posting_file_ptr new_file = open_posting_file(path_);
+    if (!new_file)
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ = new_file;
+    file_visible_tip_ = new_file->tip;
+    memory_.clear();
+    return true;
+}
+
+bool script_index::read_file(const script_posting_file& file,
+    const hash_digest& key, size_t max_depth,
+    output_point_list& outpoints) const
+{
+    // Lower bound of key among the sorted records.
+    size_t low = 0, high = file.count;
+    uint8_t probe[hash_digest_size];
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        if (pread(file.fd, probe, sizeof(probe), script_file_header_size +
+                middle * script_record_size) != sizeof(probe))
+        {
+            log_error(LOG_SCRIPTS) << "Couldn't read " << path_;
+            return false;
+        }
+        if (memcmp(probe, key.data(), hash_digest_size) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    std::vector<uint8_t> batch;
+    for (size_t position = low; position < file.count; )
+    {
+        const size_t count =
+            std::min(script_read_batch, file.count - position);
+        batch.resize(count * script_record_size);
+        if (pread(file.fd, batch.data(), batch.size(),
+                script_file_header_size + position * script_record_size) !=
+            static_cast<ssize_t>(batch.size()))
+        {
+            log_error(LOG_SCRIPTS) << "Couldn't read " << path_;
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint8_t* record = batch.data() + i * script_record_size;
+            if (memcmp(record, key.data(), hash_digest_size))
+                return true;
+            if (snapshot_get_uint32(record + hash_digest_size) > max_depth)
+                continue;
+            output_point outpoint;
+            std::copy(record + script_key_size,
+                record + script_key_size + hash_digest_size,
+                outpoint.hash.begin());
+            outpoint.index = snapshot_get_uint32(
+                record + script_key_size + hash_digest_size);
+            outpoints.push_back(outpoint);
+        }
+        position += count;
+    }
+    return true;
+}
+
+bool script_index::outputs(const hash_digest& script_hash,
+    output_point_list& outpoints) const
+{
+    script_posting_file_ptr file;
+    size_t visible_tip;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file = file_;
+        visible_tip = file_visible_tip_;
+        auto found = memory_.find(script_hash);
+        if (found != memory_.end())
+            for (const posting& entry: found->second)
+                outpoints.push_back(entry.outpoint);
+    }
+    if (!file)
+        return true;
+    // File postings are older than any in memory.
+    output_point_list older;
+    if (!read_file(*file, script_hash, visible_tip, older))
+        return false;
+    outpoints.insert(outpoints.begin(), older.begin(), older.end());
+    return true;
+}
+
+script_index_target::script_index_target(const std::string& path,
+    const sync_blockchain& chain)
+  : path_(path), chain_(chain)
+{
+}
+
+std::string script_index_target::name() const
+{
+    return "scripts";
+}
+size_t script_index_target::record_size() const
+{
+    return script_record_size;
+}
+size_t script_index_target::key_size() const
+{
+    return script_key_size;
+}
+
+bool script_index_target::extract(const sync_blockchain&, size_t depth,
+    const block_type& blk, data_chunk& records)
+{
+    for (const transaction_type& tx: blk.transactions)
+    {
+        const hash_digest tx_hash = hash_transaction(tx);
+        for (uint32_t i = 0; i < tx.outputs.size(); ++i)
+        {
+            const size_t offset = records.size();
+            records.resize(offset + script_record_size);
+            script_save_record(records.data() + offset,
+                hash_script(tx.outputs[i].output_script), depth,
+                output_point{tx_hash, i});
+        }
+    }
+    return true;
+}
+
+bool script_index_target::load(const std::string& path)
+{
+    // The tip is the deepest record, found in a first pass.
+    size_t tip = 0;
+    {
+        std::ifstream file(path, std::ios::binary);
+        uint8_t record[script_record_size];
+        while (file.read(reinterpret_cast<char*>(record), sizeof(record)))
+            tip = std::max<size_t>(tip,
+                snapshot_get_uint32(record + hash_digest_size));
+        if (!file.eof())
+            return false;
+    }
+    std::error_code ec;
+    const block_type header = chain_.block_header(tip, ec);
+    if (ec)
+    {
+        log_error(LOG_SCRIPTS) << "Couldn't fetch block " << tip << ": "
+            << ec.message();
+        return false;
+    }
+    std::ifstream file(path, std::ios::binary);
+    auto next =
+        [&file](uint8_t* record)
+        {
+            return static_cast<bool>(file.read(
+                reinterpret_cast<char*>(record), script_record_size));
+        };
+    return write_posting_file(path_, tip, hash_block_header(header), next,
+        [&file] { return file.eof(); });
+}
+
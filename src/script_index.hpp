@@ -0,0 +1,104 @@
+#ifndef QUERY_SCRIPT_INDEX_HPP
+#define QUERY_SCRIPT_INDEX_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+#include "reindex.hpp"
+#include "sync_blockchain.hpp"
+
+// Key of the script index: single SHA-256 of the serialised output
+// script, without its length prefix.
+bc::hash_digest hash_script(const bc::script& output_script);
+
+// Open posting list file with its record count, tip depth and tip
+// block hash.
+struct script_posting_file;
+typedef std::shared_ptr<script_posting_file> script_posting_file_ptr;
+
+// Outputs of every block keyed by script hash, so any script can be
+// looked up, not just those with a payment address.
+//
+// Most of the index is a posting list file built by
+// "queryd --reindex scripts": fixed size records sorted by script hash
+// then depth, searched with binary search. Blocks after the file's tip
+// are held in memory until flush_blocks of them have built up, then
+// merged into a new file. A reorganization below the file's tip hides
+// the file's records above the fork and merges straight away, so the
+// file on disk only holds main chain blocks.
+class script_index
+{
+public:
+    script_index(const std::string& path, size_t flush_blocks);
+
+    // Without a file the index stays disabled, as it does when the
+    // file's tip block is no longer in the chain.
+    bool open(const sync_blockchain& chain);
+    bool enabled() const;
+    // False until catch_up() has indexed every block after the file.
+    bool ready() const;
+
+    // Indexes blocks after the last indexed one up to the chain's tip.
+    bool catch_up(const sync_blockchain& chain, std::error_code& ec);
+    // Runs on one thread at a time, like catch_up().
+    void reorganize(size_t fork_point,
+        const bc::blockchain::block_list& new_blocks);
+
+    // Outputs paying to the script, in ascending depth. False when the
+    // file couldn't be read.
+    bool outputs(const bc::hash_digest& script_hash,
+        bc::output_point_list& outpoints) const;
+
+private:
+    struct posting
+    {
+        bc::output_point outpoint;
+        size_t depth;
+    };
+    typedef std::vector<posting> posting_list;
+
+    void add_block(const bc::block_type& blk, size_t depth);
+    bool read_file(const script_posting_file& file, const bc::hash_digest& key,
+        size_t max_depth, bc::output_point_list& outpoints) const;
+    // Writes the file and memory records into a new file and swaps it in.
+    bool flush();
+
+    const std::string path_;
+    const size_t flush_blocks_;
+    mutable std::mutex mutex_;
+    script_posting_file_ptr file_;
+    // File records deeper than this belong to replaced blocks.
+    size_t file_visible_tip_ = 0;
+    std::map<bc::hash_digest, posting_list> memory_;
+    size_t indexed_tip_ = 0;
+    bc::hash_digest indexed_tip_hash_ = bc::null_hash;
+    bool ready_ = false;
+};
+
+// Rebuilds the posting list file through reindex(). Records are
+// [32 bytes script hash] [4 bytes depth] [32 bytes tx hash]
+// [4 bytes output index] with numbers big endian, keyed on the
+// first 36 bytes so each script's outputs stay in depth order.
+class script_index_target
+  : public reindex_target
+{
+public:
+    // chain gives the hash of the tip block for the file header.
+    script_index_target(const std::string& path, const sync_blockchain& chain);
+
+    std::string name() const;
+    size_t record_size() const;
+    size_t key_size() const;
+    bool extract(const sync_blockchain& chain, size_t depth,
+        const bc::block_type& blk, bc::data_chunk& records);
+    bool load(const std::string& path);
+
+private:
+    const std::string path_;
+    const sync_blockchain chain_;
+};
+
+#endif
+
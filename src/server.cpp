@@ -0,0 +1,427 @@
+#include "server.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <set>
+#include <thread>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PosixThreadFactory.h>
+#include <thrift/server/TThreadPoolServer.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TTransportUtils.h>
+
+#include "compressed_transport.hpp"
+#include "echo.hpp"
+#include "request_trace.hpp"
+#include "thrift_factories.hpp"
+
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::server;
+using namespace bc;
+
+void server_control::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = true;
+    wakeup_.notify_all();
+}
+
+void server_control::reload()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    reload_requested_ = true;
+    wakeup_.notify_all();
+}
+
+server_control::event server_control::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    wakeup_.wait(lock,
+        [this] { return stop_requested_ || reload_requested_; });
+    if (stop_requested_)
+        return event::stop;
+    reload_requested_ = false;
+    return event::reload;
+}
+
+void server_signal_set(sigset_t& signals)
+{
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+}
+
+// The running server's control, or null outside run_thrift_server.
+std::mutex signal_target_mutex;
+server_control* signal_target = nullptr;
+
+// Runs for the life of the process. Without a server there's nothing
+// to drain, so SIGINT and SIGTERM end the process as they would if
+// unblocked, and SIGHUP is ignored.
+void watch_server_signals()
+{
+    sigset_t signals;
+    server_signal_set(signals);
+    int signal = 0;
+    while (sigwait(&signals, &signal) == 0)
+    {
+        std::lock_guard<std::mutex> lock(signal_target_mutex);
+        if (signal_target && signal == SIGHUP)
+            signal_target->reload();
+        else if (signal_target)
+            signal_target->stop();
+        else if (signal != SIGHUP)
+        {
+            echo() << "Interrupted, exiting.";
+            std::_Exit(1);
+        }
+    }
+}
+
+void block_server_signals()
+{
+    sigset_t signals;
+    server_signal_set(signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread(watch_server_signals).detach();
+}
+
+void set_signal_target(server_control* control)
+{
+    std::lock_guard<std::mutex> lock(signal_target_mutex);
+    signal_target = control;
+}
+
+// Counts requests in flight so shutdown can wait for them. Once
+// draining, connections close after their current request and new
+// requests are turned away, which clients see as a closed connection.
+class draining_processor
+  : public TProcessor
+{
+public:
+    draining_processor(boost::shared_ptr<TProcessor> processor)
+      : processor_(processor)
+    {
+    }
+
+    bool process(boost::shared_ptr<TProtocol> in,
+        boost::shared_ptr<TProtocol> out, void* connection_context)
+    {
+        // Waits out an idle connection before counting it, so drain()
+        // doesn't wait on clients that have nothing to send.
+        if (!in->getTransport()->peek())
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (draining_)
+                return false;
+            ++in_flight_;
+        }
+        bool keep_open = false;
+        try
+        {
+            keep_open = processor_->process(in, out, connection_context);
+        }
+        catch (...)
+        {
+            finish_request();
+            throw;
+        }
+        return finish_request() && keep_open;
+    }
+
+    // Returns the number of requests still running after timeout.
+    size_t drain(std::chrono::seconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        draining_ = true;
+        drained_.wait_for(lock, timeout, [this] { return in_flight_ == 0; });
+        return in_flight_;
+    }
+
+private:
+    // False once draining.
+    bool finish_request()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--in_flight_ == 0 && draining_)
+            drained_.notify_all();
+        return !draining_;
+    }
+
+    boost::shared_ptr<TProcessor> processor_;
+    std::mutex mutex_;
+    std::condition_variable drained_;
+    size_t in_flight_ = 0;
+    bool draining_ = false;
+};
+
+thread_local std::vector<std::function<void ()>> connection_close_hooks;
+
+void on_connection_close(std::function<void ()> cleanup)
+{
+    connection_close_hooks.push_back(cleanup);
+}
+
+// Runs the close hooks of the thread a connection ran on, passing every
+// event on to the inner handler when there is one.
+class connection_events
+  : public TServerEventHandler
+{
+public:
+    connection_events(boost::shared_ptr<TServerEventHandler> inner)
+      : inner_(inner)
+    {
+    }
+
+    void preServe()
+    {
+        if (inner_)
+            inner_->preServe();
+    }
+    void* createContext(boost::shared_ptr<TProtocol> input,
+        boost::shared_ptr<TProtocol> output)
+    {
+        return inner_ ? inner_->createContext(input, output) : nullptr;
+    }
+    void deleteContext(void* server_context,
+        boost::shared_ptr<TProtocol> input,
+        boost::shared_ptr<TProtocol> output)
+    {
+        if (inner_)
+            inner_->deleteContext(server_context, input, output);
+        std::vector<std::function<void ()>> hooks;
+        hooks.swap(connection_close_hooks);
+        for (const auto& cleanup: hooks)
+            cleanup();
+    }
+    void processContext(void* server_context,
+        boost::shared_ptr<TTransport> transport)
+    {
+        if (inner_)
+            inner_->processContext(server_context, transport);
+    }
+
+private:
+    boost::shared_ptr<TServerEventHandler> inner_;
+};
+
+typedef boost::shared_ptr<TThreadPoolServer> server_ptr;
+
+// Leaves anything but a socket alone, in case unix-socket names a
+// regular file by mistake.
+void remove_socket_file(const std::string& path)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) == -1)
+        return;
+    if (!S_ISSOCK(info.st_mode))
+    {
+        log_warning() << "Not removing " << path << ", it isn't a socket";
+        return;
+    }
+    unlink(path.c_str());
+}
+
+// A listener's server and its worker pool, which reloads resize.
+struct listener_type
+{
+    std::string prefix;
+    server_ptr server;
+    boost::shared_ptr<ThreadManager> workers;
+    size_t worker_count;
+};
+
+// Each listener reads <prefix>-protocol, <prefix>-transport and
+// <prefix>-threads so the TCP and unix socket listeners can be tuned
+// separately. Each connection holds a worker until it closes.
+listener_type make_listener(config_map_type& config,
+    const std::string& prefix, boost::shared_ptr<TProcessor> processor,
+    boost::shared_ptr<TServerTransport> server_transport, bool timed)
+{
+    listener_type listener{prefix, nullptr, nullptr, 0};
+    const std::string protocol_key = prefix + "-protocol";
+    boost::shared_ptr<TProtocolFactory> protocol_factory =
+        make_protocol_factory(config[protocol_key]);
+    if (!protocol_factory)
+    {
+        log_error() << "Unknown " << protocol_key << ": "
+            << config[protocol_key];
+        return listener;
+    }
+    const std::string transport_key = prefix + "-transport";
+    boost::shared_ptr<TTransportFactory> transport_factory =
+        make_transport_factory(config[transport_key],
+            boost::lexical_cast<size_t>(config["compression-threshold"]),
+            boost::lexical_cast<size_t>(config["compression-max-frame"]));
+    if (!transport_factory)
+    {
+        log_error() << "Unknown " << transport_key << ": "
+            << config[transport_key];
+        return listener;
+    }
+
+    listener.worker_count =
+        boost::lexical_cast<size_t>(config[prefix + "-threads"]);
+    listener.workers =
+        ThreadManager::newSimpleThreadManager(listener.worker_count);
+    boost::shared_ptr<PosixThreadFactory> thread_factory =
+        boost::shared_ptr<PosixThreadFactory>(new PosixThreadFactory());
+    listener.workers->threadFactory(thread_factory);
+    listener.workers->start();
+    boost::shared_ptr<queue_timer> timer;
+    if (timed)
+    {
+        timer.reset(new queue_timer(transport_factory));
+        transport_factory = timer;
+    }
+    listener.server.reset(new TThreadPoolServer(processor, server_transport,
+        transport_factory, protocol_factory, listener.workers));
+    listener.server->setServerEventHandler(
+        boost::shared_ptr<TServerEventHandler>(new connection_events(timer)));
+    return listener;
+}
+
+// Added workers start at once. A removed worker only exits once its
+// connection closes, so shrinking waits on a thread of its own.
+void resize_workers(listener_type& listener, size_t count)
+{
+    if (count == 0 || count == listener.worker_count)
+        return;
+    echo() << "Resizing " << listener.prefix << " workers from "
+        << listener.worker_count << " to " << count;
+    boost::shared_ptr<ThreadManager> workers = listener.workers;
+    if (count > listener.worker_count)
+        workers->addWorker(count - listener.worker_count);
+    else
+    {
+        const size_t surplus = listener.worker_count - count;
+        std::thread([workers, surplus] { workers->removeWorker(surplus); })
+            .detach();
+    }
+    listener.worker_count = count;
+}
+
+// Settings that run_thrift_server or a reload_function apply live.
+const std::set<std::string> reloadable_settings{
+    "service-threads", "unix-socket-threads", "slow-query-threshold",
+    "drain-timeout", "log-level", "merkle-cache-size",
+    "mempool-value-cache-size", "trace-max-nodes", "blocks-read-ahead",
+    "blocks-raw-max-bytes", "time-range-max-headers", "block-stats-max-rows",
+    "router-hedge-delay", "router-poll-interval"};
+
+void report_restart_settings(config_map_type& running,
+    config_map_type& fresh)
+{
+    for (const auto& setting: fresh)
+        if (!reloadable_settings.count(setting.first) &&
+            running[setting.first] != setting.second)
+            log_warning() << setting.first
+                << " changed, restart to apply it";
+}
+
+void run_thrift_server(config_map_type& config,
+    boost::shared_ptr<QueryServiceIf> handler, server_control& control,
+    reload_function reload)
+{
+    boost::shared_ptr<TProcessor> service_processor(
+        new QueryServiceProcessor(handler));
+    boost::shared_ptr<slow_query_log> slow_queries =
+        slow_query_log::create(config);
+    if (slow_queries)
+        service_processor->setEventHandler(slow_queries);
+    boost::shared_ptr<draining_processor> processor(
+        new draining_processor(service_processor));
+    const bool timed = slow_queries != nullptr;
+
+    std::vector<listener_type> listeners;
+    boost::shared_ptr<TServerTransport> tcp_transport(
+        new TServerSocket(
+            boost::lexical_cast<size_t>(config["service-port"])));
+    listeners.push_back(make_listener(
+        config, "service", processor, tcp_transport, timed));
+    // Co-located clients can skip the TCP loopback stack.
+    const std::string unix_path = config["unix-socket"];
+    if (!unix_path.empty())
+    {
+        // Remove a stale socket left behind by an unclean shutdown.
+        remove_socket_file(unix_path);
+        boost::shared_ptr<TServerTransport> unix_transport(
+            new TServerSocket(unix_path));
+        listeners.push_back(make_listener(
+            config, "unix-socket", processor, unix_transport, timed));
+    }
+    for (const listener_type& listener: listeners)
+        if (!listener.server)
+        {
+            log_error() << "Server not started, check the "
+                << listener.prefix << " settings";
+            return;
+        }
+
+    echo() << "Starting server...";
+    for (const listener_type& listener: listeners)
+    {
+        server_ptr server = listener.server;
+        std::thread t([server] { server->serve(); });
+        t.detach();
+    }
+    set_signal_target(&control);
+    std::chrono::seconds drain_timeout(
+        boost::lexical_cast<size_t>(config["drain-timeout"]));
+    while (control.wait() == server_control::event::reload)
+    {
+        config_map_type fresh;
+        if (!load_config(fresh, config["config-file"]))
+        {
+            log_error() << "Couldn't reload " << config["config-file"]
+                << ", keeping the current settings";
+            continue;
+        }
+        echo() << "Reloading " << config["config-file"];
+        report_restart_settings(config, fresh);
+        for (listener_type& listener: listeners)
+            resize_workers(listener, boost::lexical_cast<size_t>(
+                fresh[listener.prefix + "-threads"]));
+        const auto threshold =
+            boost::lexical_cast<size_t>(fresh["slow-query-threshold"]);
+        if (slow_queries)
+            slow_queries->set_threshold(std::chrono::milliseconds(threshold));
+        else if (threshold != 0)
+            log_warning() << "Slow query log was off at start, "
+                "restart to turn it on";
+        drain_timeout = std::chrono::seconds(
+            boost::lexical_cast<size_t>(fresh["drain-timeout"]));
+        reload(fresh);
+        // The rest only change on restart, so keep warning about them.
+        for (const std::string& setting: reloadable_settings)
+            config[setting] = fresh[setting];
+    }
+    // Stop accepting first, so no new connections queue up while
+    // the ones in flight drain.
+    for (const listener_type& listener: listeners)
+        listener.server->stop();
+    echo() << "Draining requests...";
+    const size_t cut_off = processor->drain(drain_timeout);
+    if (cut_off)
+        log_warning() << cut_off << " requests still running after "
+            << drain_timeout.count() << "s drain timeout";
+    set_signal_target(nullptr);
+    if (!unix_path.empty())
+        remove_socket_file(unix_path);
+    if (transport_stats.raw_bytes)
+        echo() << "Compressed transport: "
+            << transport_stats.raw_bytes << " bytes raw, "
+            << transport_stats.wire_bytes << " bytes on wire, "
+            << transport_stats.compressed_frames << " frames compressed in "
+            << transport_stats.compress_microseconds << " us.";
+}
+
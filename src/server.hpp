@@ -0,0 +1,55 @@
+#ifndef QUERY_SERVER_HPP
+#define QUERY_SERVER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <boost/shared_ptr.hpp>
+
+#include "thrift/QueryService.h"
+#include "config.hpp"
+
+// Stop and reload requests for a running server, made by the stop()
+// method or by signals.
+class server_control
+{
+public:
+    enum class event { stop, reload };
+
+    void stop();
+    void reload();
+    // Blocks until stop() or reload() is called. A stop wins over a
+    // pending reload.
+    event wait();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stop_requested_ = false, reload_requested_ = false;
+};
+
+// Blocks SIGHUP, SIGINT and SIGTERM in the calling thread and the
+// threads it starts afterwards, and starts a thread that takes them for
+// run_thrift_server. Outside of it SIGINT and SIGTERM exit at once, so
+// a slow startup can still be interrupted. Call before starting any
+// threads.
+void block_server_signals();
+
+// Runs cleanup on this server thread once its connection closes, for
+// per connection state kept in thread locals.
+void on_connection_close(std::function<void ()> cleanup);
+
+// Applies the reloadable settings of a freshly loaded config.
+typedef std::function<void (config_map_type&)> reload_function;
+
+// Serves handler on every configured listener until control is stopped,
+// or SIGINT or SIGTERM arrive. SIGHUP rereads the config file, resizes
+// the worker pools and passes the new config to reload. On stop the
+// listeners close and requests in flight get drain-timeout seconds to
+// finish before this returns.
+void run_thrift_server(config_map_type& config,
+    boost::shared_ptr<QueryServiceIf> handler, server_control& control,
+    reload_function reload);
+
+#endif
+
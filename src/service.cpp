@@ -1,50 +1,60 @@
 #include "service.hpp"
 
 #include <boost/lexical_cast.hpp>
-#include <thrift/concurrency/ThreadManager.h>
-#include <thrift/concurrency/PosixThreadFactory.h>
-#include <thrift/protocol/TBinaryProtocol.h>
-#include <thrift/server/TSimpleServer.h>
-#include <thrift/server/TThreadPoolServer.h>
-#include <thrift/server/TThreadedServer.h>
-#include <thrift/transport/TServerSocket.h>
-#include <thrift/transport/TTransportUtils.h>
 
+#include "block_prefetch.hpp"
 #include "echo.hpp"
+#include "request_arena.hpp"
+#include "request_trace.hpp"
+#include "server.hpp"
+#include "sync_get_impl.hpp"
+#include "thriftify.hpp"
+#include "transaction_batch.hpp"
 
-using namespace apache::thrift;
-using namespace apache::thrift::concurrency;
-using namespace apache::thrift::protocol;
-using namespace apache::thrift::transport;
-using namespace apache::thrift::server;
 using namespace bc;
-
-template <typename T>
-std::string to_binary(const T& bytes)
-{
-    std::string binary;
-    extend_data(binary, bytes);
-    return binary;
-}
+using std::placeholders::_1;
+using std::placeholders::_2;
 
 query_service_handler::query_service_handler(
-    config_map_type& config, node_impl& node)
-  : stop_secret_(config["stop-secret"].c_str()),
+    config_map_type& config, node_impl& node, server_control& control)
+  : node_(node),
     chain_(node.blockchain()),
+    async_chain_(node.blockchain()),
     txpool_(node.transaction_pool()),
-    protocol_(node.protocol())
-{
-}
-
-bool query_service_handler::stopped() const
+    protocol_(node.protocol()),
+    merkle_(node.merkle_trees()),
+    timestamps_(node.timestamps()),
+    stats_(node.block_stats()),
+    scripts_(node.scripts()),
+    recent_(node.history_window()),
+    mempool_(node.mempool()),
+    control_(control),
+    stop_secret_(config["stop-secret"].c_str()),
+    trace_max_nodes_(
+        boost::lexical_cast<size_t>(config["trace-max-nodes"])),
+    blocks_read_ahead_(
+        boost::lexical_cast<size_t>(config["blocks-read-ahead"])),
+    blocks_raw_max_bytes_(
+        boost::lexical_cast<size_t>(config["blocks-raw-max-bytes"])),
+    time_range_max_headers_(
+        boost::lexical_cast<size_t>(config["time-range-max-headers"])),
+    block_stats_max_rows_(
+        boost::lexical_cast<size_t>(config["block-stats-max-rows"]))
 {
-    return stopped_;
 }
 
-void query_service_handler::wait()
+void query_service_handler::reload(config_map_type& config)
 {
-    while (!stopped_)
-        sleep(1);
+    trace_max_nodes_ =
+        boost::lexical_cast<size_t>(config["trace-max-nodes"]);
+    blocks_read_ahead_ =
+        boost::lexical_cast<size_t>(config["blocks-read-ahead"]);
+    blocks_raw_max_bytes_ =
+        boost::lexical_cast<size_t>(config["blocks-raw-max-bytes"]);
+    time_range_max_headers_ =
+        boost::lexical_cast<size_t>(config["time-range-max-headers"]);
+    block_stats_max_rows_ =
+        boost::lexical_cast<size_t>(config["block-stats-max-rows"]);
 }
 
 bool query_service_handler::stop(const std::string& secret)
@@ -52,21 +62,10 @@ bool query_service_handler::stop(const std::string& secret)
     if (secret != stop_secret_)
         return false;
     echo() << "Stopping server...";
-    stopped_ = true;
+    control_.stop();
     return true;
 }
 
-void check_errc(const std::error_code& ec)
-{
-    if (ec)
-    {
-        ErrorCode except;
-        except.what = 0;
-        except.why = ec.message();
-        throw except;
-    }
-}
-
 template<typename IndexType>
 void block_header_impl(sync_blockchain& chain,
     BlockHeader& blk, IndexType index)
@@ -74,37 +73,21 @@ void block_header_impl(sync_blockchain& chain,
     std::error_code ec;
     auto b = chain.block_header(index, ec);
     check_errc(ec);
-    blk.version = b.version;
-    blk.timestamp = b.timestamp;
-    blk.previous_block_hash = to_binary(b.previous_block_hash);
-    blk.merkle = to_binary(b.merkle);
-    blk.bits = b.bits;
-    blk.nonce = b.nonce;
+    trace_stage stage("thriftify");
+    thriftify_header(blk, b);
 }
 
 void query_service_handler::block_header_by_depth(
     BlockHeader& blk, const int32_t depth)
 {
+    trace_argument<int64_t>(depth);
     block_header_impl(chain_, blk, depth);
 }
 
-hash_digest proper_hash(const std::string& hash_str)
-{
-    hash_digest hash;
-    if (hash_str.size() != hash.size())
-    {
-        ErrorCode except;
-        except.what = 0;
-        except.why = "Invalid hash";
-        throw except;
-    }
-    std::copy(hash_str.begin(), hash_str.end(), hash.begin());
-    return hash;
-}
-
 void query_service_handler::block_header_by_hash(
     BlockHeader& blk, const std::string& hash)
 {
+    trace_binary_argument(hash);
     block_header_impl(chain_, blk, proper_hash(hash));
 }
 
@@ -115,11 +98,7 @@ void block_tx_hashes_impl(
     std::error_code ec;
     auto txs = chain.block_transaction_hashes(index, ec);
     check_errc(ec);
-    for (const auto& inv: txs)
-    {
-        BITCOIN_ASSERT(inv.type == inventory_type_id::transaction);
-        tx_hashes.push_back(to_binary(inv.hash));
-    }
+    thriftify_tx_hashes(tx_hashes, txs);
 }
 
 void query_service_handler::block_transaction_hashes_by_depth(
@@ -150,40 +129,40 @@ int32_t query_service_handler::last_depth()
     return depth;
 }
 
-void thriftify_transaction(Transaction& tx, const transaction_type& tmp_tx)
+int32_t query_service_handler::depth_at_time(const int64_t timestamp)
 {
-    tx.version = tmp_tx.version;
-    tx.locktime = tmp_tx.locktime;
-    for (const auto& tx_input: tmp_tx.inputs)
-    {
-        TransactionInput in;
-        in.previous_output.hash = to_binary(tx_input.previous_output.hash);
-        in.previous_output.index = tx_input.previous_output.index;
-        in.input_script = to_binary(save_script(tx_input.input_script));
-        in.sequence = tx_input.sequence;
-        tx.inputs.push_back(in);
-    }
-    for (const auto& tx_output: tmp_tx.outputs)
-    {
-        TransactionOutput out;
-        out.value = tx_output.value;
-        out.output_script = to_binary(save_script(tx_output.output_script));
-        tx.outputs.push_back(out);
-    }
+    if (!valid_timestamp(timestamp))
+        throw_error("Invalid timestamp");
+    std::error_code ec;
+    auto depth = timestamps_.depth_at_time(timestamp, ec);
+    check_errc(ec);
+    return depth;
+}
+
+void query_service_handler::block_headers_in_time_range(
+    BlockHeaderList& headers, const int64_t from_time, const int64_t to_time)
+{
+    if (!valid_timestamp(from_time) || !valid_timestamp(to_time))
+        throw_error("Invalid timestamp");
+    thriftify_headers(headers, timestamps_.headers_in_range(
+        from_time, to_time, time_range_max_headers_));
 }
 
 void query_service_handler::transaction(
     Transaction& tx, const std::string& hash)
 {
+    trace_binary_argument(hash);
     std::error_code ec;
     const transaction_type tmp_tx = chain_.transaction(proper_hash(hash), ec);
     check_errc(ec);
+    trace_stage stage("thriftify");
     thriftify_transaction(tx, tmp_tx);
 }
 
 void query_service_handler::transaction_index(
     TransactionIndex& tx_index, const std::string& hash)
 {
+    trace_binary_argument(hash);
     std::error_code ec;
     auto tidx = chain_.transaction_index(proper_hash(hash), ec);
     check_errc(ec);
@@ -195,9 +174,7 @@ void query_service_handler::spend(
     InputPoint& inpoint, const OutputPoint& outpoint)
 {
     std::error_code ec;
-    output_point out{
-        proper_hash(outpoint.hash), (uint32_t)outpoint.index};
-    auto ipt = chain_.spend(out, ec);
+    auto ipt = chain_.spend(proper_outpoint(outpoint), ec);
     check_errc(ec);
     inpoint.hash = to_binary(ipt.hash);
     inpoint.index = ipt.index;
@@ -206,58 +183,188 @@ void query_service_handler::spend(
 void query_service_handler::outputs(
     OutputPointList& outpoints, const std::string& address)
 {
+    trace_argument(address);
     std::error_code ec;
     auto outs = chain_.outputs(address, ec);
     check_errc(ec);
-    for (const auto& out: outs)
-    {
-        OutputPoint outpoint;
-        outpoint.hash = to_binary(out.hash);
-        outpoint.index = out.index;
-        outpoints.push_back(outpoint);
-    }
+    trace_stage stage("thriftify");
+    thriftify_outpoints(outpoints, outs);
 }
 
 void query_service_handler::history(
     History& history, const std::string& address)
 {
+    trace_argument(address);
     std::error_code ec;
     history_t hist = chain_.history(address, ec);
     check_errc(ec);
-    for (const output_point& outp: hist.outpoints)
-    {
-        OutputPoint outpoint;
-        outpoint.hash = to_binary(outp.hash);
-        outpoint.index = outp.index;
-        history.outpoints.push_back(outpoint);
-    }
-    for (const input_point& inp: hist.inpoints)
+    trace_stage stage("thriftify");
+    thriftify_history(history, hist);
+}
+
+output_point_list script_outputs(
+    const script_index& scripts, const std::string& script_hash)
+{
+    if (!scripts.enabled())
+        throw_error("No script index, run queryd --reindex scripts");
+    if (!scripts.ready())
+        throw_error("Script index is catching up");
+    output_point_list outpoints;
+    if (!scripts.outputs(proper_hash(script_hash), outpoints))
+        throw_error("Couldn't read the script index");
+    return outpoints;
+}
+
+void query_service_handler::outputs_by_script(
+    OutputPointList& outpoints, const std::string& script_hash)
+{
+    trace_binary_argument(script_hash);
+    auto outs = script_outputs(scripts_, script_hash);
+    trace_stage stage("thriftify");
+    thriftify_outpoints(outpoints, outs);
+}
+
+void query_service_handler::history_by_script(
+    History& history, const std::string& script_hash)
+{
+    trace_binary_argument(script_hash);
+    history_t hist;
+    hist.outpoints = script_outputs(scripts_, script_hash);
+    auto spends = sync_fetch_all<input_point>(
+        std::bind(&blockchain::fetch_spend, &async_chain_, _1, _2),
+        hist.outpoints);
+    // Unspent outputs get a null input point, same as fetch_history.
+    for (size_t i = 0; i < hist.outpoints.size(); ++i)
     {
-        InputPoint inpoint;
-        inpoint.hash = to_binary(inp.hash);
-        inpoint.index = inp.index;
-        history.inpoints.push_back(inpoint);
+        if (spends.errors[i] == error::unspent_output)
+            hist.inpoints.push_back(input_point{
+                null_hash, std::numeric_limits<uint32_t>::max()});
+        else
+        {
+            check_errc(spends.errors[i]);
+            hist.inpoints.push_back(spends.results[i]);
+        }
     }
+    trace_stage stage("thriftify");
+    thriftify_history(history, hist);
 }
 
 void query_service_handler::output_values(
     OutputValues& values, const OutputPointList& outpoints)
 {
-    output_point_list outs;
-    for (const OutputPoint& outpoint: outpoints)
-    {
-        output_point outp;
-        BITCOIN_ASSERT(outpoint.hash.size() == outp.hash.size());
-        std::copy(outpoint.hash.begin(), outpoint.hash.end(),
-            outp.hash.begin());
-        outp.index = outpoint.index;
-        outs.push_back(outp);
-    }
+    trace_argument(outpoints);
+    request_arena& arena = begin_request_arena();
+    proper_outpoints(arena.outpoints, outpoints);
+    std::error_code ec;
+    output_value_list vals = chain_.output_values(arena.outpoints, ec);
+    check_errc(ec);
+    trace_stage stage("thriftify");
+    values.assign(vals.begin(), vals.end());
+}
+
+void query_service_handler::merkle_proof(
+    MerkleProof& proof, const std::string& hash)
+{
+    trace_binary_argument(hash);
+    std::error_code ec;
+    auto branch = merkle_branch(chain_, merkle_, proper_hash(hash), ec);
+    check_errc(ec);
+    thriftify_merkle_proof(proof, branch);
+}
+
+void query_service_handler::block_stats(BlockStatsList& stats,
+    const int32_t start_depth, const int32_t count)
+{
+    if (start_depth < 0 || count < 0)
+        throw_error("Invalid range");
+    std::vector<block_stats_type> rows = stats_.read(start_depth,
+        std::min<size_t>(count, block_stats_max_rows_));
+    for (size_t i = 0; i < rows.size(); ++i)
+        if (rows[i].tx_count != 0)
+            stats.push_back(thriftify_block_stats(start_depth + i, rows[i]));
+}
+
+void query_service_handler::blocks_raw(RawBlockList& blocks,
+    const int32_t start_depth, const int32_t count)
+{
+    trace_argument<int64_t>(start_depth);
+    trace_argument<int64_t>(count);
+    if (start_depth < 0 || count < 0)
+        throw_error("Invalid range");
     std::error_code ec;
-    output_value_list vals = chain_.output_values(outs, ec);
+    if (!thread_block_prefetcher().read(async_chain_, start_depth, count,
+            blocks_read_ahead_, blocks_raw_max_bytes_, blocks, ec))
+        throw_error("Chain reorganized, rewind the scan");
     check_errc(ec);
-    for (uint64_t value: vals)
-        values.push_back(value);
+}
+
+void query_service_handler::trace_forward(TraceResult& trace,
+    const OutputPoint& outpoint,
+    const int32_t max_hops, const int32_t max_nodes)
+{
+    if (max_hops < 0 || max_nodes < 0)
+        throw_error("Invalid bounds");
+    thriftify_trace(trace, ::trace_forward(async_chain_,
+        proper_outpoint(outpoint), max_hops,
+        std::min<size_t>(max_nodes, trace_max_nodes_)));
+}
+
+void query_service_handler::trace_backward(TraceResult& trace,
+    const std::string& hash, const int32_t max_hops, const int32_t max_nodes)
+{
+    if (max_hops < 0 || max_nodes < 0)
+        throw_error("Invalid bounds");
+    thriftify_trace(trace, ::trace_backward(async_chain_,
+        proper_hash(hash), max_hops,
+        std::min<size_t>(max_nodes, trace_max_nodes_)));
+}
+
+void query_service_handler::history_since(HistoryDelta& delta,
+    const std::vector<std::string>& addresses,
+    const int32_t from_depth, const std::string& known_tip_hash)
+{
+    trace_argument(addresses);
+    trace_argument<int64_t>(from_depth);
+    if (from_depth < 0)
+        throw_error("Invalid depth");
+    std::vector<payment_address> payaddrs;
+    for (const std::string& address: addresses)
+    {
+        payment_address payaddr;
+        if (!payaddr.set_encoded(address))
+            throw_error("Invalid address");
+        payaddrs.push_back(payaddr);
+    }
+    const hash_digest known_tip = known_tip_hash.empty() ?
+        null_hash : proper_hash(known_tip_hash);
+    history_delta_t result;
+    bool tip_known = false, covered = false;
+    recent_.since(payaddrs, from_depth, known_tip, result, tip_known, covered);
+    if (!tip_known)
+    {
+        // Tips older than the window are fine while still in the chain.
+        std::error_code ec;
+        chain_.block_depth(known_tip, ec);
+        if (ec)
+            throw_error("Unknown tip hash");
+    }
+    if (!covered)
+    {
+        size_t effective_from = from_depth;
+        if (result.fork_depth >= 0)
+            effective_from = std::min<size_t>(
+                effective_from, result.fork_depth + 1);
+        std::error_code ec;
+        result.rows = fetch_history_since(
+            async_chain_, payaddrs, effective_from, ec);
+        check_errc(ec);
+    }
+    trace_stage stage("thriftify");
+    thriftify_history_rows(delta.rows, result.rows);
+    thriftify_history_rows(delta.invalidated, result.invalidated);
+    delta.fork_depth = result.fork_depth;
+    delta.tip_hash = to_binary(result.tip_hash);
+    delta.tip_depth = result.tip_depth;
 }
 
 void query_service_handler::transaction_pool_transaction(
@@ -269,6 +376,11 @@ void query_service_handler::transaction_pool_transaction(
     thriftify_transaction(tx, tmp_tx);
 }
 
+void query_service_handler::mempool_fee_histogram(FeeHistogram& histogram)
+{
+    thriftify_fee_histogram(histogram, mempool_.histogram());
+}
+
 bool query_service_handler::broadcast_transaction(const std::string& tx_data)
 {
     try
@@ -284,32 +396,54 @@ bool query_service_handler::broadcast_transaction(const std::string& tx_data)
     return true;
 }
 
+void query_service_handler::broadcast_transactions(
+    BroadcastResultList& results, const std::vector<std::string>& txs_data)
+{
+    results.resize(txs_data.size());
+    std::vector<transaction_type> txs;
+    std::vector<uint8_t> parsed;
+    parse_transactions(txs_data, txs, parsed);
+    std::vector<size_t> positions;
+    std::vector<transaction_type> valid_txs;
+    for (size_t i = 0; i < txs_data.size(); ++i)
+        if (parsed[i])
+        {
+            positions.push_back(i);
+            valid_txs.push_back(std::move(txs[i]));
+        }
+        else
+        {
+            results[i].status = BroadcastStatus::MALFORMED;
+            results[i].why = "Malformed transaction";
+        }
+    std::vector<std::error_code> errors;
+    const std::vector<transaction_type> accepted =
+        node_.store_transactions(valid_txs, errors);
+    for (size_t j = 0; j < positions.size(); ++j)
+    {
+        BroadcastResult& result = results[positions[j]];
+        if (errors[j])
+        {
+            result.status = BroadcastStatus::REJECTED;
+            result.why = errors[j].message();
+        }
+        else
+            result.status = BroadcastStatus::ACCEPTED;
+    }
+    node_.broadcast_transactions(accepted);
+}
+
 void start_thrift_server(config_map_type& config, node_impl& node)
 {
-    boost::shared_ptr<TProtocolFactory> protocol_factory(
-        new TBinaryProtocolFactory());
+    server_control control;
     boost::shared_ptr<query_service_handler> handler(
-        new query_service_handler(config, node));
-    boost::shared_ptr<TProcessor> processor(
-        new QueryServiceProcessor(handler));
-    boost::shared_ptr<TServerTransport> server_transport(
-        new TServerSocket(
-            boost::lexical_cast<size_t>(config["service-port"])));
-    boost::shared_ptr<TTransportFactory> transport_factory(
-        new TBufferedTransportFactory());
-
-    boost::shared_ptr<ThreadManager> thread_manager =
-        ThreadManager::newSimpleThreadManager(10);
-    boost::shared_ptr<PosixThreadFactory> thread_factory =
-        boost::shared_ptr<PosixThreadFactory>(new PosixThreadFactory());
-    thread_manager->threadFactory(thread_factory);
-    thread_manager->start();
-    TThreadPoolServer server(processor, server_transport,
-        transport_factory, protocol_factory, thread_manager);
-
-    echo() << "Starting server...";
-    std::thread t([&server] { server.serve(); });
-    t.detach();
-    handler->wait();
+        new query_service_handler(config, node, control));
+    auto reload =
+        [&node, handler](config_map_type& fresh)
+        {
+            handler->reload(fresh);
+            node.reload(fresh);
+        };
+    run_thrift_server(config, handler, control, reload);
 }
 
@@ -5,6 +5,7 @@
 
 #include "thrift/QueryService.h"
 #include "node_impl.hpp"
+#include "server.hpp"
 #include "sync_blockchain.hpp"
 #include "sync_transaction_pool.hpp"
 
@@ -12,11 +13,10 @@ class query_service_handler
   : public QueryServiceIf
 {
 public:
-    typedef std::function<void ()> stop_function_type;
-
-    query_service_handler(config_map_type& config, node_impl& node);
-    bool stopped() const;
-    void wait();
+    query_service_handler(config_map_type& config, node_impl& node,
+        server_control& control);
+    // Applies reloadable settings.
+    void reload(config_map_type& config);
 
     bool stop(const std::string& secret);
     // blockchain methods
@@ -28,6 +28,9 @@ public:
         HashList& tx_hashes, const std::string& hash);
     int32_t block_depth(const std::string& hash);
     int32_t last_depth();
+    int32_t depth_at_time(const int64_t timestamp);
+    void block_headers_in_time_range(BlockHeaderList& headers,
+        const int64_t from_time, const int64_t to_time);
     void transaction(Transaction& tx, const std::string& hash);
     void transaction_index(
         TransactionIndex& tx_index, const std::string& hash);
@@ -35,19 +38,49 @@ public:
     void outputs(OutputPointList& outpoints, const std::string& address);
     // blockchain (composed) methods
     void history(History& history, const std::string& address);
+    void outputs_by_script(OutputPointList& outpoints,
+        const std::string& script_hash);
+    void history_by_script(History& history, const std::string& script_hash);
     void output_values(OutputValues& values, const OutputPointList& outpoints);
+    void merkle_proof(MerkleProof& proof, const std::string& hash);
+    void block_stats(BlockStatsList& stats,
+        const int32_t start_depth, const int32_t count);
+    void blocks_raw(RawBlockList& blocks,
+        const int32_t start_depth, const int32_t count);
+    void trace_forward(TraceResult& trace, const OutputPoint& outpoint,
+        const int32_t max_hops, const int32_t max_nodes);
+    void trace_backward(TraceResult& trace, const std::string& hash,
+        const int32_t max_hops, const int32_t max_nodes);
+    void history_since(HistoryDelta& delta,
+        const std::vector<std::string>& addresses,
+        const int32_t from_depth, const std::string& known_tip_hash);
     // transaction pool methods
     void transaction_pool_transaction(
         Transaction& tx, const std::string& hash);
+    void mempool_fee_histogram(FeeHistogram& histogram);
     // protocol methods
     bool broadcast_transaction(const std::string& tx_data);
+    void broadcast_transactions(BroadcastResultList& results,
+        const std::vector<std::string>& txs_data);
 
 private:
+    node_impl& node_;
     sync_blockchain chain_;
+    bc::blockchain& async_chain_;
     sync_transaction_pool txpool_;
     bc::protocol& protocol_;
+    merkle_cache& merkle_;
+    timestamp_index& timestamps_;
+    block_stats_table& stats_;
+    script_index& scripts_;
+    recent_history& recent_;
+    mempool_stats& mempool_;
+    server_control& control_;
     const std::string stop_secret_;
-    bool stopped_ = false;
+    std::atomic<size_t> trace_max_nodes_;
+    std::atomic<size_t> blocks_read_ahead_, blocks_raw_max_bytes_;
+    std::atomic<size_t> time_range_max_headers_;
+    std::atomic<size_t> block_stats_max_rows_;
 };
 
 void start_thrift_server(config_map_type& config, node_impl& node);
@@ -0,0 +1,281 @@
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_SNAPSHOT "snapshot"
+
+using namespace bc;
+
+mapped_file::~mapped_file()
+{
+    if (data_)
+        munmap(data_, size_);
+}
+
+bool mapped_file::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        log_error(LOG_SNAPSHOT) << "Couldn't open " << path;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+    {
+        close(fd);
+        return false;
+    }
+    size_ = info.st_size;
+    // mmap refuses empty mappings; an empty column is still valid.
+    if (size_ == 0)
+    {
+        close(fd);
+        return true;
+    }
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        log_error(LOG_SNAPSHOT) << "Couldn't map " << path;
+        return false;
+    }
+    data_ = reinterpret_cast<uint8_t*>(data);
+    return true;
+}
+
+bool snapshot::open(const std::string& path)
+{
+    return headers_.open(path + "/headers") &&
+        block_hashes_.open(path + "/block_hashes") &&
+        block_txs_.open(path + "/block_txs") &&
+        tx_hashes_.open(path + "/tx_hashes") &&
+        tx_offsets_.open(path + "/tx_offsets") &&
+        tx_data_.open(path + "/tx_data") &&
+        tx_lookup_.open(path + "/tx_lookup") &&
+        spends_.open(path + "/spends") &&
+        postings_.open(path + "/postings");
+}
+
+block_type snapshot::block_header(size_t depth, std::error_code& ec) const
+{
+    if (depth >= headers_.count<uint8_t>() / snapshot_header_size)
+    {
+        ec = error::not_found;
+        return block_type();
+    }
+    return snapshot_load_header(
+        headers_.as<uint8_t>() + depth * snapshot_header_size);
+}
+block_type snapshot::block_header(const hash_digest& block_hash,
+    std::error_code& ec) const
+{
+    size_t depth = block_depth(block_hash, ec);
+    if (ec)
+        return block_type();
+    return block_header(depth, ec);
+}
+
+inventory_list snapshot::block_transaction_hashes(
+    size_t depth, std::error_code& ec) const
+{
+    inventory_list hashes;
+    // block_txs holds one more entry than there are blocks.
+    const size_t entries = block_txs_.count<uint32_t>();
+    if (entries == 0 || depth >= entries - 1)
+    {
+        ec = error::not_found;
+        return hashes;
+    }
+    const uint32_t* block_txs = block_txs_.as<uint32_t>();
+    for (uint32_t number = block_txs[depth];
+        number < block_txs[depth + 1]; ++number)
+    {
+        hashes.push_back(
+            {inventory_type_id::transaction, tx_hash(number)});
+    }
+    return hashes;
+}
+inventory_list snapshot::block_transaction_hashes(
+    const hash_digest& block_hash, std::error_code& ec) const
+{
+    size_t depth = block_depth(block_hash, ec);
+    if (ec)
+        return inventory_list();
+    return block_transaction_hashes(depth, ec);
+}
+
+size_t snapshot::block_depth(const hash_digest& block_hash,
+    std::error_code& ec) const
+{
+    uint32_t depth = 0;
+    if (!find_hash(block_hashes_, block_hash, depth))
+        ec = error::not_found;
+    return depth;
+}
+
+size_t snapshot::last_depth(std::error_code& ec) const
+{
+    size_t count = headers_.count<uint8_t>() / snapshot_header_size;
+    if (count == 0)
+    {
+        ec = error::not_found;
+        return 0;
+    }
+    return count - 1;
+}
+
+transaction_type snapshot::transaction(
+    const hash_digest& transaction_hash, std::error_code& ec) const
+{
+    uint32_t tx_number = 0;
+    if (!find_hash(tx_lookup_, transaction_hash, tx_number))
+    {
+        ec = error::not_found;
+        return transaction_type();
+    }
+    return load_transaction(tx_number);
+}
+
+transaction_index_t snapshot::transaction_index(
+    const hash_digest& transaction_hash, std::error_code& ec) const
+{
+    uint32_t tx_number = 0;
+    if (!find_hash(tx_lookup_, transaction_hash, tx_number))
+    {
+        ec = error::not_found;
+        return transaction_index_t{0, 0};
+    }
+    size_t depth = tx_depth(tx_number);
+    return transaction_index_t{
+        depth, tx_number - block_txs_.as<uint32_t>()[depth]};
+}
+
+input_point snapshot::spend(
+    const output_point& outpoint, std::error_code& ec) const
+{
+    snapshot_spend_record key;
+    std::copy(outpoint.hash.begin(), outpoint.hash.end(), key.hash);
+    snapshot_set_uint32(key.index, outpoint.index);
+    const snapshot_spend_record* begin = spends_.as<snapshot_spend_record>();
+    const snapshot_spend_record* end =
+        begin + spends_.count<snapshot_spend_record>();
+    auto less = snapshot_key_less<
+        snapshot_spend_record, snapshot_spend_key_size>;
+    auto it = std::lower_bound(begin, end, key, less);
+    if (it == end || less(key, *it))
+    {
+        ec = error::unspent_output;
+        return input_point();
+    }
+    return input_point{tx_hash(snapshot_get_uint32(it->spend_tx)),
+        snapshot_get_uint32(it->spend_index)};
+}
+
+output_point_list snapshot::outputs(
+    const payment_address& address, std::error_code& ec) const
+{
+    snapshot_posting_record key;
+    key.version = address.version();
+    const short_hash& address_hash = address.hash();
+    std::copy(address_hash.begin(), address_hash.end(), key.hash);
+    const snapshot_posting_record* begin =
+        postings_.as<snapshot_posting_record>();
+    const snapshot_posting_record* end =
+        begin + postings_.count<snapshot_posting_record>();
+    auto range = std::equal_range(begin, end, key,
+        snapshot_key_less<
+            snapshot_posting_record, snapshot_address_key_size>);
+    output_point_list outs;
+    for (auto it = range.first; it != range.second; ++it)
+        outs.push_back(output_point{
+            tx_hash(snapshot_get_uint32(it->tx)),
+            snapshot_get_uint32(it->index)});
+    return outs;
+}
+
+history_t snapshot::history(
+    const payment_address& address, std::error_code& ec) const
+{
+    history_t history;
+    history.outpoints = outputs(address, ec);
+    if (ec)
+        return history;
+    // Unspent outputs get a null input point, same as fetch_history.
+    for (const output_point& outpoint: history.outpoints)
+    {
+        std::error_code spend_ec;
+        input_point inpoint = spend(outpoint, spend_ec);
+        if (spend_ec)
+            inpoint = input_point{
+                null_hash, std::numeric_limits<uint32_t>::max()};
+        history.inpoints.push_back(inpoint);
+    }
+    return history;
+}
+
+output_value_list snapshot::output_values(
+    const output_point_list& outpoints, std::error_code& ec) const
+{
+    output_value_list values;
+    for (const output_point& outpoint: outpoints)
+    {
+        const transaction_type tx = transaction(outpoint.hash, ec);
+        if (ec)
+            return output_value_list();
+        if (outpoint.index >= tx.outputs.size())
+        {
+            ec = error::not_found;
+            return output_value_list();
+        }
+        values.push_back(tx.outputs[outpoint.index].value);
+    }
+    return values;
+}
+
+bool snapshot::find_hash(const mapped_file& file,
+    const hash_digest& hash, uint32_t& number) const
+{
+    snapshot_hash_record key;
+    std::copy(hash.begin(), hash.end(), key.hash);
+    const snapshot_hash_record* begin = file.as<snapshot_hash_record>();
+    const snapshot_hash_record* end =
+        begin + file.count<snapshot_hash_record>();
+    auto less = snapshot_key_less<
+        snapshot_hash_record, snapshot_hash_key_size>;
+    auto it = std::lower_bound(begin, end, key, less);
+    if (it == end || less(key, *it))
+        return false;
+    number = snapshot_get_uint32(it->number);
+    return true;
+}
+
+transaction_type snapshot::load_transaction(uint32_t tx_number) const
+{
+    const uint64_t* offsets = tx_offsets_.as<uint64_t>();
+    const uint8_t* data = tx_data_.as<uint8_t>();
+    transaction_type tx;
+    satoshi_load(data + offsets[tx_number], data + offsets[tx_number + 1], tx);
+    return tx;
+}
+
+hash_digest snapshot::tx_hash(uint32_t tx_number) const
+{
+    hash_digest hash;
+    const uint8_t* data = tx_hashes_.as<uint8_t>() + tx_number * hash.size();
+    std::copy(data, data + hash.size(), hash.begin());
+    return hash;
+}
+
+size_t snapshot::tx_depth(uint32_t tx_number) const
+{
+    const uint32_t* begin = block_txs_.as<uint32_t>();
+    const uint32_t* end = begin + block_txs_.count<uint32_t>();
+    // block_txs holds the first tx number of each block, so the block
+    // containing tx_number is the last entry not greater than it.
+    return std::upper_bound(begin, end, tx_number) - begin - 1;
+}
+
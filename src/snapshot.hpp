@@ -0,0 +1,85 @@
+#ifndef QUERY_SNAPSHOT_HPP
+#define QUERY_SNAPSHOT_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+#include "snapshot_format.hpp"
+#include "sync_blockchain.hpp"
+
+// Read-only memory map of a single snapshot column.
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    void operator=(const mapped_file&) = delete;
+    ~mapped_file();
+
+    bool open(const std::string& path);
+
+    template <typename T>
+    const T* as() const
+    {
+        return reinterpret_cast<const T*>(data_);
+    }
+    template <typename T>
+    size_t count() const
+    {
+        return size_ / sizeof(T);
+    }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Answers the read-only blockchain queries from an exported snapshot.
+// Mirrors the sync_blockchain interface. Many processes can map the
+// same snapshot since nothing is ever written.
+class snapshot
+{
+public:
+    bool open(const std::string& path);
+
+    bc::block_type block_header(size_t depth, std::error_code& ec) const;
+    bc::block_type block_header(const bc::hash_digest& block_hash,
+        std::error_code& ec) const;
+
+    bc::inventory_list block_transaction_hashes(
+        size_t depth, std::error_code& ec) const;
+    bc::inventory_list block_transaction_hashes(
+        const bc::hash_digest& block_hash, std::error_code& ec) const;
+
+    size_t block_depth(const bc::hash_digest& block_hash,
+        std::error_code& ec) const;
+    size_t last_depth(std::error_code& ec) const;
+
+    bc::transaction_type transaction(
+        const bc::hash_digest& transaction_hash, std::error_code& ec) const;
+    transaction_index_t transaction_index(
+        const bc::hash_digest& transaction_hash, std::error_code& ec) const;
+
+    bc::input_point spend(
+        const bc::output_point& outpoint, std::error_code& ec) const;
+    bc::output_point_list outputs(
+        const bc::payment_address& address, std::error_code& ec) const;
+
+    history_t history(
+        const bc::payment_address& address, std::error_code& ec) const;
+    bc::output_value_list output_values(
+        const bc::output_point_list& outpoints, std::error_code& ec) const;
+
+private:
+    bool find_hash(const mapped_file& file,
+        const bc::hash_digest& hash, uint32_t& number) const;
+    bc::transaction_type load_transaction(uint32_t tx_number) const;
+    bc::hash_digest tx_hash(uint32_t tx_number) const;
+    size_t tx_depth(uint32_t tx_number) const;
+
+    mapped_file headers_, block_hashes_, block_txs_;
+    mapped_file tx_hashes_, tx_offsets_, tx_data_, tx_lookup_;
+    mapped_file spends_, postings_;
+};
+
+#endif
+
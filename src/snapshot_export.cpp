@@ -0,0 +1,190 @@
+#include "snapshot_export.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "echo.hpp"
+#include "reindex.hpp"
+#include "snapshot_format.hpp"
+
+#define LOG_SNAPSHOT "snapshot"
+
+using namespace bc;
+
+template <typename T>
+void write_value(std::ofstream& file, const T& value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Records buffered per sorted run before spilling it to disk.
+constexpr size_t snapshot_run_bytes = 64 * 1000 * 1000;
+
+// Sorted column built like a reindex: records are spilled as sorted
+// runs next to the column and merged at the end, so memory stays flat
+// however long the chain is.
+template <typename Record, size_t KeySize>
+class sorted_column
+{
+public:
+    sorted_column(const std::string& path)
+      : path_(path)
+    {
+    }
+
+    bool add(const Record& record)
+    {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(&record);
+        buffer_.insert(buffer_.end(), data, data + sizeof(Record));
+        return buffer_.size() < snapshot_run_bytes || spill();
+    }
+
+    bool finish()
+    {
+        // Small columns never touch the disk twice.
+        if (runs_.empty())
+            return write_run(path_, buffer_, sizeof(Record), KeySize);
+        if (!buffer_.empty() && !spill())
+            return false;
+        const bool success =
+            merge_runs(runs_, path_, sizeof(Record), KeySize);
+        for (const std::string& run: runs_)
+            std::remove(run.c_str());
+        return success;
+    }
+
+private:
+    bool spill()
+    {
+        runs_.push_back(path_ + ".run-" + std::to_string(runs_.size()));
+        if (!write_run(runs_.back(), buffer_, sizeof(Record), KeySize))
+        {
+            log_error(LOG_SNAPSHOT) << "Couldn't write " << runs_.back();
+            return false;
+        }
+        buffer_.clear();
+        return true;
+    }
+
+    const std::string path_;
+    data_chunk buffer_;
+    std::vector<std::string> runs_;
+};
+
+snapshot_hash_record make_hash_record(const hash_digest& hash, uint32_t number)
+{
+    snapshot_hash_record record;
+    std::copy(hash.begin(), hash.end(), record.hash);
+    snapshot_set_uint32(record.number, number);
+    return record;
+}
+
+bool export_snapshot(sync_blockchain& chain, const std::string& path)
+{
+    std::error_code ec;
+    const size_t last_depth = chain.last_depth(ec);
+    if (ec)
+    {
+        log_error(LOG_SNAPSHOT) << "Couldn't fetch last depth: "
+            << ec.message();
+        return false;
+    }
+    mkdir(path.c_str(), 0755);
+    std::ofstream headers(path + "/headers", std::ios::binary),
+        block_txs(path + "/block_txs", std::ios::binary),
+        tx_hashes(path + "/tx_hashes", std::ios::binary),
+        tx_offsets(path + "/tx_offsets", std::ios::binary),
+        tx_data(path + "/tx_data", std::ios::binary);
+    if (!headers || !block_txs || !tx_hashes || !tx_offsets || !tx_data)
+    {
+        log_error(LOG_SNAPSHOT) << "Couldn't create snapshot in " << path;
+        return false;
+    }
+    // Postings sort on the whole record since the big endian tx number
+    // and index that follow the address keep each address in chain order.
+    sorted_column<snapshot_hash_record, snapshot_hash_key_size>
+        block_hashes(path + "/block_hashes"), tx_lookup(path + "/tx_lookup");
+    sorted_column<snapshot_spend_record, snapshot_spend_key_size>
+        spends(path + "/spends");
+    sorted_column<snapshot_posting_record, sizeof(snapshot_posting_record)>
+        postings(path + "/postings");
+    bool written = true;
+    uint32_t tx_number = 0;
+    uint64_t data_offset = 0;
+    write_value(block_txs, tx_number);
+    write_value(tx_offsets, data_offset);
+    for (size_t depth = 0; depth <= last_depth; ++depth)
+    {
+        const block_type blk = chain.block(depth, ec);
+        if (ec)
+        {
+            log_error(LOG_SNAPSHOT) << "Couldn't fetch block " << depth
+                << ": " << ec.message();
+            return false;
+        }
+        uint8_t header[snapshot_header_size];
+        snapshot_save_header(blk, header);
+        headers.write(reinterpret_cast<const char*>(header), sizeof(header));
+        written = written && block_hashes.add(
+            make_hash_record(hash_block_header(blk), depth));
+        for (const transaction_type& tx: blk.transactions)
+        {
+            const hash_digest tx_hash = hash_transaction(tx);
+            tx_hashes.write(
+                reinterpret_cast<const char*>(tx_hash.data()), tx_hash.size());
+            data_chunk raw_tx(satoshi_raw_size(tx));
+            satoshi_save(tx, raw_tx.begin());
+            tx_data.write(
+                reinterpret_cast<const char*>(raw_tx.data()), raw_tx.size());
+            data_offset += raw_tx.size();
+            write_value(tx_offsets, data_offset);
+            written = written &&
+                tx_lookup.add(make_hash_record(tx_hash, tx_number));
+            for (uint32_t i = 0; i < tx.inputs.size() && !is_coinbase(tx); ++i)
+            {
+                const output_point& prevout = tx.inputs[i].previous_output;
+                snapshot_spend_record spend;
+                std::copy(prevout.hash.begin(), prevout.hash.end(),
+                    spend.hash);
+                snapshot_set_uint32(spend.index, prevout.index);
+                snapshot_set_uint32(spend.spend_tx, tx_number);
+                snapshot_set_uint32(spend.spend_index, i);
+                written = written && spends.add(spend);
+            }
+            for (uint32_t i = 0; i < tx.outputs.size(); ++i)
+            {
+                payment_address address;
+                if (!extract(address, tx.outputs[i].output_script))
+                    continue;
+                snapshot_posting_record posting;
+                posting.version = address.version();
+                const short_hash& address_hash = address.hash();
+                std::copy(address_hash.begin(), address_hash.end(),
+                    posting.hash);
+                snapshot_set_uint32(posting.tx, tx_number);
+                snapshot_set_uint32(posting.index, i);
+                written = written && postings.add(posting);
+            }
+            ++tx_number;
+        }
+        write_value(block_txs, tx_number);
+        if (!written)
+            return false;
+        if (depth % 10000 == 0)
+            echo() << "Exported block " << depth << " / " << last_depth;
+    }
+    echo() << "Sorting indexes...";
+    bool success = headers && block_txs && tx_hashes &&
+        tx_offsets && tx_data && postings.finish() &&
+        block_hashes.finish() && tx_lookup.finish() && spends.finish();
+    if (!success)
+    {
+        log_error(LOG_SNAPSHOT) << "Problem writing snapshot indexes.";
+        return false;
+    }
+    echo() << "Exported " << last_depth + 1 << " blocks and "
+        << tx_number << " transactions to " << path;
+    return true;
+}
+
@@ -0,0 +1,13 @@
+#ifndef QUERY_SNAPSHOT_EXPORT_HPP
+#define QUERY_SNAPSHOT_EXPORT_HPP
+
+#include <string>
+
+#include "sync_blockchain.hpp"
+
+// Writes every block up to the current last depth into a read-only
+// snapshot directory. See snapshot_format.hpp for the layout.
+bool export_snapshot(sync_blockchain& chain, const std::string& path);
+
+#endif
+
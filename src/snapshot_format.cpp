@@ -0,0 +1,43 @@
+#include "snapshot_format.hpp"
+
+using namespace bc;
+
+uint32_t snapshot_get_uint32(const uint8_t* data)
+{
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+void snapshot_set_uint32(uint8_t* data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+void snapshot_save_header(const block_type& blk, uint8_t* data)
+{
+    data_chunk raw(snapshot_header_size);
+    auto serial = make_serializer(raw.begin());
+    serial.write_4_bytes(blk.version);
+    serial.write_hash(blk.previous_block_hash);
+    serial.write_hash(blk.merkle);
+    serial.write_4_bytes(blk.timestamp);
+    serial.write_4_bytes(blk.bits);
+    serial.write_4_bytes(blk.nonce);
+    BITCOIN_ASSERT(serial.iterator() == raw.end());
+    std::copy(raw.begin(), raw.end(), data);
+}
+
+block_type snapshot_load_header(const uint8_t* data)
+{
+    block_type blk;
+    auto deserial = make_deserializer(data, data + snapshot_header_size);
+    blk.version = deserial.read_4_bytes();
+    blk.previous_block_hash = deserial.read_hash();
+    blk.merkle = deserial.read_hash();
+    blk.timestamp = deserial.read_4_bytes();
+    blk.bits = deserial.read_4_bytes();
+    blk.nonce = deserial.read_4_bytes();
+    return blk;
+}
+
@@ -0,0 +1,64 @@
+#ifndef QUERY_SNAPSHOT_FORMAT_HPP
+#define QUERY_SNAPSHOT_FORMAT_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+// A snapshot is a directory of flat files, one column per file:
+//
+//   headers       80 byte block headers indexed by depth.
+//   block_hashes  snapshot_hash_record sorted by hash, number = depth.
+//   block_txs     uint32 per depth plus one: first tx number of each block.
+//   tx_hashes     32 byte tx hashes in chain order, indexed by tx number.
+//   tx_offsets    uint64 per tx plus one: offsets into tx_data.
+//   tx_data       satoshi serialized transactions in chain order.
+//   tx_lookup     snapshot_hash_record sorted by hash, number = tx number.
+//   spends        snapshot_spend_record sorted by previous output.
+//   postings      snapshot_posting_record sorted by address, then chain order.
+//
+// Array files (block_txs, tx_offsets) use host byte order since they're
+// only ever mapped on the machine that serves them. Sorted record keys
+// are big endian so records compare with memcmp.
+
+constexpr size_t snapshot_header_size = 80;
+
+struct snapshot_hash_record
+{
+    uint8_t hash[32];
+    uint8_t number[4];
+};
+
+struct snapshot_spend_record
+{
+    uint8_t hash[32];
+    uint8_t index[4];
+    uint8_t spend_tx[4];
+    uint8_t spend_index[4];
+};
+
+struct snapshot_posting_record
+{
+    uint8_t version;
+    uint8_t hash[20];
+    uint8_t tx[4];
+    uint8_t index[4];
+};
+
+// Key sizes used for sorting and searching.
+constexpr size_t snapshot_hash_key_size = 32;
+constexpr size_t snapshot_spend_key_size = 32 + 4;
+constexpr size_t snapshot_address_key_size = 1 + 20;
+
+uint32_t snapshot_get_uint32(const uint8_t* data);
+void snapshot_set_uint32(uint8_t* data, uint32_t value);
+
+void snapshot_save_header(const bc::block_type& blk, uint8_t* data);
+bc::block_type snapshot_load_header(const uint8_t* data);
+
+template <typename Record, size_t KeySize>
+bool snapshot_key_less(const Record& left, const Record& right)
+{
+    return memcmp(&left, &right, KeySize) < 0;
+}
+
+#endif
+
@@ -0,0 +1,266 @@
+#include "snapshot_service.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include "echo.hpp"
+#include "server.hpp"
+#include "thriftify.hpp"
+
+using namespace bc;
+
+snapshot_service_handler::snapshot_service_handler(
+    config_map_type& config, const snapshot& snap, server_control& control)
+  : snapshot_(snap),
+    merkle_(boost::lexical_cast<size_t>(config["merkle-cache-size"])),
+    control_(control), stop_secret_(config["stop-secret"]),
+    time_range_max_headers_(
+        boost::lexical_cast<size_t>(config["time-range-max-headers"]))
+{
+    // A snapshot never changes, so the index is built once.
+    std::error_code ec;
+    if (!timestamps_.build(snapshot_, ec))
+        log_error() << "Couldn't load snapshot headers: " << ec.message();
+}
+
+void snapshot_service_handler::reload(config_map_type& config)
+{
+    merkle_.set_capacity(
+        boost::lexical_cast<size_t>(config["merkle-cache-size"]));
+    time_range_max_headers_ =
+        boost::lexical_cast<size_t>(config["time-range-max-headers"]);
+}
+
+bool snapshot_service_handler::stop(const std::string& secret)
+{
+    if (secret != stop_secret_)
+        return false;
+    echo() << "Stopping server...";
+    control_.stop();
+    return true;
+}
+
+void snapshot_service_handler::block_header_by_depth(
+    BlockHeader& blk, const int32_t depth)
+{
+    if (depth < 0)
+        throw_error("Invalid depth");
+    std::error_code ec;
+    auto header = snapshot_.block_header(depth, ec);
+    check_errc(ec);
+    thriftify_header(blk, header);
+}
+
+void snapshot_service_handler::block_header_by_hash(
+    BlockHeader& blk, const std::string& hash)
+{
+    std::error_code ec;
+    auto header = snapshot_.block_header(proper_hash(hash), ec);
+    check_errc(ec);
+    thriftify_header(blk, header);
+}
+
+void snapshot_service_handler::block_transaction_hashes_by_depth(
+    HashList& tx_hashes, const int32_t depth)
+{
+    if (depth < 0)
+        throw_error("Invalid depth");
+    std::error_code ec;
+    auto txs = snapshot_.block_transaction_hashes(depth, ec);
+    check_errc(ec);
+    thriftify_tx_hashes(tx_hashes, txs);
+}
+
+void snapshot_service_handler::block_transaction_hashes_by_hash(
+    HashList& tx_hashes, const std::string& hash)
+{
+    std::error_code ec;
+    auto txs = snapshot_.block_transaction_hashes(proper_hash(hash), ec);
+    check_errc(ec);
+    thriftify_tx_hashes(tx_hashes, txs);
+}
+
+int32_t snapshot_service_handler::block_depth(const std::string& hash)
+{
+    std::error_code ec;
+    auto depth = snapshot_.block_depth(proper_hash(hash), ec);
+    check_errc(ec);
+    return depth;
+}
+
+int32_t snapshot_service_handler::last_depth()
+{
+    std::error_code ec;
+    auto depth = snapshot_.last_depth(ec);
+    check_errc(ec);
+    return depth;
+}
+
+int32_t snapshot_service_handler::depth_at_time(const int64_t timestamp)
+{
+    if (!valid_timestamp(timestamp))
+        throw_error("Invalid timestamp");
+    std::error_code ec;
+    auto depth = timestamps_.depth_at_time(timestamp, ec);
+    check_errc(ec);
+    return depth;
+}
+
+void snapshot_service_handler::block_headers_in_time_range(
+    BlockHeaderList& headers, const int64_t from_time, const int64_t to_time)
+{
+    if (!valid_timestamp(from_time) || !valid_timestamp(to_time))
+        throw_error("Invalid timestamp");
+    thriftify_headers(headers, timestamps_.headers_in_range(
+        from_time, to_time, time_range_max_headers_));
+}
+
+void snapshot_service_handler::transaction(
+    Transaction& tx, const std::string& hash)
+{
+    std::error_code ec;
+    const transaction_type tmp_tx =
+        snapshot_.transaction(proper_hash(hash), ec);
+    check_errc(ec);
+    thriftify_transaction(tx, tmp_tx);
+}
+
+void snapshot_service_handler::transaction_index(
+    TransactionIndex& tx_index, const std::string& hash)
+{
+    std::error_code ec;
+    auto tidx = snapshot_.transaction_index(proper_hash(hash), ec);
+    check_errc(ec);
+    tx_index.depth = tidx.depth;
+    tx_index.offset = tidx.offset;
+}
+
+void snapshot_service_handler::spend(
+    InputPoint& inpoint, const OutputPoint& outpoint)
+{
+    std::error_code ec;
+    auto ipt = snapshot_.spend(proper_outpoint(outpoint), ec);
+    check_errc(ec);
+    inpoint.hash = to_binary(ipt.hash);
+    inpoint.index = ipt.index;
+}
+
+void snapshot_service_handler::outputs(
+    OutputPointList& outpoints, const std::string& address)
+{
+    std::error_code ec;
+    auto outs = snapshot_.outputs(address, ec);
+    check_errc(ec);
+    thriftify_outpoints(outpoints, outs);
+}
+
+void snapshot_service_handler::history(
+    History& history, const std::string& address)
+{
+    std::error_code ec;
+    history_t hist = snapshot_.history(address, ec);
+    check_errc(ec);
+    thriftify_history(history, hist);
+}
+
+void snapshot_service_handler::outputs_by_script(
+    OutputPointList& outpoints, const std::string& script_hash)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::history_by_script(
+    History& history, const std::string& script_hash)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::output_values(
+    OutputValues& values, const OutputPointList& outpoints)
+{
+    std::error_code ec;
+    output_value_list vals = snapshot_.output_values(
+        proper_outpoints(outpoints), ec);
+    check_errc(ec);
+    for (uint64_t value: vals)
+        values.push_back(value);
+}
+
+void snapshot_service_handler::merkle_proof(
+    MerkleProof& proof, const std::string& hash)
+{
+    std::error_code ec;
+    auto branch = merkle_branch(snapshot_, merkle_, proper_hash(hash), ec);
+    check_errc(ec);
+    thriftify_merkle_proof(proof, branch);
+}
+
+void snapshot_service_handler::block_stats(BlockStatsList& stats,
+    const int32_t start_depth, const int32_t count)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::blocks_raw(RawBlockList& blocks,
+    const int32_t start_depth, const int32_t count)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::trace_forward(TraceResult& trace,
+    const OutputPoint& outpoint,
+    const int32_t max_hops, const int32_t max_nodes)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::trace_backward(TraceResult& trace,
+    const std::string& hash, const int32_t max_hops, const int32_t max_nodes)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::history_since(HistoryDelta& delta,
+    const std::vector<std::string>& addresses,
+    const int32_t from_depth, const std::string& known_tip_hash)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::transaction_pool_transaction(
+    Transaction& tx, const std::string& hash)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void snapshot_service_handler::mempool_fee_histogram(
+    FeeHistogram& histogram)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+bool snapshot_service_handler::broadcast_transaction(
+    const std::string& tx_data)
+{
+    throw_error("Not available when serving a snapshot");
+    return false;
+}
+
+void snapshot_service_handler::broadcast_transactions(
+    BroadcastResultList& results, const std::vector<std::string>& txs_data)
+{
+    throw_error("Not available when serving a snapshot");
+}
+
+void start_snapshot_server(config_map_type& config, const snapshot& snap)
+{
+    server_control control;
+    boost::shared_ptr<snapshot_service_handler> handler(
+        new snapshot_service_handler(config, snap, control));
+    auto reload =
+        [handler](config_map_type& fresh)
+        {
+            handler->reload(fresh);
+        };
+    run_thrift_server(config, handler, control, reload);
+}
+
@@ -0,0 +1,80 @@
+#ifndef QUERY_SNAPSHOT_SERVICE_HPP
+#define QUERY_SNAPSHOT_SERVICE_HPP
+
+#include <atomic>
+#include "thrift/QueryService.h"
+#include "config.hpp"
+#include "merkle_tree.hpp"
+#include "server.hpp"
+#include "timestamp_index.hpp"
+#include "snapshot.hpp"
+
+// Stateless QueryService backed by a snapshot. There is no node, so
+// transaction pool and protocol methods throw ErrorCode.
+class snapshot_service_handler
+  : public QueryServiceIf
+{
+public:
+    snapshot_service_handler(config_map_type& config, const snapshot& snap,
+        server_control& control);
+    // Applies reloadable settings.
+    void reload(config_map_type& config);
+
+    bool stop(const std::string& secret);
+    // blockchain methods
+    void block_header_by_depth(BlockHeader& blk, const int32_t depth);
+    void block_header_by_hash(BlockHeader& blk, const std::string& hash);
+    void block_transaction_hashes_by_depth(
+        HashList& tx_hashes, const int32_t depth);
+    void block_transaction_hashes_by_hash(
+        HashList& tx_hashes, const std::string& hash);
+    int32_t block_depth(const std::string& hash);
+    int32_t last_depth();
+    int32_t depth_at_time(const int64_t timestamp);
+    void block_headers_in_time_range(BlockHeaderList& headers,
+        const int64_t from_time, const int64_t to_time);
+    void transaction(Transaction& tx, const std::string& hash);
+    void transaction_index(
+        TransactionIndex& tx_index, const std::string& hash);
+    void spend(InputPoint& inpoint, const OutputPoint& outpoint);
+    void outputs(OutputPointList& outpoints, const std::string& address);
+    // blockchain (composed) methods
+    void history(History& history, const std::string& address);
+    void outputs_by_script(OutputPointList& outpoints,
+        const std::string& script_hash);
+    void history_by_script(History& history, const std::string& script_hash);
+    void output_values(OutputValues& values, const OutputPointList& outpoints);
+    void merkle_proof(MerkleProof& proof, const std::string& hash);
+    void block_stats(BlockStatsList& stats,
+        const int32_t start_depth, const int32_t count);
+    void blocks_raw(RawBlockList& blocks,
+        const int32_t start_depth, const int32_t count);
+    void trace_forward(TraceResult& trace, const OutputPoint& outpoint,
+        const int32_t max_hops, const int32_t max_nodes);
+    void trace_backward(TraceResult& trace, const std::string& hash,
+        const int32_t max_hops, const int32_t max_nodes);
+    void history_since(HistoryDelta& delta,
+        const std::vector<std::string>& addresses,
+        const int32_t from_depth, const std::string& known_tip_hash);
+    // transaction pool methods
+    void transaction_pool_transaction(
+        Transaction& tx, const std::string& hash);
+    void mempool_fee_histogram(FeeHistogram& histogram);
+    // protocol methods
+    bool broadcast_transaction(const std::string& tx_data);
+    void broadcast_transactions(BroadcastResultList& results,
+        const std::vector<std::string>& txs_data);
+
+private:
+    const snapshot& snapshot_;
+    merkle_cache merkle_;
+    timestamp_index timestamps_;
+    server_control& control_;
+    const std::string stop_secret_;
+    std::atomic<size_t> time_range_max_headers_;
+};
+
+void start_snapshot_server(config_map_type& config, const snapshot& snap);
+
+#endif
+
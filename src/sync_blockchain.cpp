@@ -1,7 +1,5 @@
 #include "sync_blockchain.hpp"
 
-#include <future>
-
 #include "sync_get_impl.hpp"
 
 using namespace bc;
@@ -19,20 +17,18 @@ template <typename IndexType>
 block_type block_header_impl(blockchain& chain,
     IndexType index, std::error_code& ec)
 {
-    block_type block_header;
-    std::promise<bool> promise;
+    sync_state<block_type> state;
     auto handle_block_header =
-        [&ec, &block_header, &promise]
-            (const std::error_code& cec, const block_type& blk)
+        [&state](const std::error_code& cec, const block_type& blk)
         {
-            ec = cec;
-            block_header = blk;
-            promise.set_value(true);
+            state.ec = cec;
+            state.obj = blk;
+            state.waiter.notify();
         };
     chain.fetch_block_header(index, handle_block_header);
-    bool success = promise.get_future().get();
-    BITCOIN_ASSERT(success);
-    return block_header;
+    state.waiter.wait();
+    ec = state.ec;
+    return std::move(state.obj);
 }
 
 block_type sync_blockchain::block_header(size_t depth) const
@@ -58,24 +54,43 @@ block_type sync_blockchain::block_header(const hash_digest& block_hash,
     return block_header_impl(chain_, block_hash, ec);
 }
 
+block_type sync_blockchain::block(size_t depth) const
+{
+    std::error_code discard_ec;
+    return block(depth, discard_ec);
+}
+block_type sync_blockchain::block(size_t depth, std::error_code& ec) const
+{
+    sync_state<block_type> state;
+    auto handle_block =
+        [&state](const std::error_code& cec, const block_type& cblk)
+        {
+            state.ec = cec;
+            state.obj = cblk;
+            state.waiter.notify();
+        };
+    fetch_block(chain_, depth, handle_block);
+    state.waiter.wait();
+    ec = state.ec;
+    return std::move(state.obj);
+}
+
 template <typename IndexType>
 inventory_list block_tx_hashes_impl(blockchain& chain,
     IndexType index, std::error_code& ec)
 {
-    inventory_list hashes;
-    std::promise<bool> promise;
+    sync_state<inventory_list> state;
     auto handle_tx_hashes =
-        [&ec, &hashes, &promise]
-            (const std::error_code& cec, const inventory_list& chashes)
+        [&state](const std::error_code& cec, const inventory_list& chashes)
         {
-            ec = cec;
-            hashes = chashes;
-            promise.set_value(true);
+            state.ec = cec;
+            state.obj = chashes;
+            state.waiter.notify();
         };
     chain.fetch_block_transaction_hashes(index, handle_tx_hashes);
-    bool success = promise.get_future().get();
-    BITCOIN_ASSERT(success);
-    return hashes;
+    state.waiter.wait();
+    ec = state.ec;
+    return std::move(state.obj);
 }
 
 inventory_list sync_blockchain::block_transaction_hashes(
@@ -152,20 +167,18 @@ transaction_index_t sync_blockchain::transaction_index(
 transaction_index_t sync_blockchain::transaction_index(
     const hash_digest& transaction_hash, std::error_code& ec) const
 {
-    transaction_index_t tx_index;
-    std::promise<bool> promise;
+    sync_state<transaction_index_t> state;
     auto handle_tx_index =
-        [&ec, &tx_index, &promise]
-            (const std::error_code& cec, size_t depth, size_t offset)
+        [&state](const std::error_code& cec, size_t depth, size_t offset)
         {
-            ec = cec;
-            tx_index = {depth, offset};
-            promise.set_value(true);
+            state.ec = cec;
+            state.obj = {depth, offset};
+            state.waiter.notify();
         };
     chain_.fetch_transaction_index(transaction_hash, handle_tx_index);
-    bool success = promise.get_future().get();
-    BITCOIN_ASSERT(success);
-    return tx_index;
+    state.waiter.wait();
+    ec = state.ec;
+    return state.obj;
 }
 
 input_point sync_blockchain::spend(
@@ -205,23 +218,21 @@ history_t sync_blockchain::history(
 history_t sync_blockchain::history(
     const bc::payment_address& address, std::error_code& ec) const
 {
-    history_t history;
-    std::promise<bool> promise;
+    sync_state<history_t> state;
     auto handle_history =
-        [&ec, &history, &promise]
-            (const std::error_code& cec,
+        [&state](const std::error_code& cec,
              const output_point_list& outpoints,
              const input_point_list& inpoints)
         {
-            ec = cec;
-            history.outpoints = outpoints;
-            history.inpoints = inpoints;
-            promise.set_value(true);
+            state.ec = cec;
+            state.obj.outpoints = outpoints;
+            state.obj.inpoints = inpoints;
+            state.waiter.notify();
         };
     fetch_history(chain_, address, handle_history);
-    bool success = promise.get_future().get();
-    BITCOIN_ASSERT(success);
-    return history;
+    state.waiter.wait();
+    ec = state.ec;
+    return std::move(state.obj);
 }
 
 output_value_list sync_blockchain::output_values(
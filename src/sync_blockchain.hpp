@@ -26,6 +26,10 @@ public:
     bc::block_type block_header(const bc::hash_digest& block_hash,
         std::error_code& ec) const;
 
+    // Full block including its transactions.
+    bc::block_type block(size_t depth) const;
+    bc::block_type block(size_t depth, std::error_code& ec) const;
+
     bc::inventory_list block_transaction_hashes(
         size_t depth) const;
     bc::inventory_list block_transaction_hashes(
@@ -1,27 +1,120 @@
 #ifndef QUERY_SYNC_GET_IMPL_HPP
 #define QUERY_SYNC_GET_IMPL_HPP
 
-#include <future>
+#include <condition_variable>
+#include <mutex>
 #include <system_error>
+#include <utility>
+#include <vector>
+
+#include "request_trace.hpp"
+
+// Blocks a caller until an async handler has run. It lives on the
+// caller's stack, unlike std::promise whose shared state is allocated
+// on every call. Inside a traced request, the time until the handler
+// runs counts as the fetch stage and the time to resume as wake.
+class sync_waiter
+{
+public:
+    sync_waiter()
+      : traced_(current_trace() != nullptr)
+    {
+        if (traced_)
+            posted_ = trace_clock::now();
+    }
+    void notify()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (traced_)
+            notified_ = trace_clock::now();
+        done_ = true;
+        condition_.notify_one();
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return done_; });
+        if (!traced_)
+            return;
+        trace_add("fetch", notified_ - posted_);
+        trace_add("wake", trace_clock::now() - notified_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool done_ = false;
+    const bool traced_;
+    trace_clock::time_point posted_, notified_;
+};
+
+// Everything a handler fills in, so it captures a single pointer and
+// fits in std::function's small object buffer instead of being copied
+// to the heap.
+template <typename ReturnType>
+struct sync_state
+{
+    std::error_code ec;
+    ReturnType obj;
+    sync_waiter waiter;
+};
 
 template<typename ReturnType, typename FetchFunc, typename IndexType>
 ReturnType sync_get_impl(FetchFunc fetch,
     IndexType index, std::error_code& ec)
 {
-    ReturnType obj;
-    std::promise<bool> promise;
+    sync_state<ReturnType> state;
     auto handle =
-        [&ec, &obj, &promise]
-            (const std::error_code& cec, const ReturnType& cobj)
+        [&state](const std::error_code& cec, const ReturnType& cobj)
         {
-            ec = cec;
-            obj = cobj;
-            promise.set_value(true);
+            // Handlers only get a const reference, so this is the one
+            // copy left; the result moves from here on.
+            state.ec = cec;
+            state.obj = cobj;
+            state.waiter.notify();
         };
     fetch(index, handle);
-    bool success = promise.get_future().get();
-    BITCOIN_ASSERT(success);
-    return obj;
+    state.waiter.wait();
+    ec = state.ec;
+    return std::move(state.obj);
+}
+
+template <typename Result>
+struct fetched_list
+{
+    std::vector<std::error_code> errors;
+    std::vector<Result> results;
+};
+
+// Starts every fetch at once and waits for all of them to finish, so
+// the fetches run in parallel on the service's threads.
+template <typename Result, typename FetchFunc, typename IndexType>
+fetched_list<Result> sync_fetch_all(FetchFunc fetch,
+    const std::vector<IndexType>& indexes)
+{
+    trace_stage stage("fetch");
+    fetched_list<Result> all;
+    all.errors.resize(indexes.size());
+    all.results.resize(indexes.size());
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = indexes.size();
+    for (size_t i = 0; i < indexes.size(); ++i)
+    {
+        auto handle =
+            [&, i](const std::error_code& ec, const Result& result)
+            {
+                all.errors[i] = ec;
+                all.results[i] = result;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--remaining == 0)
+                    done.notify_one();
+            };
+        fetch(indexes[i], handle);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&remaining] { return remaining == 0; });
+    return all;
 }
 
 #endif
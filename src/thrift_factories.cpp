@@ -0,0 +1,40 @@
+#include "thrift_factories.hpp"
+
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TTransportUtils.h>
+
+#include "compressed_transport.hpp"
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+boost::shared_ptr<TProtocolFactory> make_protocol_factory(
+    const std::string& name)
+{
+    if (name == "binary")
+        return boost::shared_ptr<TProtocolFactory>(
+            new TBinaryProtocolFactory());
+    else if (name == "compact")
+        return boost::shared_ptr<TProtocolFactory>(
+            new TCompactProtocolFactory());
+    return nullptr;
+}
+
+boost::shared_ptr<TTransportFactory> make_transport_factory(
+    const std::string& name, size_t compression_threshold,
+    size_t compression_max_frame)
+{
+    if (name == "buffered")
+        return boost::shared_ptr<TTransportFactory>(
+            new TBufferedTransportFactory());
+    else if (name == "framed")
+        return boost::shared_ptr<TTransportFactory>(
+            new TFramedTransportFactory());
+    else if (name == "compressed")
+        return boost::shared_ptr<TTransportFactory>(
+            new compressed_transport_factory(
+                compression_threshold, compression_max_frame));
+    return nullptr;
+}
+
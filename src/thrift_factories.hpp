@@ -0,0 +1,20 @@
+#ifndef QUERY_THRIFT_FACTORIES_HPP
+#define QUERY_THRIFT_FACTORIES_HPP
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TTransport.h>
+
+// Protocol and transport factories by config name. Returns an empty
+// pointer for unknown names. Shared by the servers, the router's
+// backend connections and the client library.
+boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>
+    make_protocol_factory(const std::string& name);
+boost::shared_ptr<apache::thrift::transport::TTransportFactory>
+    make_transport_factory(
+        const std::string& name, size_t compression_threshold,
+        size_t compression_max_frame);
+
+#endif
+
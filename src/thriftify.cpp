@@ -0,0 +1,191 @@
+#include "thriftify.hpp"
+
+using namespace bc;
+
+void check_errc(const std::error_code& ec)
+{
+    if (ec)
+        throw_error(ec.message());
+}
+
+void throw_error(const std::string& why)
+{
+    ErrorCode except;
+    except.what = 0;
+    except.why = why;
+    throw except;
+}
+
+hash_digest proper_hash(const std::string& hash_str)
+{
+    hash_digest hash;
+    if (hash_str.size() != hash.size())
+        throw_error("Invalid hash");
+    std::copy(hash_str.begin(), hash_str.end(), hash.begin());
+    return hash;
+}
+
+output_point proper_outpoint(const OutputPoint& outpoint)
+{
+    return output_point{
+        proper_hash(outpoint.hash), (uint32_t)outpoint.index};
+}
+
+output_point_list proper_outpoints(const OutputPointList& outpoints)
+{
+    output_point_list outs;
+    proper_outpoints(outs, outpoints);
+    return outs;
+}
+void proper_outpoints(output_point_list& outs, const OutputPointList& outpoints)
+{
+    outs.clear();
+    outs.reserve(outpoints.size());
+    for (const OutputPoint& outpoint: outpoints)
+        outs.push_back(proper_outpoint(outpoint));
+}
+
+void thriftify_header(BlockHeader& blk, const block_type& header)
+{
+    blk.version = header.version;
+    blk.timestamp = header.timestamp;
+    assign_binary(blk.previous_block_hash, header.previous_block_hash);
+    assign_binary(blk.merkle, header.merkle);
+    blk.bits = header.bits;
+    blk.nonce = header.nonce;
+}
+
+void thriftify_headers(BlockHeaderList& blks,
+    const std::vector<block_type>& headers)
+{
+    blks.resize(headers.size());
+    for (size_t i = 0; i < headers.size(); ++i)
+        thriftify_header(blks[i], headers[i]);
+}
+
+void thriftify_tx_hashes(HashList& tx_hashes, const inventory_list& txs)
+{
+    tx_hashes.reserve(txs.size());
+    for (const auto& inv: txs)
+    {
+        BITCOIN_ASSERT(inv.type == inventory_type_id::transaction);
+        tx_hashes.push_back(to_binary(inv.hash));
+    }
+}
+
+void thriftify_transaction(Transaction& tx, const transaction_type& tmp_tx)
+{
+    tx.version = tmp_tx.version;
+    tx.locktime = tmp_tx.locktime;
+    // Elements are filled where they sit rather than built and copied in.
+    tx.inputs.resize(tmp_tx.inputs.size());
+    for (size_t i = 0; i < tmp_tx.inputs.size(); ++i)
+    {
+        const auto& tx_input = tmp_tx.inputs[i];
+        TransactionInput& in = tx.inputs[i];
+        assign_binary(in.previous_output.hash, tx_input.previous_output.hash);
+        in.previous_output.index = tx_input.previous_output.index;
+        assign_binary(in.input_script, save_script(tx_input.input_script));
+        in.sequence = tx_input.sequence;
+    }
+    tx.outputs.resize(tmp_tx.outputs.size());
+    for (size_t i = 0; i < tmp_tx.outputs.size(); ++i)
+    {
+        const auto& tx_output = tmp_tx.outputs[i];
+        TransactionOutput& out = tx.outputs[i];
+        out.value = tx_output.value;
+        assign_binary(out.output_script, save_script(tx_output.output_script));
+    }
+}
+
+void thriftify_outpoints(
+    OutputPointList& outpoints, const output_point_list& outs)
+{
+    outpoints.resize(outs.size());
+    for (size_t i = 0; i < outs.size(); ++i)
+    {
+        assign_binary(outpoints[i].hash, outs[i].hash);
+        outpoints[i].index = outs[i].index;
+    }
+}
+
+void thriftify_history(History& history, const history_t& hist)
+{
+    thriftify_outpoints(history.outpoints, hist.outpoints);
+    history.inpoints.resize(hist.inpoints.size());
+    for (size_t i = 0; i < hist.inpoints.size(); ++i)
+    {
+        assign_binary(history.inpoints[i].hash, hist.inpoints[i].hash);
+        history.inpoints[i].index = hist.inpoints[i].index;
+    }
+}
+
+BlockStats thriftify_block_stats(size_t depth, const block_stats_type& row)
+{
+    BlockStats stats;
+    stats.depth = depth;
+    stats.tx_count = row.tx_count;
+    stats.size = row.size;
+    stats.input_count = row.input_count;
+    stats.output_count = row.output_count;
+    stats.total_output_value = row.total_output_value;
+    stats.fees = row.fees;
+    return stats;
+}
+
+void thriftify_trace(TraceResult& trace, const trace_result_t& result)
+{
+    trace.edges.resize(result.edges.size());
+    for (size_t i = 0; i < result.edges.size(); ++i)
+    {
+        const trace_edge_t& edge = result.edges[i];
+        assign_binary(trace.edges[i].outpoint.hash, edge.outpoint.hash);
+        trace.edges[i].outpoint.index = edge.outpoint.index;
+        assign_binary(trace.edges[i].inpoint.hash, edge.inpoint.hash);
+        trace.edges[i].inpoint.index = edge.inpoint.index;
+    }
+    trace.truncated = result.truncated;
+}
+
+void thriftify_merkle_proof(MerkleProof& proof, const merkle_branch_t& branch)
+{
+    proof.branch.reserve(branch.branch.size());
+    for (const hash_digest& hash: branch.branch)
+        proof.branch.push_back(to_binary(hash));
+    proof.position = branch.position;
+    proof.depth = branch.depth;
+    proof.merkle = to_binary(branch.root);
+}
+
+void thriftify_history_rows(
+    HistoryRowList& rows, const history_row_list& history_rows)
+{
+    rows.resize(history_rows.size());
+    for (size_t i = 0; i < history_rows.size(); ++i)
+    {
+        const history_row_t& row = history_rows[i];
+        assign_binary(rows[i].outpoint.hash, row.outpoint.hash);
+        rows[i].outpoint.index = row.outpoint.index;
+        assign_binary(rows[i].inpoint.hash, row.inpoint.hash);
+        rows[i].inpoint.index = row.inpoint.index;
+        rows[i].is_spend = row.is_spend;
+        rows[i].depth = row.depth;
+    }
+}
+
+void thriftify_fee_histogram(
+    FeeHistogram& histogram, const fee_histogram_type& fees)
+{
+    histogram.buckets.resize(fees.buckets.size());
+    for (size_t i = 0; i < fees.buckets.size(); ++i)
+    {
+        const fee_bucket_type& bucket = fees.buckets[i];
+        histogram.buckets[i].min_fee_rate = bucket.min_fee_rate;
+        histogram.buckets[i].tx_count = bucket.tx_count;
+        histogram.buckets[i].total_size = bucket.total_size;
+        histogram.buckets[i].total_fees = bucket.total_fees;
+    }
+    histogram.tx_count = fees.tx_count;
+    histogram.total_size = fees.total_size;
+}
+
@@ -0,0 +1,58 @@
+#ifndef QUERY_THRIFTIFY_HPP
+#define QUERY_THRIFTIFY_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+#include "thrift/interface_types.h"
+#include "block_stats.hpp"
+#include "mempool_stats.hpp"
+#include "merkle_tree.hpp"
+#include "recent_history.hpp"
+#include "sync_blockchain.hpp"
+#include "transaction_graph.hpp"
+
+// Conversions between libbitcoin types and the generated Thrift types,
+// shared by every QueryService implementation.
+
+template <typename T>
+std::string to_binary(const T& bytes)
+{
+    return std::string(bytes.begin(), bytes.end());
+}
+
+// Fills binary in place, reusing whatever capacity it already has.
+template <typename T>
+void assign_binary(std::string& binary, const T& bytes)
+{
+    binary.assign(bytes.begin(), bytes.end());
+}
+
+// Throws ErrorCode if ec is set.
+void check_errc(const std::error_code& ec);
+// Throws ErrorCode with the given reason.
+void throw_error(const std::string& why);
+
+bc::hash_digest proper_hash(const std::string& hash_str);
+bc::output_point proper_outpoint(const OutputPoint& outpoint);
+bc::output_point_list proper_outpoints(const OutputPointList& outpoints);
+void proper_outpoints(
+    bc::output_point_list& outs, const OutputPointList& outpoints);
+
+void thriftify_header(BlockHeader& blk, const bc::block_type& header);
+void thriftify_headers(BlockHeaderList& blks,
+    const std::vector<bc::block_type>& headers);
+void thriftify_tx_hashes(HashList& tx_hashes, const bc::inventory_list& txs);
+void thriftify_transaction(Transaction& tx, const bc::transaction_type& tmp_tx);
+void thriftify_outpoints(
+    OutputPointList& outpoints, const bc::output_point_list& outs);
+void thriftify_history(History& history, const history_t& hist);
+BlockStats thriftify_block_stats(size_t depth, const block_stats_type& row);
+void thriftify_trace(TraceResult& trace, const trace_result_t& result);
+void thriftify_merkle_proof(MerkleProof& proof, const merkle_branch_t& branch);
+void thriftify_fee_histogram(
+    FeeHistogram& histogram, const fee_histogram_type& fees);
+void thriftify_history_rows(
+    HistoryRowList& rows, const history_row_list& history_rows);
+
+#endif
+
@@ -0,0 +1,59 @@
+#include "timestamp_index.hpp"
+
+using namespace bc;
+
+void timestamp_index::reorganize(size_t fork_point,
+    const blockchain::block_list& new_blocks)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (headers_.size() > fork_point + 1)
+    {
+        headers_.resize(fork_point + 1);
+        max_timestamps_.resize(fork_point + 1);
+    }
+    for (const auto& blk: new_blocks)
+    {
+        // Only keep the header fields.
+        block_type header = *blk;
+        header.transactions.clear();
+        append(header);
+    }
+}
+
+size_t timestamp_index::depth_at_time(
+    uint32_t timestamp, std::error_code& ec) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::lower_bound(
+        max_timestamps_.begin(), max_timestamps_.end(), timestamp);
+    if (it == max_timestamps_.end())
+    {
+        ec = error::not_found;
+        return 0;
+    }
+    return it - max_timestamps_.begin();
+}
+
+std::vector<block_type> timestamp_index::headers_in_range(
+    uint32_t from_time, uint32_t to_time, size_t max_headers) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto begin = std::lower_bound(
+        max_timestamps_.begin(), max_timestamps_.end(), from_time);
+    auto end = std::upper_bound(begin, max_timestamps_.end(), to_time);
+    if (static_cast<size_t>(end - begin) > max_headers)
+        end = begin + max_headers;
+    return std::vector<block_type>(
+        headers_.begin() + (begin - max_timestamps_.begin()),
+        headers_.begin() + (end - max_timestamps_.begin()));
+}
+
+void timestamp_index::append(const block_type& header)
+{
+    uint32_t max_timestamp = header.timestamp;
+    if (!max_timestamps_.empty())
+        max_timestamp = std::max(max_timestamp, max_timestamps_.back());
+    headers_.push_back(header);
+    max_timestamps_.push_back(max_timestamp);
+}
+
@@ -0,0 +1,65 @@
+#ifndef QUERY_TIMESTAMP_INDEX_HPP
+#define QUERY_TIMESTAMP_INDEX_HPP
+
+#include <limits>
+#include <mutex>
+#include <bitcoin/bitcoin.hpp>
+
+// Block timestamps are 32 bit, so wider request values can't match.
+inline bool valid_timestamp(int64_t timestamp)
+{
+    return timestamp >= 0 &&
+        timestamp <= std::numeric_limits<uint32_t>::max();
+}
+
+// In-memory headers with a running maximum of block timestamps, aligned
+// with depth. Block timestamps aren't monotonic but the running maximum
+// is, so time lookups are a binary search.
+class timestamp_index
+{
+public:
+    // Loads every header up to the chain's last depth.
+    template <typename Chain>
+    bool build(const Chain& chain, std::error_code& ec)
+    {
+        size_t last_depth = chain.last_depth(ec);
+        if (ec)
+            return false;
+        std::vector<bc::block_type> headers;
+        headers.reserve(last_depth + 1);
+        for (size_t depth = 0; depth <= last_depth; ++depth)
+        {
+            headers.push_back(chain.block_header(depth, ec));
+            if (ec)
+                return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        headers_.clear();
+        max_timestamps_.clear();
+        for (const bc::block_type& header: headers)
+            append(header);
+        return true;
+    }
+
+    // Drops blocks above fork_point and appends the new ones.
+    void reorganize(size_t fork_point,
+        const bc::blockchain::block_list& new_blocks);
+
+    // Lowest depth whose running max timestamp is at least timestamp.
+    size_t depth_at_time(uint32_t timestamp, std::error_code& ec) const;
+    // Headers of the blocks from depth_at_time(from_time) up to the last
+    // block whose running max timestamp is at most to_time, stopping
+    // after max_headers.
+    std::vector<bc::block_type> headers_in_range(
+        uint32_t from_time, uint32_t to_time, size_t max_headers) const;
+
+private:
+    void append(const bc::block_type& header);
+
+    mutable std::mutex mutex_;
+    std::vector<bc::block_type> headers_;
+    std::vector<uint32_t> max_timestamps_;
+};
+
+#endif
+
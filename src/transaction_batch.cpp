@@ -0,0 +1,42 @@
+#include "transaction_batch.hpp"
+
+#include <thread>
+
+using namespace bc;
+
+void parse_transactions(const std::vector<std::string>& txs_data,
+    std::vector<transaction_type>& txs, std::vector<uint8_t>& parsed)
+{
+    constexpr size_t min_chunk_size = 64;
+    txs.resize(txs_data.size());
+    parsed.assign(txs_data.size(), false);
+    const size_t thread_count =
+        std::max(std::thread::hardware_concurrency(), 1u);
+    const size_t chunk_size = std::max(min_chunk_size,
+        (txs_data.size() + thread_count - 1) / thread_count);
+    auto parse_chunk =
+        [&](size_t begin)
+        {
+            const size_t end = std::min(begin + chunk_size, txs_data.size());
+            for (size_t i = begin; i < end; ++i)
+                try
+                {
+                    satoshi_load(txs_data[i].begin(), txs_data[i].end(),
+                        txs[i]);
+                    parsed[i] = true;
+                }
+                catch (const bc::end_of_stream&)
+                {
+                }
+        };
+    std::vector<std::thread> workers;
+    for (size_t begin = chunk_size; begin < txs_data.size();
+        begin += chunk_size)
+    {
+        workers.emplace_back(parse_chunk, begin);
+    }
+    parse_chunk(0);
+    for (std::thread& worker: workers)
+        worker.join();
+}
+
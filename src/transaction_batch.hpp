@@ -0,0 +1,13 @@
+#ifndef QUERY_TRANSACTION_BATCH_HPP
+#define QUERY_TRANSACTION_BATCH_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+// Deserializes txs_data into txs in chunks spread over the hardware
+// threads. parsed[i] is set when txs[i] was read; it's a byte per
+// transaction since vector<bool> can't be written in parallel.
+void parse_transactions(const std::vector<std::string>& txs_data,
+    std::vector<bc::transaction_type>& txs, std::vector<uint8_t>& parsed);
+
+#endif
+
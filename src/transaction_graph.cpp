@@ -0,0 +1,110 @@
+#include "transaction_graph.hpp"
+
+#include <set>
+
+#include "sync_get_impl.hpp"
+
+using namespace bc;
+using std::placeholders::_1;
+using std::placeholders::_2;
+
+trace_result_t trace_forward(blockchain& chain,
+    const output_point& outpoint, size_t max_hops, size_t max_nodes)
+{
+    trace_result_t trace{std::vector<trace_edge_t>(), false};
+    std::set<hash_digest> visited{outpoint.hash};
+    std::vector<output_point> frontier{outpoint};
+    for (size_t hop = 0; hop < max_hops && !frontier.empty(); ++hop)
+    {
+        auto spends = sync_fetch_all<input_point>(
+            std::bind(&blockchain::fetch_spend, &chain, _1, _2), frontier);
+        std::vector<hash_digest> next_txs;
+        for (size_t i = 0; i < frontier.size(); ++i)
+        {
+            // Unspent outputs end this branch of the walk.
+            if (spends.errors[i])
+                continue;
+            const input_point& inpoint = spends.results[i];
+            if (trace.edges.size() >= max_nodes)
+            {
+                trace.truncated = true;
+                return trace;
+            }
+            trace.edges.push_back(trace_edge_t{frontier[i], inpoint});
+            if (!visited.insert(inpoint.hash).second)
+                continue;
+            if (visited.size() > max_nodes)
+            {
+                trace.truncated = true;
+                return trace;
+            }
+            next_txs.push_back(inpoint.hash);
+        }
+        frontier.clear();
+        if (hop + 1 == max_hops)
+            break;
+        auto txs = sync_fetch_all<transaction_type>(
+            std::bind(&blockchain::fetch_transaction, &chain, _1, _2),
+            next_txs);
+        for (size_t i = 0; i < next_txs.size(); ++i)
+        {
+            if (txs.errors[i])
+                continue;
+            for (uint32_t index = 0;
+                index < txs.results[i].outputs.size(); ++index)
+            {
+                // Every output costs a spend lookup on the next hop.
+                if (trace.edges.size() + frontier.size() >= max_nodes)
+                {
+                    trace.truncated = true;
+                    break;
+                }
+                frontier.push_back(output_point{next_txs[i], index});
+            }
+        }
+    }
+    return trace;
+}
+
+trace_result_t trace_backward(blockchain& chain,
+    const hash_digest& tx_hash, size_t max_hops, size_t max_nodes)
+{
+    trace_result_t trace{std::vector<trace_edge_t>(), false};
+    std::set<hash_digest> visited{tx_hash};
+    std::vector<hash_digest> frontier{tx_hash};
+    for (size_t hop = 0; hop < max_hops && !frontier.empty(); ++hop)
+    {
+        auto txs = sync_fetch_all<transaction_type>(
+            std::bind(&blockchain::fetch_transaction, &chain, _1, _2),
+            frontier);
+        std::vector<hash_digest> next_txs;
+        for (size_t i = 0; i < frontier.size(); ++i)
+        {
+            const transaction_type& tx = txs.results[i];
+            if (txs.errors[i] || is_coinbase(tx))
+                continue;
+            for (uint32_t index = 0; index < tx.inputs.size(); ++index)
+            {
+                const output_point& prevout = tx.inputs[index].previous_output;
+                if (trace.edges.size() >= max_nodes)
+                {
+                    trace.truncated = true;
+                    return trace;
+                }
+                trace.edges.push_back(
+                    trace_edge_t{prevout, input_point{frontier[i], index}});
+                if (!visited.insert(prevout.hash).second)
+                    continue;
+                if (visited.size() > max_nodes)
+                {
+                    trace.truncated = true;
+                    return trace;
+                }
+                next_txs.push_back(prevout.hash);
+            }
+        }
+        frontier.swap(next_txs);
+    }
+    return trace;
+}
+
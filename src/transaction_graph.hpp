@@ -0,0 +1,34 @@
+#ifndef QUERY_TRANSACTION_GRAPH_HPP
+#define QUERY_TRANSACTION_GRAPH_HPP
+
+#include <bitcoin/bitcoin.hpp>
+
+// An output and the input that spends it.
+struct trace_edge_t
+{
+    bc::output_point outpoint;
+    bc::input_point inpoint;
+};
+
+struct trace_result_t
+{
+    std::vector<trace_edge_t> edges;
+    // Set when max_nodes cut the walk short. Edges, transactions and
+    // outputs still waiting for a spend lookup all count against it.
+    bool truncated;
+};
+
+// Bounded breadth first walks over the spend graph. Each frontier is
+// fetched with one asynchronous request per node, so the chain spreads
+// a hop across its disk pool threads. Transactions are the nodes and
+// each is visited once.
+
+// Follows outpoint to the transactions spending it, then their outputs.
+trace_result_t trace_forward(bc::blockchain& chain,
+    const bc::output_point& outpoint, size_t max_hops, size_t max_nodes);
+// Follows tx_hash back through its inputs to the funding transactions.
+trace_result_t trace_backward(bc::blockchain& chain,
+    const bc::hash_digest& tx_hash, size_t max_hops, size_t max_nodes);
+
+#endif
+